@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef BITBUF_H
+#define BITBUF_H
+
+/**
+ * \file
+ *
+ * \brief Bit-granular writer and reader of the SCHC packets.
+ *
+ * The Compression Residue of a rule is the concatenation of the fields
+ * sent, each one using exactly its Field Length in bits, with no
+ * alignment. The bits are accumulated in a 64-bit word which is flushed
+ * to the buffer, in network byte order, only once it is full. The reader
+ * does the opposite, loading the buffer into a 64-bit word as needed.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct bit_writer {
+	uint8_t *buf;
+	size_t cap;       /** Size of buf, in bytes */
+	size_t len;       /** Bytes of buf already written */
+	uint64_t acc;     /** Pending bits, the last one in the LSB */
+	uint8_t nbits;    /** Number of pending bits in acc */
+	uint8_t overflow; /** Set if buf was too small */
+};
+
+struct bit_reader {
+	const uint8_t *buf;
+	size_t len;        /** Size of buf, in bytes */
+	size_t pos;        /** Next byte of buf to load in acc */
+	uint64_t acc;      /** Loaded bits, the next one in the MSB */
+	uint8_t nbits;     /** Number of loaded bits in acc */
+	uint8_t underflow; /** Set if more bits than available were read */
+};
+
+/**********************************************************************/
+/***        Inline Functions                                        ***/
+/**********************************************************************/
+
+static inline void bit_writer_init(struct bit_writer *w, uint8_t *buf, size_t cap)
+{
+	w->buf = buf;
+	w->cap = cap;
+	w->len = 0;
+	w->acc = 0;
+	w->nbits = 0;
+	w->overflow = 0;
+}
+
+/**
+ * \brief Number of bits written so far, pending ones included.
+ */
+static inline size_t bit_writer_bits(const struct bit_writer *w)
+{
+	return w->len * 8 + w->nbits;
+}
+
+/**
+ * \brief Writes the first n bytes of word, in network byte order.
+ */
+static inline void bit_writer_flush(struct bit_writer *w, uint64_t word, int n)
+{
+	if (w->len + n > w->cap) {
+		w->overflow = 1;
+		return;
+	}
+
+	for (int i = 0 ; i < n ; i++)
+		w->buf[w->len + i] = word >> (56 - 8 * i);
+
+	w->len += n;
+}
+
+/**
+ * \brief Appends the n least significant bits of value, the most
+ * significant one first.
+ *
+ * @param [in] n Number of bits to append, from 0 to 64.
+ */
+static inline void bit_writer_put(struct bit_writer *w, uint64_t value, uint8_t n)
+{
+	if (n < 64)
+		value &= (((uint64_t) 1) << n) - 1;
+
+	if (n < 64 - w->nbits) {
+		w->acc = (n == 0) ? w->acc : (w->acc << n) | value;
+		w->nbits += n;
+		return;
+	}
+
+	/*
+	 * The accumulator gets full: we flush a whole 64-bit word and keep
+	 * the bits of value that did not fit.
+	 */
+	uint8_t rest = n - (64 - w->nbits);
+	uint64_t word = value >> rest;
+
+	if (w->nbits != 0)
+		word |= w->acc << (64 - w->nbits);
+
+	bit_writer_flush(w, word, 8);
+
+	w->acc = value;
+	w->nbits = rest;
+}
+
+/**
+ * \brief Appends len bytes. If the writer is byte-aligned, they are
+ * copied as they are, otherwise they go through the accumulator, 8 bytes
+ * at a time.
+ */
+static inline void bit_writer_put_bytes(struct bit_writer *w, const uint8_t *src, size_t len)
+{
+	if ((w->nbits % 8) == 0) {
+
+		if (w->nbits != 0)
+			bit_writer_flush(w, w->acc << (64 - w->nbits), w->nbits / 8);
+		w->acc = 0;
+		w->nbits = 0;
+
+		if (w->len + len > w->cap) {
+			w->overflow = 1;
+			return;
+		}
+
+		memcpy(w->buf + w->len, src, len);
+		w->len += len;
+		return;
+	}
+
+	for ( ; len >= 8 ; src += 8, len -= 8) {
+		uint64_t word = 0;
+
+		for (int i = 0 ; i < 8 ; i++)
+			word = (word << 8) | src[i];
+
+		bit_writer_put(w, word, 64);
+	}
+
+	for ( ; len > 0 ; src++, len--)
+		bit_writer_put(w, *src, 8);
+}
+
+/**
+ * \brief Appends the first nbits bits of src, as written by another
+ * bit_writer.
+ */
+static inline void bit_writer_put_bits(struct bit_writer *w, const uint8_t *src, size_t nbits)
+{
+	bit_writer_put_bytes(w, src, nbits / 8);
+
+	if (nbits % 8 != 0)
+		bit_writer_put(w, src[nbits / 8] >> (8 - nbits % 8), nbits % 8);
+}
+
+/**
+ * \brief Flushes the pending bits, padding the last byte with zeros.
+ *
+ * @return The number of bytes written to the buffer, or -1 if it was
+ * too small.
+ */
+static inline int bit_writer_finish(struct bit_writer *w)
+{
+	if (w->nbits != 0)
+		bit_writer_flush(w, w->acc << (64 - w->nbits), (w->nbits + 7) / 8);
+
+	w->acc = 0;
+	w->nbits = 0;
+
+	return w->overflow ? -1 : (int) w->len;
+}
+
+static inline void bit_reader_init(struct bit_reader *r, const uint8_t *buf, size_t len)
+{
+	r->buf = buf;
+	r->len = len;
+	r->pos = 0;
+	r->acc = 0;
+	r->nbits = 0;
+	r->underflow = 0;
+}
+
+/**
+ * \brief Number of bits not read yet.
+ */
+static inline size_t bit_reader_left(const struct bit_reader *r)
+{
+	return r->nbits + (r->len - r->pos) * 8;
+}
+
+/**
+ * \brief Loads whole bytes of the buffer into the accumulator, while
+ * they fit.
+ */
+static inline void bit_reader_refill(struct bit_reader *r)
+{
+	while (r->nbits <= 56 && r->pos < r->len) {
+		r->acc |= ((uint64_t) r->buf[r->pos++]) << (56 - r->nbits);
+		r->nbits += 8;
+	}
+}
+
+/**
+ * \brief Reads the next n bits, the first one read becomes the most
+ * significant one of the value returned.
+ *
+ * @param [in] n Number of bits to read, from 0 to 64.
+ */
+static inline uint64_t bit_reader_get(struct bit_reader *r, uint8_t n)
+{
+	if (n > 56) {
+		uint64_t high = bit_reader_get(r, n - 32);
+		return (high << 32) | bit_reader_get(r, 32);
+	}
+
+	bit_reader_refill(r);
+
+	if (n > r->nbits) {
+		r->underflow = 1;
+		return 0;
+	}
+
+	if (n == 0)
+		return 0;
+
+	uint64_t value = r->acc >> (64 - n);
+
+	r->acc <<= n;
+	r->nbits -= n;
+
+	return value;
+}
+
+/**
+ * \brief Reads len bytes. If the reader is byte-aligned they are copied
+ * as they are, otherwise they go through the accumulator.
+ */
+static inline void bit_reader_get_bytes(struct bit_reader *r, uint8_t *dst, size_t len)
+{
+	if (len * 8 > bit_reader_left(r)) {
+		r->underflow = 1;
+		return;
+	}
+
+	if ((r->nbits % 8) == 0) {
+
+		for ( ; r->nbits != 0 && len > 0 ; dst++, len--)
+			*dst = bit_reader_get(r, 8);
+
+		memcpy(dst, r->buf + r->pos, len);
+		r->pos += len;
+		return;
+	}
+
+	for ( ; len > 0 ; dst++, len--)
+		*dst = bit_reader_get(r, 8);
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* BITBUF_H */
+
+// vim:tw=72
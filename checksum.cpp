@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the checksum.h functions.
+ *
+ * All the optimized versions sum the data as native 16-bit words, which
+ * is allowed by the byte order independence of the one's complement sum
+ * (RFC 1071, section 2.B), and swap the result once at the end if the
+ * host is little-endian.
+ *
+ * The 64-bit scalar version adds 32-bit words to a 64-bit accumulator,
+ * so the carries do not need to be folded until the end. The SIMD
+ * versions widen the 16-bit words to 32-bit lanes and add them, flushing
+ * the lanes to a 64-bit accumulator before they can overflow.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "checksum.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define CHECKSUM_SIMD
+#endif
+
+/**
+ * Below this length, the SIMD setup costs more than what it saves.
+ */
+#define CHECKSUM_SIMD_MIN_LEN 64
+
+/**
+ * Maximum number of SIMD iterations before flushing the 32-bit lanes.
+ * Every iteration adds at most 2 * 0xFFFF to a lane.
+ */
+#define CHECKSUM_SIMD_CHUNK 16384
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static inline uint16_t fold16(uint64_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return sum;
+}
+
+/**
+ * \brief Converts a folded sum of native words to a sum of big-endian
+ * words.
+ */
+static inline uint16_t native_to_be(uint16_t sum)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return (sum << 8) | (sum >> 8);
+#else
+	return sum;
+#endif
+}
+
+/**
+ * \brief Sums the data as native words. If dst is not NULL the data is
+ * also copied to it.
+ */
+static uint64_t sum_native(uint8_t *dst, const uint8_t *buf, size_t len)
+{
+	uint64_t sum = 0;
+
+	for ( ; len >= 16 ; buf += 16, len -= 16) {
+		uint64_t w[2];
+
+		memcpy(w, buf, sizeof(w));
+		if (dst != NULL) {
+			memcpy(dst, w, sizeof(w));
+			dst += sizeof(w);
+		}
+
+		sum += (w[0] & 0xFFFFFFFF) + (w[0] >> 32);
+		sum += (w[1] & 0xFFFFFFFF) + (w[1] >> 32);
+	}
+
+	for ( ; len >= 4 ; buf += 4, len -= 4) {
+		uint32_t w;
+
+		memcpy(&w, buf, sizeof(w));
+		if (dst != NULL) {
+			memcpy(dst, &w, sizeof(w));
+			dst += sizeof(w);
+		}
+
+		sum += w;
+	}
+
+	if (len > 0) {
+		/*
+		 * The missing bytes of the last word are zero.
+		 */
+		uint32_t w = 0;
+
+		memcpy(&w, buf, len);
+		if (dst != NULL)
+			memcpy(dst, buf, len);
+
+		sum += w;
+	}
+
+	return sum;
+}
+
+#ifdef CHECKSUM_SIMD
+
+__attribute__((target("sse2")))
+static uint64_t sum_sse2(uint8_t *dst, const uint8_t *buf, size_t nblocks)
+{
+	const __m128i zero = _mm_setzero_si128();
+	uint64_t sum = 0;
+
+	while (nblocks > 0) {
+
+		size_t n = (nblocks < CHECKSUM_SIMD_CHUNK) ? nblocks : CHECKSUM_SIMD_CHUNK;
+		__m128i acc = zero;
+		uint32_t lanes[4];
+
+		nblocks -= n;
+
+		for ( ; n > 0 ; n--, buf += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) buf);
+
+			if (dst != NULL) {
+				_mm_storeu_si128((__m128i *) dst, v);
+				dst += 16;
+			}
+
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+		}
+
+		_mm_storeu_si128((__m128i *) lanes, acc);
+		sum += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static uint64_t sum_avx2(uint8_t *dst, const uint8_t *buf, size_t nblocks)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	uint64_t sum = 0;
+
+	while (nblocks > 0) {
+
+		size_t n = (nblocks < CHECKSUM_SIMD_CHUNK) ? nblocks : CHECKSUM_SIMD_CHUNK;
+		__m256i acc = zero;
+		uint32_t lanes[8];
+
+		nblocks -= n;
+
+		for ( ; n > 0 ; n--, buf += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) buf);
+
+			if (dst != NULL) {
+				_mm256_storeu_si256((__m256i *) dst, v);
+				dst += 32;
+			}
+
+			acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+			acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+		}
+
+		_mm256_storeu_si256((__m256i *) lanes, acc);
+		for (int i = 0 ; i < 8 ; i++)
+			sum += lanes[i];
+	}
+
+	return sum;
+}
+
+static int cpu_has_avx2(void)
+{
+	static int avx2 = -1;
+
+	if (avx2 < 0) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+
+	return avx2;
+}
+
+#endif /* CHECKSUM_SIMD */
+
+/**
+ * \brief Sums (and copies, if dst is not NULL) the data with the fastest
+ * version available.
+ */
+static uint16_t sum_any(uint8_t *dst, const uint8_t *buf, size_t len)
+{
+	uint64_t sum = 0;
+
+#ifdef CHECKSUM_SIMD
+	if (len >= CHECKSUM_SIMD_MIN_LEN) {
+		size_t done;
+
+		if (cpu_has_avx2()) {
+			done = len & ~(size_t) 31;
+			sum = sum_avx2(dst, buf, done / 32);
+		} else {
+			done = len & ~(size_t) 15;
+			sum = sum_sse2(dst, buf, done / 16);
+		}
+
+		buf += done;
+		len -= done;
+		if (dst != NULL)
+			dst += done;
+	}
+#endif /* CHECKSUM_SIMD */
+
+	sum += sum_native(dst, buf, len);
+
+	return native_to_be(fold16(sum));
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+uint16_t checksum_ref(const uint8_t *buf, size_t len)
+{
+	uint32_t sum = 0;
+
+	for ( ; len > 1 ; buf += 2, len -= 2)
+		sum += buf[0] << 8 | buf[1];
+
+	if (len > 0)
+		sum += buf[0] << 8;
+
+	return ~fold16(sum);
+}
+
+uint32_t checksum_partial(const uint8_t *buf, size_t len, uint32_t sum)
+{
+	return fold16((uint64_t) sum + sum_any(NULL, buf, len));
+}
+
+uint32_t checksum_copy_partial(uint8_t *dst, const uint8_t *src, size_t len,
+		uint32_t sum)
+{
+	return fold16((uint64_t) sum + sum_any(dst, src, len));
+}
+
+uint16_t checksum_fold(uint32_t sum)
+{
+	return ~fold16(sum);
+}
+
+uint16_t checksum_update16(uint16_t checksum, uint16_t old_word, uint16_t new_word)
+{
+	uint32_t sum = (uint16_t) ~checksum;
+
+	sum += (uint16_t) ~old_word;
+	sum += new_word;
+
+	return checksum_fold(sum);
+}
+
+uint16_t checksum_update(uint16_t checksum, const uint8_t *old_data,
+		const uint8_t *new_data, size_t len)
+{
+	uint32_t sum = (uint16_t) ~checksum;
+
+	/*
+	 * Adding the complement of the sum of the old words is the same as
+	 * adding the complement of every old word.
+	 */
+	sum += checksum_fold(checksum_partial(old_data, len, 0));
+	sum += checksum_partial(new_data, len, 0);
+
+	return checksum_fold(sum);
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
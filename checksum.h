@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+/**
+ * \file
+ *
+ * \brief Internet checksum (RFC 1071) used by the COMPUTE_CHECKSUM CDA.
+ *
+ * The checksum is built from partial sums, so a packet can be summed in
+ * pieces (pseudo-header, header, payload) and only folded at the end.
+ * A partial sum is the one's complement sum of the 16-bit big-endian
+ * words of the data, not folded to 16 bits and not complemented.
+ *
+ * \note When a packet is summed in pieces, all of them but the last must
+ * have an even length, otherwise the bytes of the next piece are paired
+ * wrong.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Reference implementation: sums the data 16 bits at a time and
+ * returns the checksum (folded and complemented).
+ *
+ * It is kept to verify the optimized versions, use checksum_partial()
+ * instead.
+ */
+uint16_t checksum_ref(const uint8_t *buf, size_t len);
+
+/**
+ * \brief Adds the data to a partial sum.
+ *
+ * The data is summed 64 bits at a time with the carries deferred until
+ * the end, or with SSE2/AVX2 on x86 hosts when available.
+ *
+ * @param [in] sum The partial sum of the previous pieces, 0 for the
+ * first one.
+ *
+ * @return The new partial sum.
+ */
+uint32_t checksum_partial(const uint8_t *buf, size_t len, uint32_t sum);
+
+/**
+ * \brief Same as checksum_partial(), but it also copies the data to dst
+ * in the same pass.
+ */
+uint32_t checksum_copy_partial(uint8_t *dst, const uint8_t *src, size_t len,
+		uint32_t sum);
+
+/**
+ * \brief Folds a partial sum to 16 bits and complements it, giving the
+ * checksum to write in the packet (in host byte order).
+ */
+uint16_t checksum_fold(uint32_t sum);
+
+/**
+ * \brief Updates a checksum when a 16-bit word of the data changes,
+ * without summing the data again (RFC 1624, eqn. 3).
+ *
+ * @param [in] checksum The checksum of the old data.
+ * @param [in] old_word The old value of the word, host byte order.
+ * @param [in] new_word The new value of the word, host byte order.
+ *
+ * @return The checksum of the new data.
+ */
+uint16_t checksum_update16(uint16_t checksum, uint16_t old_word, uint16_t new_word);
+
+/**
+ * \brief Updates a checksum when some bytes of the data change, for
+ * instance when only the headers of a packet are rewritten.
+ *
+ * @param [in] old_data The old bytes, len bytes long.
+ * @param [in] new_data The new bytes, len bytes long.
+ * @param [in] len Must be even, and the bytes must start at an even
+ * offset of the data.
+ *
+ * @return The checksum of the new data.
+ */
+uint16_t checksum_update(uint16_t checksum, const uint8_t *old_data,
+		const uint8_t *new_data, size_t len);
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* CHECKSUM_H */
+
+// vim:tw=72
@@ -41,6 +41,14 @@
 /***        Include files                                           ***/
 /**********************************************************************/
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 /**********************************************************************/
 /***        Local Include files                                     ***/
 /**********************************************************************/
@@ -52,10 +60,15 @@
 /***        Macro Definitions                                       ***/
 /**********************************************************************/
 
+#define NROWS (sizeof(rules) / sizeof(rules[0]))
+
+#define INDEX_END 0xFF
+
 /**********************************************************************/
 /***        Types Definitions                                       ***/
 /**********************************************************************/
 
+
 /**********************************************************************/
 /***        Forward Declarations                                    ***/
 /**********************************************************************/
@@ -78,175 +91,1229 @@
  * compression/decompression to a packet (if it matches).
  *
  * \note Because we use uint8_t type as Rule ID, we can have as many as
- * 255 rules. (Very unlikely for our purposes right now).
+ * 255 rules. (Very unlikely for our purposes right now). The rules are
+ * found through a hash index on their address/port TVs, so the number
+ * of rules does not change the cost of compressing a packet.
+ *
+ * \note As the draft requires, among the rules that match, the one
+ * used to compress is the one giving the shortest Compression Residue.
+ * The length of the residue of every rule is computed once by
+ * schc_compile_rules(). If several rules give the same length, the one
+ * with the lowest Rule ID is used.
  *
- * \note The first rule that matches is the one which will be used to
- * compress. In the draft, the procedure should find the one which
- * matches and also offers the better Compression size, but in our
- * implementation, the first that matches is the one that is used. TODO
- * Think about how to implement this.
+ * \note The rows are packed (see struct packed_field) and stay in flash:
+ * on the MCU they are read from there every time they are used, so the
+ * rules take no RAM. The TVs are numbers, checked against the Field
+ * Length only once, by schc_compile_rules(), which refuses the whole
+ * context if any row is not valid.
  *
- * \note The TV must be a valid string. Also, the format is not checked
- * before parsing, this is extremely dangerous in the case of
- * IPV6_DEV_PREFIX, IPV6_DEVIID, etc. Extreme caution must be taken when
- * writing the rules to make sure that the format is right.
+ * \note A MSB row gives x of MSB(x) in its last column, and its CDA
+ * is usually LSB, which sends the Field Length - x bits left. The TV
+ * of a MATCH_MAPPING row is not used, its last column is the number of
+ * its list of values, and its CDA is usually MAPPING_SENT, which sends
+ * the position of the value in the list. One such rule covers a whole
+ * prefix or a set of ports.
  *
- * TODO It should not use a fixed size of [14], it should be dynamic
- * size of rows. Think about this. The ammount of rules should be
- * computed at runtime in the for() loops.
+ * \note SCHC_ROW_END marks the end of a rule.
  */
-struct field_description rules[][23] = {
-	
-	{ /* Dummy rule 0: fport can not be 0 */ 
-		/* Field;              FL; FP;DI; TV;                 MO;     CA; */
-		{ IPV6_VERSION,        4,  1, BI, "1",                EQUALS, NOT_SENT         },
-		{ IPV6_TRAFFIC_CLASS,  8,  1, BI, "0",                EQUALS, NOT_SENT         },
-		{ IPV6_FLOW_LABEL,     20, 1, BI, "0",                IGNORE, NOT_SENT         },
-		{ IPV6_PAYLOAD_LENGTH, 16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ IPV6_NEXT_HEADER,    8,  1, BI, "17",               EQUALS, NOT_SENT         },
-		{ IPV6_HOP_LIMIT,      8,  1, BI, "64",               IGNORE, NOT_SENT         },
-		{ IPV6_DEV_PREFIX,     64, 1, BI, "1234567891234567", EQUALS, NOT_SENT         },
-		{ IPV6_DEVIID,         64, 1, BI, "7157084458723854", EQUALS, NOT_SENT         },
-		{ IPV6_APP_PREFIX,     64, 1, BI, "1234567890123456", EQUALS, NOT_SENT         },
-		{ IPV6_APPIID,         64, 1, BI, "1478585784768976", EQUALS, NOT_SENT         },
-
-		{ UDP_DEVPORT,         16, 1, BI, "0",             	  IGNORE, VALUE_SENT       },
-		{ UDP_APPPORT,         16, 1, BI, "5683",             IGNORE, NOT_SENT         },
-		{ UDP_LENGTH,          16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ UDP_CHECKSUM,        16, 1, BI, "0",                IGNORE, COMPUTE_CHECKSUM },
-
-
-	},
-
-	  /* Message to send via arduino: mac tx uncnf 1 e7db19eb4d6a0b0773746f726167653130 */
-		/* Field;              FL; FP;DI; TV;                 MO;     CA; */
-		{ IPV6_VERSION,        4,  1, BI, "6",                EQUALS, NOT_SENT         },
-		{ IPV6_TRAFFIC_CLASS,  8,  1, BI, "0",                EQUALS, NOT_SENT         },
-		{ IPV6_FLOW_LABEL,     20, 1, BI, "0",                IGNORE, NOT_SENT         },
-		{ IPV6_PAYLOAD_LENGTH, 16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ IPV6_NEXT_HEADER,    8,  1, BI, "17",               EQUALS, NOT_SENT         },
-		{ IPV6_HOP_LIMIT,      8,  1, BI, "64",               IGNORE, NOT_SENT         },
-		{ IPV6_DEV_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_DEVIID,         64, 1, BI, "080027fffe000000", EQUALS, NOT_SENT         },
-		{ IPV6_APP_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_APPIID,         64, 1, BI, "0a0027fffe656550", EQUALS, NOT_SENT         },
-
-		{ UDP_DEVPORT,         16, 1, BI, "59355",       	  EQUALS, NOT_SENT	       },
-		{ UDP_APPPORT,         16, 1, BI, "5683",             EQUALS, NOT_SENT         },
-		{ UDP_LENGTH,          16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ UDP_CHECKSUM,        16, 1, BI, "0",                IGNORE, COMPUTE_CHECKSUM },
-
-
-	},
-
-		/* Field;              FL; FP;DI; TV;                 MO;     CA; */
-		{ IPV6_VERSION,        4,  1, BI, "6",                EQUALS, NOT_SENT         },
-		{ IPV6_TRAFFIC_CLASS,  8,  1, BI, "0",                EQUALS, NOT_SENT         },
-		{ IPV6_FLOW_LABEL,     20, 1, BI, "0",                IGNORE, NOT_SENT         },
-		{ IPV6_PAYLOAD_LENGTH, 16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ IPV6_NEXT_HEADER,    8,  1, BI, "17",               EQUALS, NOT_SENT         },
-		{ IPV6_HOP_LIMIT,      8,  1, BI, "64",               IGNORE, NOT_SENT         },
-		{ IPV6_DEV_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_DEVIID,         64, 1, BI, "080027fffe000000", EQUALS, NOT_SENT         },
-		{ IPV6_APP_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_APPIID,         64, 1, BI, "30f008da05cbe19a", EQUALS, NOT_SENT         },
-
-		{ UDP_DEVPORT,         16, 1, BI, "59355",       	  EQUALS, NOT_SENT	       },
-		{ UDP_APPPORT,         16, 1, BI, "5683",             EQUALS, NOT_SENT         },
-		{ UDP_LENGTH,          16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ UDP_CHECKSUM,        16, 1, BI, "0",                IGNORE, COMPUTE_CHECKSUM },
-
-
-	},
-
-		/* Field;              FL; FP;DI; TV;                 MO;     CA; */
-		{ IPV6_VERSION,        4,  1, BI, "6",                EQUALS, NOT_SENT         },
-		{ IPV6_TRAFFIC_CLASS,  8,  1, BI, "0",                EQUALS, NOT_SENT         },
-		{ IPV6_FLOW_LABEL,     20, 1, BI, "0",                IGNORE, NOT_SENT         },
-		{ IPV6_PAYLOAD_LENGTH, 16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ IPV6_NEXT_HEADER,    8,  1, BI, "17",               EQUALS, NOT_SENT         },
-		{ IPV6_HOP_LIMIT,      8,  1, BI, "64",               IGNORE, NOT_SENT         },
-		{ IPV6_DEV_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_DEVIID,         64, 1, BI, "080027fffe000000", EQUALS, NOT_SENT         },
-		{ IPV6_APP_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_APPIID,         64, 1, BI, "30f008da05cbe19a", EQUALS, NOT_SENT         },
-
-		{ UDP_DEVPORT,         16, 1, BI, "59355",         	  EQUALS, NOT_SENT	       },
-		{ UDP_APPPORT,         16, 1, BI, "5683",             EQUALS, NOT_SENT         },
-		{ UDP_LENGTH,          16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ UDP_CHECKSUM,        16, 1, BI, "0",                IGNORE, COMPUTE_CHECKSUM },
-
-
-	},
-
-		/* Field;              FL; FP;DI; TV;                 MO;     CA; */
-		{ IPV6_VERSION,        4,  1, BI, "6",                EQUALS, NOT_SENT         },
-		{ IPV6_TRAFFIC_CLASS,  8,  1, BI, "0",                EQUALS, NOT_SENT         },
-		{ IPV6_FLOW_LABEL,     20, 1, BI, "0",                IGNORE, NOT_SENT         },
-		{ IPV6_PAYLOAD_LENGTH, 16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ IPV6_NEXT_HEADER,    8,  1, BI, "17",               EQUALS, NOT_SENT         },
-		{ IPV6_HOP_LIMIT,      8,  1, BI, "64",               IGNORE, NOT_SENT         },
-		{ IPV6_DEV_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_DEVIID,         64, 1, BI, "080027fffe000000", EQUALS, NOT_SENT         },
-		{ IPV6_APP_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_APPIID,         64, 1, BI, "30f008da05cbe19a", EQUALS, NOT_SENT         },
-
-		{ UDP_DEVPORT,         16, 1, BI, "59355",         	  EQUALS, NOT_SENT	       },
-		{ UDP_APPPORT,         16, 1, BI, "5683",             EQUALS, NOT_SENT         },
-		{ UDP_LENGTH,          16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ UDP_CHECKSUM,        16, 1, BI, "0",                IGNORE, COMPUTE_CHECKSUM },
-
-
-	},
-
-	  /* Message to send via arduino: mac tx uncnf 1 e7dbc3a256650b03786d6c */
-		/* Field;              FL; FP;DI; TV;                 MO;     CA; */
-		{ IPV6_VERSION,        4,  1, BI, "6",                EQUALS, NOT_SENT         },
-		{ IPV6_TRAFFIC_CLASS,  8,  1, BI, "0",                EQUALS, NOT_SENT         },
-		{ IPV6_FLOW_LABEL,     20, 1, BI, "0",                IGNORE, NOT_SENT         },
-		{ IPV6_PAYLOAD_LENGTH, 16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ IPV6_NEXT_HEADER,    8,  1, BI, "17",               EQUALS, NOT_SENT         },
-		{ IPV6_HOP_LIMIT,      8,  1, BI, "64",               IGNORE, NOT_SENT         },
-		{ IPV6_DEV_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_DEVIID,         64, 1, BI, "080027fffe000000", EQUALS, NOT_SENT         },
-		{ IPV6_APP_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_APPIID,         64, 1, BI, "30f008da05cbe19a", EQUALS, NOT_SENT         },
-
-		{ UDP_DEVPORT,         16, 1, BI, "0",             	  IGNORE, VALUE_SENT       },
-		{ UDP_APPPORT,         16, 1, BI, "5683",             IGNORE, NOT_SENT         },
-		{ UDP_LENGTH,          16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ UDP_CHECKSUM,        16, 1, BI, "0",                IGNORE, COMPUTE_CHECKSUM },
-
-
-	},
-
-		/* Field;              FL; FP;DI; TV;                 MO;     CA; */
-		{ IPV6_VERSION,        4,  1, BI, "6",                EQUALS, NOT_SENT         },
-		{ IPV6_TRAFFIC_CLASS,  8,  1, BI, "0",                EQUALS, NOT_SENT         },
-		{ IPV6_FLOW_LABEL,     20, 1, BI, "0",                IGNORE, NOT_SENT         },
-		{ IPV6_PAYLOAD_LENGTH, 16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ IPV6_NEXT_HEADER,    8,  1, BI, "17",               EQUALS, NOT_SENT         },
-		{ IPV6_HOP_LIMIT,      8,  1, BI, "64",               IGNORE, NOT_SENT         },
-		{ IPV6_DEV_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_DEVIID,         64, 1, BI, "080027fffe000000", EQUALS, NOT_SENT         },
-		{ IPV6_APP_PREFIX,     64, 1, BI, "FE80000000000000", EQUALS, NOT_SENT         },
-		{ IPV6_APPIID,         64, 1, BI, "30f008da05cbe19a", EQUALS, NOT_SENT         },
-
-		{ UDP_DEVPORT,         16, 1, BI, "0",             	  IGNORE, VALUE_SENT       },
-		{ UDP_APPPORT,         16, 1, BI, "5683",             IGNORE, NOT_SENT         },
-		{ UDP_LENGTH,          16, 1, BI, "0",                IGNORE, COMPUTE_LENGTH   },
-		{ UDP_CHECKSUM,        16, 1, BI, "0",                IGNORE, COMPUTE_CHECKSUM },
-
-
-	},
+static const struct packed_field rules[] PROGMEM = {
+
+	/* Dummy rule 0: fport can not be 0 */
+	/*       Field;              FL; DI; TV;                  MO;     CA;               MSB */
+	SCHC_ROW(IPV6_VERSION,        4, BI, 1,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_TRAFFIC_CLASS,  8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_FLOW_LABEL,    20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_PAYLOAD_LENGTH,16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(IPV6_NEXT_HEADER,    8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_HOP_LIMIT,      8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEV_PREFIX,    64, BI, 0x1234567891234567, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEVIID,        64, BI, 0x7157084458723854, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APP_PREFIX,    64, BI, 0x1234567890123456, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APPIID,        64, BI, 0x1478585784768976, EQUALS, NOT_SENT,         0),
+
+	SCHC_ROW(UDP_DEVPORT,        16, BI, 0,                  IGNORE, VALUE_SENT,       0),
+	SCHC_ROW(UDP_APPPORT,        16, BI, 5683,               IGNORE, NOT_SENT,         0),
+	SCHC_ROW(UDP_LENGTH,         16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(UDP_CHECKSUM,       16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+	SCHC_ROW_END,
+
+	/* Message to send via arduino: mac tx uncnf 1 e7db19eb4d6a0b0773746f726167653130 */
+	/*       Field;              FL; DI; TV;                  MO;     CA;               MSB */
+	SCHC_ROW(IPV6_VERSION,        4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_TRAFFIC_CLASS,  8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_FLOW_LABEL,    20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_PAYLOAD_LENGTH,16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(IPV6_NEXT_HEADER,    8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_HOP_LIMIT,      8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEV_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEVIID,        64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APP_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APPIID,        64, BI, 0x0A0027FFFE656550, EQUALS, NOT_SENT,         0),
+
+	SCHC_ROW(UDP_DEVPORT,        16, BI, 59355,              EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_APPPORT,        16, BI, 5683,               EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_LENGTH,         16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(UDP_CHECKSUM,       16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+	SCHC_ROW_END,
+
+	/*       Field;              FL; DI; TV;                  MO;     CA;               MSB */
+	SCHC_ROW(IPV6_VERSION,        4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_TRAFFIC_CLASS,  8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_FLOW_LABEL,    20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_PAYLOAD_LENGTH,16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(IPV6_NEXT_HEADER,    8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_HOP_LIMIT,      8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEV_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEVIID,        64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APP_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APPIID,        64, BI, 0x30F008DA05CBE19A, EQUALS, NOT_SENT,         0),
 
+	SCHC_ROW(UDP_DEVPORT,        16, BI, 59355,              EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_APPPORT,        16, BI, 5683,               EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_LENGTH,         16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(UDP_CHECKSUM,       16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+	SCHC_ROW_END,
+
+	/*       Field;              FL; DI; TV;                  MO;     CA;               MSB */
+	SCHC_ROW(IPV6_VERSION,        4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_TRAFFIC_CLASS,  8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_FLOW_LABEL,    20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_PAYLOAD_LENGTH,16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(IPV6_NEXT_HEADER,    8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_HOP_LIMIT,      8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEV_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEVIID,        64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APP_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APPIID,        64, BI, 0x30F008DA05CBE19A, EQUALS, NOT_SENT,         0),
+
+	SCHC_ROW(UDP_DEVPORT,        16, BI, 59355,              EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_APPPORT,        16, BI, 5683,               EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_LENGTH,         16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(UDP_CHECKSUM,       16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+	SCHC_ROW_END,
+
+	/*       Field;              FL; DI; TV;                  MO;     CA;               MSB */
+	SCHC_ROW(IPV6_VERSION,        4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_TRAFFIC_CLASS,  8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_FLOW_LABEL,    20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_PAYLOAD_LENGTH,16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(IPV6_NEXT_HEADER,    8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_HOP_LIMIT,      8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEV_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEVIID,        64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APP_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APPIID,        64, BI, 0x30F008DA05CBE19A, EQUALS, NOT_SENT,         0),
+
+	SCHC_ROW(UDP_DEVPORT,        16, BI, 59355,              EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_APPPORT,        16, BI, 5683,               EQUALS, NOT_SENT,         0),
+	SCHC_ROW(UDP_LENGTH,         16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(UDP_CHECKSUM,       16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+	SCHC_ROW_END,
+
+	/* Message to send via arduino: mac tx uncnf 1 e7dbc3a256650b03786d6c */
+	/*       Field;              FL; DI; TV;                  MO;     CA;               MSB */
+	SCHC_ROW(IPV6_VERSION,        4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_TRAFFIC_CLASS,  8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_FLOW_LABEL,    20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_PAYLOAD_LENGTH,16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(IPV6_NEXT_HEADER,    8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_HOP_LIMIT,      8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEV_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEVIID,        64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APP_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APPIID,        64, BI, 0x30F008DA05CBE19A, EQUALS, NOT_SENT,         0),
+
+	SCHC_ROW(UDP_DEVPORT,        16, BI, 0,                  IGNORE, VALUE_SENT,       0),
+	SCHC_ROW(UDP_APPPORT,        16, BI, 5683,               IGNORE, NOT_SENT,         0),
+	SCHC_ROW(UDP_LENGTH,         16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(UDP_CHECKSUM,       16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+	SCHC_ROW_END,
+
+	/*       Field;              FL; DI; TV;                  MO;     CA;               MSB */
+	SCHC_ROW(IPV6_VERSION,        4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_TRAFFIC_CLASS,  8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_FLOW_LABEL,    20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_PAYLOAD_LENGTH,16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(IPV6_NEXT_HEADER,    8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_HOP_LIMIT,      8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEV_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_DEVIID,        64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APP_PREFIX,    64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_ROW(IPV6_APPIID,        64, BI, 0x30F008DA05CBE19A, EQUALS, NOT_SENT,         0),
+
+	SCHC_ROW(UDP_DEVPORT,        16, BI, 0,                  IGNORE, VALUE_SENT,       0),
+	SCHC_ROW(UDP_APPPORT,        16, BI, 5683,               IGNORE, NOT_SENT,         0),
+	SCHC_ROW(UDP_LENGTH,         16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_ROW(UDP_CHECKSUM,       16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+	SCHC_ROW_END,
 
 };
 
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
 /**********************************************************************/
 /***        AUX Functions                                           ***/
 /**********************************************************************/
 
+#ifndef SCHC_FLASH_RULES
+
+/**
+ * \brief Returns 1 if the TV of the field is written in hexadecimal.
+ */
+static int tv_is_hex(enum fieldid fieldid)
+{
+	switch (fieldid) {
+		case IPV6_DEV_PREFIX:
+		case IPV6_DEVIID:
+		case IPV6_APP_PREFIX:
+		case IPV6_APPIID:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * \brief Parses one value of a TV, which ends at the end of the string
+ * or at a space. *p is left after the value.
+ *
+ * @return 0 if successfull, -1 if the value is malformed or does not
+ * fit in the Field Length.
+ */
+static int parse_value(const char **p, int base, size_t field_length,
+		uint64_t *value)
+{
+	int ndigits = 0;
+
+	*value = 0;
+
+	for ( ; **p != '\0' && **p != ' ' ; (*p)++, ndigits++) {
+		char c = **p;
+		int digit;
+
+		if (c >= '0' && c <= '9')
+			digit = c - '0';
+		else if (base == 16 && c >= 'a' && c <= 'f')
+			digit = c - 'a' + 10;
+		else if (base == 16 && c >= 'A' && c <= 'F')
+			digit = c - 'A' + 10;
+		else
+			return -1;
+
+		if (*value > (UINT64_MAX - digit) / base)
+			return -1; /* overflow */
+
+		*value = *value * base + digit;
+	}
+
+	if (ndigits == 0)
+		return -1;
+
+	if (field_length < 64 && (*value >> field_length) != 0)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * \brief Parses the TV of a rule row into its binary slot.
+ *
+ * @return 0 if successfull, -1 if the TV is malformed or the value
+ * does not fit in the Field Length.
+ */
+static int parse_tv(const struct field_description *row, uint8_t slot[SCHC_FIELD_LEN])
+{
+	const char *p = row->tv;
+	uint64_t value;
+
+	if (p == NULL || row->field_length == 0 ||
+	    row->field_length > SCHC_FIELD_LEN * 8) {
+		return -1;
+	}
+
+	if (parse_value(&p, tv_is_hex(row->fieldid) ? 16 : 10,
+			row->field_length, &value) != 0 || *p != '\0')
+		return -1;
+
+	schc_slot_set(slot, value);
+
+	return 0;
+}
+
+#endif /* SCHC_FLASH_RULES */
+
+static uint32_t mapping_hash(uint16_t seed, uint64_t value)
+{
+	value ^= seed * 0x9E3779B97F4A7C15ULL;
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDULL;
+	value ^= value >> 33;
+
+	return value;
+}
+
+/**
+ * \brief Chooses the seed of every bucket of a mapping, so that every
+ * value gets a slot of its own.
+ *
+ * The buckets are placed from the biggest to the smallest, trying
+ * seeds until all the values of the bucket fall on free slots.
+ *
+ * @return 0 if successfull, -1 if the list has duplicated values or no
+ * seed was found.
+ */
+static int mapping_build(struct schc_ruleset *ruleset, const struct schc_mapping *m)
+{
+	uint8_t bucket[SCHC_MAX_MAPPING_LEN];
+	uint8_t size[SCHC_MAX_MAPPING_LEN];
+	uint8_t used[SCHC_MAX_MAPPING_LEN];
+	uint64_t values[SCHC_MAX_MAPPING_LEN];
+
+	memset(size, 0, sizeof(size));
+	memset(used, 0, sizeof(used));
+
+	for (int i = 0 ; i < m->n ; i++) {
+		values[i] = schc_slot_get(ruleset->map_values[m->first + i]);
+		bucket[i] = mapping_hash(0, values[i]) % m->n;
+		size[bucket[i]]++;
+
+		for (int j = 0 ; j < i ; j++) {
+			if (values[j] == values[i])
+				return -1;
+		}
+
+		ruleset->map_seed[m->first + i] = 0;
+	}
+
+	for (int k = m->n ; k > 0 ; k--) {
+		for (int b = 0 ; b < m->n ; b++) {
+
+			if (size[b] != k)
+				continue;
+
+			uint16_t seed;
+
+			for (seed = 1 ; seed != 0 ; seed++) {
+				int i;
+
+				for (i = 0 ; i < m->n ; i++) {
+					if (bucket[i] != b)
+						continue;
+
+					uint8_t slot = mapping_hash(seed, values[i]) % m->n;
+
+					if (used[slot])
+						break;
+
+					used[slot] = 1;
+					ruleset->map_slot[m->first + slot] = i;
+				}
+
+				if (i == m->n)
+					break;
+
+				/* Some slot was taken, we free the ones of this try */
+				for (int j = 0 ; j < i ; j++) {
+					if (bucket[j] == b)
+						used[mapping_hash(seed, values[j]) % m->n] = 0;
+				}
+			}
+
+			if (seed == 0)
+				return -1;
+
+			ruleset->map_seed[m->first + b] = seed;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Starts a new mapping of the rule set, with no values.
+ *
+ * @return The mapping, or NULL if there is no room for it.
+ */
+static struct schc_mapping *mapping_new(struct schc_ruleset *ruleset)
+{
+	if (ruleset->nmappings == SCHC_MAX_MAPPINGS)
+		return NULL;
+
+	struct schc_mapping *m = &ruleset->mappings[ruleset->nmappings];
+
+	m->first = 0;
+	if (ruleset->nmappings != 0)
+		m->first = m[-1].first + m[-1].n;
+	m->n = 0;
+
+	return m;
+}
+
+/**
+ * \brief Appends a value to the list of a new mapping.
+ *
+ * @return 0 if successfull, -1 if there is no room for it.
+ */
+static int mapping_add(struct schc_ruleset *ruleset, struct schc_mapping *m,
+		uint64_t value)
+{
+	if (m->n == SCHC_MAX_MAPPING_LEN || m->first + m->n == SCHC_MAPPING_VALUES)
+		return -1;
+
+	schc_slot_set(ruleset->map_values[m->first + m->n], value);
+	m->n++;
+
+	return 0;
+}
+
+/**
+ * \brief Builds the hash table of a new mapping, once all its values
+ * are added, and makes it part of the rule set.
+ *
+ * @return The number of the mapping, or -1 if it is not valid.
+ */
+static int mapping_finish(struct schc_ruleset *ruleset, struct schc_mapping *m)
+{
+	if (m->n == 0)
+		return -1;
+
+	for (m->index_bits = 0 ; (1U << m->index_bits) < m->n ; m->index_bits++)
+		;
+
+	if (mapping_build(ruleset, m) != 0)
+		return -1;
+
+	return ruleset->nmappings++;
+}
+
+#ifndef SCHC_FLASH_RULES
+
+/**
+ * \brief Parses the list of values of a MATCH_MAPPING row, separated by
+ * spaces, into a new mapping of the rule set.
+ *
+ * @return The number of the mapping, or -1 if the list is malformed or
+ * there is no room for it.
+ */
+static int parse_mapping(struct schc_ruleset *ruleset,
+		const struct field_description *row)
+{
+	const char *p = row->tv;
+	int base = tv_is_hex(row->fieldid) ? 16 : 10;
+	struct schc_mapping *m = mapping_new(ruleset);
+
+	if (p == NULL || m == NULL || row->field_length == 0 ||
+	    row->field_length > SCHC_FIELD_LEN * 8) {
+		return -1;
+	}
+
+	for (;;) {
+		uint64_t value;
+
+		if (parse_value(&p, base, row->field_length, &value) != 0 ||
+		    mapping_add(ruleset, m, value) != 0)
+			return -1;
+
+		if (*p == '\0')
+			break;
+		p++;
+	}
+
+	return mapping_finish(ruleset, m);
+}
+
+#endif /* SCHC_FLASH_RULES */
+
+/**
+ * \brief Sets x of MSB(x) of a row: only the x most significant bits
+ * of the TV are kept, the rest are the ones sent by LSB.
+ *
+ * @return 0 if successfull, -1 if x is longer than the field.
+ */
+static int field_set_msb(struct compiled_field *field, int msb_length)
+{
+	if (msb_length < 0 || msb_length > field->field_length)
+		return -1;
+
+	field->lsb_bits = field->field_length - msb_length;
+
+	uint64_t tv = schc_slot_get(field->tv);
+
+	if (field->lsb_bits == 64)
+		tv = 0;
+	else
+		tv &= ~((((uint64_t) 1) << field->lsb_bits) - 1);
+
+	schc_slot_set(field->tv, tv);
+
+	return 0;
+}
+
+/**
+ * \brief Checks that a compiled row is valid: known field, MO and CDA,
+ * a Field Length up to 64 bits with a TV that fits in it, and the CDA
+ * which need a given MO have it.
+ *
+ * @return 0 if it is valid, -1 otherwise.
+ */
+static int field_check(const struct schc_ruleset *ruleset,
+		const struct compiled_field *field)
+{
+	if (field->fieldid >= SCHC_FIELDS_COUNT || field->MO > MSB ||
+	    field->CDA > APPIID || field->direction > BI ||
+	    field->field_length == 0 || field->field_length > 64 ||
+	    field->lsb_bits > field->field_length)
+		return -1;
+
+	if (field->field_length < 64 &&
+	    (schc_slot_get(field->tv) >> field->field_length) != 0)
+		return -1;
+
+	if ((field->CDA == LSB && field->MO != MSB) ||
+	    (field->CDA == MAPPING_SENT && field->MO != MATCH_MAPPING) ||
+	    (field->MO == MATCH_MAPPING && field->mapping >= ruleset->nmappings))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * \brief Reads a word of the mapping lists given to
+ * schc_ruleset_compile_packed(), which are in flash.
+ */
+static uint64_t packed_word_read(const uint64_t *word)
+{
+#ifdef __AVR__
+	uint64_t value;
+
+	memcpy_P(&value, word, sizeof(value));
+	return value;
+#else
+	return *word;
+#endif
+}
+
+/**
+ * \brief Empties the rule set before compiling new rules into it. The
+ * index and the rule matrix are emptied too, so if the compilation
+ * fails, nothing is left of the previous rules.
+ */
+static void ruleset_reset(struct schc_ruleset *ruleset)
+{
+	ruleset->nrules = 0;
+#ifndef SCHC_FLASH_RULES
+	ruleset->nfields = 0;
+#endif
+	ruleset->nmappings = 0;
+	ruleset->flow_fields = 0;
+	ruleset->generation++;
+
+	ruleset->index.nkeys = 0;
+	memset(ruleset->index.bucket, INDEX_END, sizeof(ruleset->index.bucket));
+#ifdef SCHC_RULE_MATRIX
+	ruleset->matrix.nwords = 0;
+#endif
+}
+
+/**
+ * \brief Hashes the fields selected by key_fields.
+ *
+ * fields points to an array of SCHC_FIELDS_COUNT slots, indexed by
+ * fieldid, so the same function hashes the TVs of a rule and the fields
+ * of a packet.
+ */
+static uint16_t index_hash(uint8_t key, uint16_t key_fields,
+		const uint8_t fields[][SCHC_FIELD_LEN])
+{
+	uint32_t h = 2166136261UL ^ key; /* FNV-1a */
+
+	for (int id = 0 ; id < SCHC_FIELDS_COUNT ; id++) {
+
+		if (!(key_fields & (1U << id)))
+			continue;
+
+		for (int i = 0 ; i < SCHC_FIELD_LEN ; i++) {
+			h ^= fields[id][i];
+			h *= 16777619UL;
+		}
+	}
+
+	return (h ^ (h >> 16)) & (SCHC_INDEX_BUCKETS - 1);
+}
+
+/**
+ * \brief Returns the key (the set of indexable EQUALS fields) of a rule.
+ */
+static uint16_t rule_key_fields(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule)
+{
+	uint16_t key_fields = 0;
+	struct compiled_field tmp;
+
+	for (int i = 0 ; i < rule->nfields ; i++) {
+		const struct compiled_field *field = rule_field(ruleset, rule, i, &tmp);
+
+		if (field->MO == EQUALS)
+			key_fields |= (1U << field->fieldid);
+	}
+
+	return key_fields & SCHC_INDEX_FIELDS;
+}
+
+/**
+ * \brief Computes the length of the Compression Residue of a rule from
+ * the CDA and Field Length of its rows.
+ */
+static uint16_t rule_residue_bits(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule)
+{
+	uint16_t bits = 0;
+	struct compiled_field tmp;
+
+	for (int i = 0 ; i < rule->nfields ; i++) {
+		const struct compiled_field *field = rule_field(ruleset, rule, i, &tmp);
+
+		if (field->CDA == VALUE_SENT)
+			bits += field->field_length;
+		else if (field->CDA == LSB)
+			bits += field->lsb_bits;
+		else if (field->CDA == MAPPING_SENT)
+			bits += ruleset->mappings[field->mapping].index_bits;
+	}
+
+	return bits;
+}
+
+/**
+ * \brief Returns the fields of a rule whose value decides if the rule
+ * matches or goes into the Compression Residue.
+ */
+static uint16_t rule_flow_fields(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule)
+{
+	uint16_t flow_fields = 0;
+	struct compiled_field tmp;
+
+	for (int i = 0 ; i < rule->nfields ; i++) {
+		const struct compiled_field *field = rule_field(ruleset, rule, i, &tmp);
+
+		if (field->MO != IGNORE || (field->CDA != NOT_SENT &&
+		    field->CDA != COMPUTE_LENGTH && field->CDA != COMPUTE_CHECKSUM))
+			flow_fields |= (1U << field->fieldid);
+	}
+
+	return flow_fields;
+}
+
+#ifdef SCHC_RULE_MATRIX
+
+/**
+ * \brief Puts a row of a rule in its lane of the rule matrix.
+ *
+ * @return 0 if successfull, -1 if the row can not be put in the masks,
+ * the rule is partial then.
+ */
+static int matrix_add_row(struct rule_matrix *matrix, int block, int lane,
+		const struct compiled_field *field, uint16_t *fields)
+{
+	uint64_t mask;
+
+	if (field->MO == IGNORE)
+		return 0;
+
+	if (field->MO == MATCH_MAPPING || (*fields & (1U << field->fieldid)))
+		return -1;
+
+	*fields |= 1U << field->fieldid;
+
+	if (field->MO == EQUALS)
+		mask = ~(uint64_t) 0;
+	else if (field->lsb_bits == 64)
+		mask = 0;
+	else
+		mask = ~(uint64_t) 0 << field->lsb_bits;
+
+	/*
+	 * The masks are stored with the byte order of the TVs, so the words
+	 * of the packet are compared as they are in struct header_fields.
+	 */
+	uint8_t slot[SCHC_FIELD_LEN];
+
+	schc_slot_set(slot, mask);
+
+	for (int half = 0 ; half < SCHC_FIELD_LEN / 4 ; half++) {
+		int w = field->fieldid * SCHC_FIELD_LEN / 4 + half;
+
+		memcpy(&matrix->value[block][w][lane], field->tv + 4 * half, 4);
+		memcpy(&matrix->mask[block][w][lane], slot + 4 * half, 4);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Builds the rule matrix from the compiled rules, if there are
+ * no more than SCHC_MATRIX_MAX_RULES. It is left empty otherwise.
+ *
+ * The words are first stored at their position in the header, and then
+ * the ones no rule matches are dropped.
+ */
+static void rule_matrix_build(struct schc_ruleset *ruleset)
+{
+	struct rule_matrix *matrix = &ruleset->matrix;
+
+	memset(matrix, 0, sizeof(*matrix));
+
+	if (ruleset->nrules > SCHC_MATRIX_MAX_RULES)
+		return;
+
+	/* Insertion sort of the rules, the best first */
+	for (size_t i = 0 ; i < ruleset->nrules ; i++) {
+		size_t j = i;
+
+		for ( ; j > 0 && rule_is_better(&ruleset->rules[i],
+				&ruleset->rules[matrix->order[j - 1]]) ; j--)
+			matrix->order[j] = matrix->order[j - 1];
+
+		matrix->order[j] = i;
+	}
+
+	for (size_t i = 0 ; i < ruleset->nrules ; i++) {
+		const struct compiled_rule *rule = &ruleset->rules[matrix->order[i]];
+		uint16_t fields = 0;
+		struct compiled_field tmp;
+
+		for (int j = 0 ; j < rule->nfields ; j++) {
+			if (matrix_add_row(matrix, i / SCHC_MATRIX_LANES,
+					   i % SCHC_MATRIX_LANES,
+					   rule_field(ruleset, rule, j, &tmp), &fields) != 0)
+				matrix->partial[rule->rule_id] = 1;
+		}
+	}
+
+	for (int w = 0 ; w < SCHC_MATRIX_WORDS ; w++) {
+		int used = 0;
+
+		for (int b = 0 ; b < SCHC_MATRIX_BLOCKS ; b++) {
+			for (int lane = 0 ; lane < SCHC_MATRIX_LANES ; lane++)
+				used |= matrix->mask[b][w][lane] != 0;
+		}
+
+		if (!used)
+			continue;
+
+		for (int b = 0 ; b < SCHC_MATRIX_BLOCKS ; b++) {
+			memmove(matrix->value[b][matrix->nwords], matrix->value[b][w],
+				sizeof(matrix->value[b][w]));
+			memmove(matrix->mask[b][matrix->nwords], matrix->mask[b][w],
+				sizeof(matrix->mask[b][w]));
+		}
+
+		matrix->word[matrix->nwords++] = w;
+	}
+}
+
+/**
+ * \brief Checks a packet against the SCHC_MATRIX_LANES rules of a block.
+ *
+ * @return Bit n set if lane n matches.
+ */
+static uint32_t matrix_block_match(const struct rule_matrix *matrix, int block,
+		const uint32_t *hw)
+{
+#if defined(__AVX2__)
+	__m256i acc = _mm256_setzero_si256();
+
+	for (int w = 0 ; w < matrix->nwords ; w++) {
+		__m256i h = _mm256_set1_epi32(hw[w]);
+		__m256i v = _mm256_loadu_si256((const __m256i *) matrix->value[block][w]);
+		__m256i m = _mm256_loadu_si256((const __m256i *) matrix->mask[block][w]);
+
+		acc = _mm256_or_si256(acc, _mm256_and_si256(_mm256_xor_si256(h, v), m));
+	}
+
+	return _mm256_movemask_ps(_mm256_castsi256_ps(
+			_mm256_cmpeq_epi32(acc, _mm256_setzero_si256())));
+
+#elif defined(__SSE2__)
+	__m128i lo = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+
+	for (int w = 0 ; w < matrix->nwords ; w++) {
+		__m128i h = _mm_set1_epi32(hw[w]);
+		const __m128i *v = (const __m128i *) matrix->value[block][w];
+		const __m128i *m = (const __m128i *) matrix->mask[block][w];
+
+		lo = _mm_or_si128(lo, _mm_and_si128(_mm_xor_si128(h, _mm_loadu_si128(v)),
+						    _mm_loadu_si128(m)));
+		hi = _mm_or_si128(hi, _mm_and_si128(_mm_xor_si128(h, _mm_loadu_si128(v + 1)),
+						    _mm_loadu_si128(m + 1)));
+	}
+
+	return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lo, _mm_setzero_si128()))) |
+	       _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(hi, _mm_setzero_si128()))) << 4;
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint32_t lane_bits[4] = { 1, 2, 4, 8 };
+	uint32x4_t lo = vdupq_n_u32(0);
+	uint32x4_t hi = vdupq_n_u32(0);
+
+	for (int w = 0 ; w < matrix->nwords ; w++) {
+		uint32x4_t h = vdupq_n_u32(hw[w]);
+		const uint32_t *v = matrix->value[block][w];
+		const uint32_t *m = matrix->mask[block][w];
+
+		lo = vorrq_u32(lo, vandq_u32(veorq_u32(h, vld1q_u32(v)), vld1q_u32(m)));
+		hi = vorrq_u32(hi, vandq_u32(veorq_u32(h, vld1q_u32(v + 4)), vld1q_u32(m + 4)));
+	}
+
+	uint32x4_t bits = vld1q_u32(lane_bits);
+
+	return vaddvq_u32(vandq_u32(vceqq_u32(lo, vdupq_n_u32(0)), bits)) |
+	       vaddvq_u32(vandq_u32(vceqq_u32(hi, vdupq_n_u32(0)), bits)) << 4;
+
+#else
+	uint32_t bits = 0;
+
+	for (int lane = 0 ; lane < SCHC_MATRIX_LANES ; lane++) {
+		uint32_t acc = 0;
+
+		for (int w = 0 ; w < matrix->nwords ; w++)
+			acc |= (hw[w] ^ matrix->value[block][w][lane]) &
+			       matrix->mask[block][w][lane];
+
+		if (acc == 0)
+			bits |= 1U << lane;
+	}
+
+	return bits;
+#endif
+}
+
+/**
+ * \brief Returns the lanes of a block that hold a rule.
+ */
+static uint8_t matrix_lanes(const struct schc_ruleset *ruleset, int block)
+{
+	size_t n = ruleset->nrules - block * SCHC_MATRIX_LANES;
+
+	return (n >= SCHC_MATRIX_LANES) ? 0xFF : (1U << n) - 1;
+}
+
+#endif /* SCHC_RULE_MATRIX */
+
+/**
+ * \brief Builds the rule index from the compiled rules.
+ */
+static void rule_index_build(struct schc_ruleset *ruleset)
+{
+	struct rule_index *rule_index = &ruleset->index;
+
+	/* TV of every rule indexed by fieldid, in the same layout as header_fields */
+	uint8_t tvs[SCHC_FIELDS_COUNT][SCHC_FIELD_LEN];
+
+	memset(rule_index, INDEX_END, sizeof(*rule_index));
+	rule_index->nkeys = 0;
+
+	for (size_t i = 0 ; i < ruleset->nrules ; i++) {
+
+		const struct compiled_rule *rule = &ruleset->rules[i];
+		uint16_t key_fields = rule_key_fields(ruleset, rule);
+		uint8_t key;
+
+		for (key = 0 ; key < rule_index->nkeys ; key++) {
+			if (rule_index->key_fields[key] == key_fields)
+				break;
+		}
+
+		if (key == rule_index->nkeys) {
+			/*
+			 * New key. If there is no room for it, the last key is
+			 * the empty one, which is a valid key for any rule: it
+			 * puts all its rules in the same bucket.
+			 */
+			if (key == SCHC_INDEX_MAX_KEYS - 1)
+				key_fields = 0;
+
+			for (key = 0 ; key < rule_index->nkeys ; key++) {
+				if (rule_index->key_fields[key] == key_fields)
+					break;
+			}
+
+			if (key == rule_index->nkeys) {
+				rule_index->key_fields[key] = key_fields;
+				rule_index->nkeys++;
+			}
+		}
+
+		memset(tvs, 0, sizeof(tvs));
+		for (int j = 0 ; j < rule->nfields ; j++) {
+			struct compiled_field tmp;
+			const struct compiled_field *field = rule_field(ruleset, rule, j, &tmp);
+
+			memcpy(tvs[field->fieldid], field->tv, SCHC_FIELD_LEN);
+		}
+
+		uint16_t b = index_hash(key, key_fields, tvs);
+
+		/*
+		 * Every bucket is kept sorted by residue length and then by
+		 * Rule ID, so the first rule of the bucket that matches is the
+		 * best one of the bucket.
+		 */
+		uint8_t *prev = &rule_index->bucket[b];
+
+		while (*prev != INDEX_END && !rule_is_better(rule, &ruleset->rules[*prev]))
+			prev = &rule_index->next[*prev];
+
+		rule_index->next[i] = *prev;
+		*prev = i;
+
+		rule_index->rule_key[i] = key;
+	}
+}
+
+/**
+ * \brief Computes what depends on all the rows, once the rules are in
+ * the rule set: the residue length of every rule, the flow key fields
+ * and the index or matrix.
+ */
+static void ruleset_finish(struct schc_ruleset *ruleset)
+{
+	for (size_t i = 0 ; i < ruleset->nrules ; i++) {
+		struct compiled_rule *rule = &ruleset->rules[i];
+
+		rule->residue_bits = rule_residue_bits(ruleset, rule);
+		ruleset->flow_fields |= rule_flow_fields(ruleset, rule);
+	}
+
+	rule_index_build(ruleset);
+#ifdef SCHC_RULE_MATRIX
+	rule_matrix_build(ruleset);
+#endif
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+void packed_field_read(const struct packed_field *row, struct compiled_field *field)
+{
+	struct packed_field packed;
+
+#ifdef __AVR__
+	memcpy_P(&packed, row, sizeof(packed));
+#else
+	packed = *row;
+#endif
+
+	field->fieldid = packed.fieldid;
+	field->field_length = packed.field_length;
+	field->direction = packed.op >> 4 & 0x03;
+	field->MO = packed.op >> 6;
+	field->CDA = packed.op & 0x0F;
+	field->lsb_bits = 0;
+	field->mapping = (field->MO == MATCH_MAPPING) ? packed.arg : 0;
+	memcpy(field->tv, packed.tv, SCHC_FIELD_LEN);
+
+	/* An invalid MSB(x) is left for field_check() to find */
+	if (field->MO == MSB && field_set_msb(field, packed.arg) != 0)
+		field->lsb_bits = 0xFF;
+}
+
+void packed_field_write(const struct compiled_field *field, struct packed_field *row)
+{
+	row->fieldid = field->fieldid;
+	row->field_length = field->field_length;
+	row->op = field->MO << 6 | field->direction << 4 | field->CDA;
+	row->arg = 0;
+	memcpy(row->tv, field->tv, SCHC_FIELD_LEN);
+
+	if (field->MO == MSB)
+		row->arg = field->field_length - field->lsb_bits;
+	else if (field->MO == MATCH_MAPPING)
+		row->arg = field->mapping;
+}
+
+const struct compiled_rule *rule_find(const struct schc_ruleset *ruleset,
+		uint8_t rule_id)
+{
+	/*
+	 * The Rule ID of a compiled rule is its position in the table.
+	 */
+	if (rule_id >= ruleset->nrules)
+		return NULL;
+
+	return &ruleset->rules[rule_id];
+}
+
+int rule_is_better(const struct compiled_rule *a, const struct compiled_rule *b)
+{
+	if (a->residue_bits != b->residue_bits)
+		return a->residue_bits < b->residue_bits;
+
+	return a->rule_id < b->rule_id;
+}
+
+int mapping_lookup(const struct schc_ruleset *ruleset, uint8_t mapping,
+		const uint8_t value[SCHC_FIELD_LEN])
+{
+	const struct schc_mapping *m = &ruleset->mappings[mapping];
+	uint64_t v = schc_slot_get(value);
+	uint8_t b = mapping_hash(0, v) % m->n;
+	uint8_t i = ruleset->map_slot[m->first +
+			mapping_hash(ruleset->map_seed[m->first + b], v) % m->n];
+
+	if (memcmp(ruleset->map_values[m->first + i], value, SCHC_FIELD_LEN) != 0)
+		return -1;
+
+	return i;
+}
+
+const uint8_t *mapping_value(const struct schc_ruleset *ruleset,
+		uint8_t mapping, uint32_t index)
+{
+	const struct schc_mapping *m = &ruleset->mappings[mapping];
+
+	if (index >= m->n)
+		return NULL;
+
+	return ruleset->map_values[m->first + index];
+}
+
+#ifdef SCHC_RULE_MATRIX
+
+const struct compiled_rule *rule_matrix_first(const struct schc_ruleset *ruleset,
+		const struct header_fields *hdr, struct rule_matrix_iter *it)
+{
+	const struct rule_matrix *matrix = &ruleset->matrix;
+	const uint8_t *words = hdr->field[0];
+
+	for (int w = 0 ; w < matrix->nwords ; w++)
+		memcpy(&it->hw[w], words + 4 * matrix->word[w], 4);
+
+	it->block = 0;
+	it->bits = 0;
+	if (ruleset->nrules > 0)
+		it->bits = matrix_block_match(matrix, 0, it->hw) & matrix_lanes(ruleset, 0);
+
+	return rule_matrix_next(ruleset, it);
+}
+
+const struct compiled_rule *rule_matrix_next(const struct schc_ruleset *ruleset,
+		struct rule_matrix_iter *it)
+{
+	const struct rule_matrix *matrix = &ruleset->matrix;
+	int nblocks = (ruleset->nrules + SCHC_MATRIX_LANES - 1) / SCHC_MATRIX_LANES;
+
+	while (it->bits == 0) {
+		if (it->block + 1 >= nblocks)
+			return NULL;
+
+		it->block++;
+		it->bits = matrix_block_match(matrix, it->block, it->hw) &
+			   matrix_lanes(ruleset, it->block);
+	}
+
+	int lane = __builtin_ctz(it->bits);
+
+	it->bits &= it->bits - 1;
+
+	return &ruleset->rules[matrix->order[it->block * SCHC_MATRIX_LANES + lane]];
+}
+
+int rule_matrix_exact(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule)
+{
+	return !ruleset->matrix.partial[rule->rule_id];
+}
+
+#endif /* SCHC_RULE_MATRIX */
+
+uint8_t rule_index_keys(const struct schc_ruleset *ruleset)
+{
+	return ruleset->index.nkeys;
+}
+
+const struct compiled_rule *rule_index_first(const struct schc_ruleset *ruleset,
+		uint8_t key, const struct header_fields *hdr)
+{
+	const struct rule_index *rule_index = &ruleset->index;
+	uint16_t b = index_hash(key, rule_index->key_fields[key], hdr->field);
+	uint8_t i = rule_index->bucket[b];
+
+	while (i != INDEX_END && rule_index->rule_key[i] != key)
+		i = rule_index->next[i];
+
+	return (i == INDEX_END) ? NULL : &ruleset->rules[i];
+}
+
+const struct compiled_rule *rule_index_next(const struct schc_ruleset *ruleset,
+		uint8_t key, const struct compiled_rule *rule)
+{
+	const struct rule_index *rule_index = &ruleset->index;
+	uint8_t i = rule_index->next[rule - ruleset->rules];
+
+	while (i != INDEX_END && rule_index->rule_key[i] != key)
+		i = rule_index->next[i];
+
+	return (i == INDEX_END) ? NULL : &ruleset->rules[i];
+}
+
+int schc_compile_rules(struct schc_ruleset *ruleset)
+{
+	return schc_ruleset_compile_packed(ruleset, rules, NROWS, NULL, 0);
+}
+
+#ifndef SCHC_FLASH_RULES
+
+int schc_ruleset_compile(struct schc_ruleset *ruleset,
+		const struct field_description rules[][SCHC_MAX_RULE_FIELDS],
+		size_t nrules)
+{
+	ruleset_reset(ruleset);
+
+	if (nrules > SCHC_MAX_RULES || nrules > SCHC_FRG_RULEID)
+		return -1;
+
+	for (size_t i = 0 ; i < nrules ; i++) {
+
+		struct compiled_rule *rule = &ruleset->rules[i];
+
+		rule->rule_id = i;
+		rule->nfields = 0;
+		rule->first = ruleset->nfields;
+
+		for (size_t j = 0 ; j < SCHC_MAX_RULE_FIELDS ; j++) {
+
+			const struct field_description *row = &rules[i][j];
+			struct compiled_field *field = &ruleset->fields[ruleset->nfields];
+
+			if (row->tv == NULL)
+				break; /* zero-filled row, end of the rule */
+
+			if (ruleset->nfields == SCHC_MAX_FIELDS)
+				return -1;
+
+			field->mapping = 0;
+			field->lsb_bits = 0;
+
+			if (row->MO == MATCH_MAPPING) {
+				int mapping = parse_mapping(ruleset, row);
+
+				if (mapping < 0)
+					return -1;
+
+				field->mapping = mapping;
+				memset(field->tv, 0, SCHC_FIELD_LEN);
+
+			} else if (parse_tv(row, field->tv) != 0) {
+				return -1;
+			}
+
+			field->fieldid = row->fieldid;
+			field->field_length = row->field_length;
+			field->direction = row->direction;
+			field->MO = row->MO;
+			field->CDA = row->CDA;
+
+			if (row->MO == MSB && field_set_msb(field, row->msb_length) != 0)
+				return -1;
+
+			if (field_check(ruleset, field) != 0)
+				return -1;
+
+			ruleset->nfields++;
+			rule->nfields++;
+		}
+	}
+
+	ruleset->nrules = nrules;
+
+	ruleset_finish(ruleset);
+
+	return 0;
+}
+
+#endif /* SCHC_FLASH_RULES */
+
+int schc_ruleset_compile_packed(struct schc_ruleset *ruleset,
+		const struct packed_field *rows, size_t nrows,
+		const uint64_t *lists, size_t nwords)
+{
+	size_t nrules = 0;
+	size_t first = 0;
+
+	ruleset_reset(ruleset);
+
+	for (size_t w = 0 ; w < nwords ; ) {
+		uint64_t n = packed_word_read(&lists[w++]);
+		struct schc_mapping *m = mapping_new(ruleset);
+
+		if (m == NULL || n > nwords - w)
+			return -1;
+
+		for ( ; n > 0 ; n--) {
+			if (mapping_add(ruleset, m, packed_word_read(&lists[w++])) != 0)
+				return -1;
+		}
+
+		if (mapping_finish(ruleset, m) < 0)
+			return -1;
+	}
+
+	for (size_t r = 0 ; r < nrows ; r++) {
+
+		struct compiled_field field;
+
+		packed_field_read(&rows[r], &field);
+
+		if (field.fieldid != PACKED_FIELD_END) {
+			if (field_check(ruleset, &field) != 0 ||
+			    r - first == SCHC_MAX_RULE_FIELDS)
+				return -1;
+			continue;
+		}
+
+		/* End of a rule: its rows are first to r - 1 */
+		if (nrules == SCHC_MAX_RULES || nrules == SCHC_FRG_RULEID)
+			return -1;
+
+		struct compiled_rule *rule = &ruleset->rules[nrules];
+
+		rule->rule_id = nrules;
+		rule->nfields = r - first;
+
+#ifdef SCHC_FLASH_RULES
+		rule->first = first;
+#else
+		if (ruleset->nfields + rule->nfields > SCHC_MAX_FIELDS)
+			return -1;
+
+		rule->first = ruleset->nfields;
+		for (size_t i = first ; i < r ; i++)
+			packed_field_read(&rows[i], &ruleset->fields[ruleset->nfields++]);
+#endif
+
+		nrules++;
+		first = r + 1;
+	}
+
+	if (first != nrows)
+		return -1; /* the last rule has no SCHC_ROW_END */
+
+#ifdef SCHC_FLASH_RULES
+	ruleset->rows = rows;
+#endif
+	ruleset->nrules = nrules;
+
+	ruleset_finish(ruleset);
+
+	return 0;
+}
+
 /**********************************************************************/
 /***        MAIN INO routines                                       ***/
 /**********************************************************************/
@@ -45,19 +45,433 @@
 
 #include "schc.h"
 
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#endif
+
 /**********************************************************************/
 /***        Macro Definitions                                       ***/
 /**********************************************************************/
 
+/**
+ * If defined, the rows of the rules are not copied to RAM: they are read
+ * from the packed rows (see struct packed_field) in flash every time
+ * they are used. Only rule sets built by schc_ruleset_compile_packed()
+ * are supported then.
+ */
+#if defined(__AVR__) && !defined(SCHC_FLASH_RULES)
+#define SCHC_FLASH_RULES
+#endif
+
+/**
+ * Number of buckets of the rule index. Must be a power of two. It should
+ * be at least twice the number of rules, so most buckets hold a single
+ * rule.
+ */
+#ifndef SCHC_INDEX_BUCKETS
+#ifdef __AVR__
+#define SCHC_INDEX_BUCKETS 16
+#else
+#define SCHC_INDEX_BUCKETS 512
+#endif
+#endif
+
+/**
+ * Maximum number of rules of a rule set. The Rule ID of a compiled rule
+ * is its position, and must stay below the Rule IDs of the SCHC
+ * Fragments (SCHC_FRG_RULEID).
+ */
+#ifndef SCHC_MAX_RULES
+#ifdef __AVR__
+#define SCHC_MAX_RULES 8
+#else
+#define SCHC_MAX_RULES 128
+#endif
+#endif
+
+/**
+ * Maximum number of rows of all the rules of a rule set together, when
+ * they are in RAM.
+ */
+#ifndef SCHC_MAX_FIELDS
+#define SCHC_MAX_FIELDS (SCHC_MAX_RULES * SCHC_MAX_RULE_FIELDS)
+#endif
+
+/**
+ * If defined, small rule sets (up to SCHC_MATRIX_MAX_RULES rules) are
+ * selected with the rule matrix (see struct rule_matrix) instead of the
+ * hash index. It is the default except on AVR, where the matrix does not
+ * fit in RAM. Define SCHC_NO_RULE_MATRIX to always use the index.
+ */
+#if !defined(__AVR__) && !defined(SCHC_NO_RULE_MATRIX) && !defined(SCHC_RULE_MATRIX)
+#define SCHC_RULE_MATRIX
+#endif
+
+/**
+ * Rules checked together by the rule matrix, one per 32-bit lane of a
+ * 256-bit vector.
+ */
+#define SCHC_MATRIX_LANES 8
+
+/**
+ * Number of 32-bit words of the header fields (struct header_fields).
+ */
+#define SCHC_MATRIX_WORDS (SCHC_FIELDS_COUNT * SCHC_FIELD_LEN / 4)
+
+/**
+ * Largest rule set selected with the rule matrix. The matrix checks
+ * every block for every packet, so its cost grows with the number of
+ * rules, while the index only looks at one bucket per key: above a
+ * couple of blocks the index is faster, and it is used instead.
+ */
+#ifndef SCHC_MATRIX_MAX_RULES
+#define SCHC_MATRIX_MAX_RULES 16
+#endif
+
+#define SCHC_MATRIX_BLOCKS ((SCHC_MATRIX_MAX_RULES + SCHC_MATRIX_LANES - 1) / SCHC_MATRIX_LANES)
+
+/**
+ * Maximum number of different index keys. A key is the set of fields a
+ * rule matches with EQUALS among the SCHC_INDEX_FIELDS. Rules sharing
+ * the same set of fields share the same key.
+ */
+#define SCHC_INDEX_MAX_KEYS 8
+
+/**
+ * The fields which can be part of an index key: the address/port tuple.
+ */
+#define SCHC_INDEX_FIELDS ((1U << IPV6_DEV_PREFIX) | (1U << IPV6_DEVIID) | \
+                           (1U << IPV6_APP_PREFIX) | (1U << IPV6_APPIID) | \
+                           (1U << UDP_DEVPORT)     | (1U << UDP_APPPORT))
+
+/**
+ * Maximum number of MATCH_MAPPING rows of a rule set, and of values of
+ * all their lists together.
+ */
+#ifndef SCHC_MAX_MAPPINGS
+#ifdef __AVR__
+#define SCHC_MAX_MAPPINGS 2
+#define SCHC_MAPPING_VALUES 8
+#else
+#define SCHC_MAX_MAPPINGS 32
+#define SCHC_MAPPING_VALUES 256
+#endif
+#endif
+
+/**
+ * Maximum number of values of a single mapping list.
+ */
+#define SCHC_MAX_MAPPING_LEN 64
+
+/**
+ * \brief A packed row, see struct packed_field.
+ *
+ * For instance:
+ *
+ * \verbatim
+ * SCHC_ROW(UDP_APPPORT, 16, BI, 5683, EQUALS, NOT_SENT, 0),
+ * SCHC_ROW(UDP_DEVPORT, 16, BI, 0xF0B0, MSB, LSB, 12),
+ * \endverbatim
+ */
+#define SCHC_ROW(fieldid, field_length, direction, tv, MO, CDA, arg) \
+	{ fieldid, field_length, (uint8_t) ((MO) << 6 | (direction) << 4 | (CDA)), \
+	  arg, SCHC_PACKED_TV((uint64_t) (tv)) }
+
+/**
+ * \brief Ends the rows of a rule.
+ */
+#define SCHC_ROW_END { PACKED_FIELD_END, 0, 0, 0, { 0 } }
+
+#define SCHC_PACKED_TV(v) { \
+	(uint8_t) ((v) >> 56), (uint8_t) ((v) >> 48), (uint8_t) ((v) >> 40), \
+	(uint8_t) ((v) >> 32), (uint8_t) ((v) >> 24), (uint8_t) ((v) >> 16), \
+	(uint8_t) ((v) >> 8),  (uint8_t) (v) }
+
+#define PACKED_FIELD_END 0xFF
+
 /**********************************************************************/
 /***        Types Definitions                                       ***/
 /**********************************************************************/
 
+/**
+ * \brief A rule row packed in 12 bytes, with its TV already in binary,
+ * so the rules can be a constant table in flash (PROGMEM), written with
+ * SCHC_ROW(). The rows of a rule are followed by SCHC_ROW_END.
+ *
+ * arg is x of MSB(x) for MSB rows, and the number of the mapping list
+ * for MATCH_MAPPING rows (see schc_ruleset_compile_packed()).
+ */
+struct packed_field {
+	uint8_t fieldid;
+	uint8_t field_length; /** Length in bits */
+	uint8_t op;           /** MO << 6 | direction << 4 | CDA */
+	uint8_t arg;
+	uint8_t tv[SCHC_FIELD_LEN];
+};
+
+/**
+ * \brief Hash index of the compiled rules.
+ *
+ * Every rule is stored in the bucket given by the hash of the TV of its
+ * key fields. At compression time, for every key, the packet fields
+ * selected by the key are hashed the same way, so only the rules of one
+ * bucket per key need to be verified. The cost of finding the rule does
+ * not depend on the number of rules, only on the number of keys.
+ */
+struct rule_index {
+	uint8_t nkeys;
+	uint16_t key_fields[SCHC_INDEX_MAX_KEYS]; /* bit n set: fieldid n is part of the key */
+	uint8_t bucket[SCHC_INDEX_BUCKETS];       /* first rule of every bucket */
+	uint8_t next[SCHC_MAX_RULES];             /* next rule in the same bucket */
+	uint8_t rule_key[SCHC_MAX_RULES];         /* the key of every rule */
+};
+
+/**
+ * \brief The rules transposed into a structure of arrays, to check a
+ * packet against SCHC_MATRIX_LANES rules at a time.
+ *
+ * The header fields of a packet are seen as SCHC_MATRIX_WORDS 32-bit
+ * words, of which only the nwords ones some rule matches are kept, in
+ * word[]. Every block holds SCHC_MATRIX_LANES rules, one per lane: for
+ * every word, the value the rule expects and the mask of the bits it
+ * matches (all of them for EQUALS, the most significant ones for MSB,
+ * none for IGNORE). A lane matches if no word differs under its mask,
+ * which is a xor, an and and an or per word for all the lanes at once
+ * (with AVX2, SSE2 or NEON, or scalar code otherwise).
+ *
+ * The lanes are sorted according to rule_is_better(), so the first
+ * lane that matches is the rule to use. A MATCH_MAPPING row, or a
+ * second row of the same field, can not be put in the masks: the rule
+ * is marked partial then, and must be verified against the packet.
+ */
+struct rule_matrix {
+	uint8_t nwords;
+	uint8_t word[SCHC_MATRIX_WORDS];        /* position of every word in the header */
+	uint8_t order[SCHC_MATRIX_MAX_RULES];   /* rule of every lane, the best first */
+	uint8_t partial[SCHC_MATRIX_MAX_RULES]; /* by Rule ID */
+	uint32_t value[SCHC_MATRIX_BLOCKS][SCHC_MATRIX_WORDS][SCHC_MATRIX_LANES];
+	uint32_t mask[SCHC_MATRIX_BLOCKS][SCHC_MATRIX_WORDS][SCHC_MATRIX_LANES];
+};
+
+/**
+ * \brief Position of rule_matrix_first() and rule_matrix_next() in the
+ * rule matrix.
+ */
+struct rule_matrix_iter {
+	uint32_t hw[SCHC_MATRIX_WORDS]; /* the matrix words of the packet */
+	uint8_t block;
+	uint8_t bits;                   /* lanes of block not returned yet */
+};
+
+/**
+ * \brief The list of values of a MATCH_MAPPING row, compiled into a
+ * minimal perfect hash table.
+ *
+ * The values are in values[first] to values[first + n - 1] of the rule
+ * set, in the order of the list: the position of a value is the index
+ * sent by MAPPING_SENT, in index_bits bits. A value is first hashed to
+ * one of n buckets, then hashed again with the seed of its bucket to
+ * one of n slots, and the slot holds its position. The seeds are
+ * chosen by schc_ruleset_compile() so no two values share a slot.
+ */
+struct schc_mapping {
+	uint16_t first;
+	uint8_t n;
+	uint8_t index_bits; /** ceil(log2(n)) */
+};
+
+/**
+ * \brief A set of compiled rules and their index or matrix.
+ *
+ * It is built once by schc_compile_rules(), schc_ruleset_compile() or
+ * schc_ruleset_compile_packed(), and only read afterwards, so any
+ * number of SCHC instances (see struct schc_ctx), on any number of
+ * threads, can share it without locking.
+ * Compiling it again flushes the flow cache of every instance using it.
+ */
+struct schc_ruleset {
+	size_t nrules;
+	struct compiled_rule rules[SCHC_MAX_RULES];
+#ifdef SCHC_FLASH_RULES
+	const struct packed_field *rows; /** In flash */
+#else
+	uint16_t nfields;
+	struct compiled_field fields[SCHC_MAX_FIELDS];
+#endif
+	struct rule_index index;
+#ifdef SCHC_RULE_MATRIX
+	struct rule_matrix matrix; /** Only if nrules <= SCHC_MATRIX_MAX_RULES */
+#endif
+	uint8_t nmappings;
+	struct schc_mapping mappings[SCHC_MAX_MAPPINGS];
+	uint8_t map_values[SCHC_MAPPING_VALUES][SCHC_FIELD_LEN];
+	uint16_t map_seed[SCHC_MAPPING_VALUES]; /* seed of every bucket */
+	uint8_t map_slot[SCHC_MAPPING_VALUES];  /* position of the value of every slot */
+	uint16_t flow_fields; /** bit n set: fieldid n is part of the flow key */
+	uint32_t generation;  /** Incremented every time it is compiled */
+};
+
 /**********************************************************************/
 /***        Forward Declarations                                    ***/
 /**********************************************************************/
 
-extern struct field_description rules[7][23];
+/**
+ * \brief Unpacks a packed row read from flash.
+ */
+void packed_field_read(const struct packed_field *row, struct compiled_field *field);
+
+/**
+ * \brief Packs a compiled row back, so packed_field_read() gives it
+ * again.
+ */
+void packed_field_write(const struct compiled_field *field, struct packed_field *row);
+
+/**
+ * \brief Returns row i of rule. tmp is only used if the row must be
+ * read from flash, the result is valid until tmp is reused.
+ */
+static inline const struct compiled_field *rule_field(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule, int i, struct compiled_field *tmp)
+{
+#ifdef SCHC_FLASH_RULES
+	packed_field_read(&ruleset->rows[rule->first + i], tmp);
+	return tmp;
+#else
+	(void) tmp;
+	return &ruleset->fields[rule->first + i];
+#endif
+}
+
+/**
+ * \brief Compiles the rules of this context, which are packed rows in
+ * flash, and stores the result in ruleset.
+ *
+ * It must be called once, before the first call to schc_compress().
+ *
+ * @return 0 if successfull, non-zero if a row is not valid, for
+ * instance if its TV does not fit in its Field Length. In case of
+ * error the rule set is left empty, so no packet will be compressed.
+ */
+int schc_compile_rules(struct schc_ruleset *ruleset);
+
+#ifndef SCHC_FLASH_RULES
+/**
+ * \brief Parses the Target Values of any table of nrules rules, written
+ * as text, and stores the result in ruleset.
+ *
+ * @return 0 if successfull, non-zero if a Target Value is malformed,
+ * there are more than SCHC_MAX_RULES rules, or the mapping lists do
+ * not fit (see SCHC_MAX_MAPPINGS).
+ */
+int schc_ruleset_compile(struct schc_ruleset *ruleset,
+		const struct field_description rules[][SCHC_MAX_RULE_FIELDS],
+		size_t nrules);
+#endif
+
+/**
+ * \brief Same as schc_compile_rules(), for any table of packed rows.
+ *
+ * The mapping lists are given in lists[], nwords values in all: every
+ * list is its number of values, followed by the values. The rows with
+ * arg n use list n.
+ *
+ * @return 0 if successfull, non-zero if a row is not valid or the
+ * rules or mapping lists do not fit in the rule set.
+ */
+int schc_ruleset_compile_packed(struct schc_ruleset *ruleset,
+		const struct packed_field *rows, size_t nrows,
+		const uint64_t *lists, size_t nwords);
+
+/**
+ * \brief Returns the compiled rule with the given Rule ID, or NULL if
+ * there is no such rule.
+ */
+const struct compiled_rule *rule_find(const struct schc_ruleset *ruleset,
+		uint8_t rule_id);
+
+/**
+ * \brief Returns non-zero if rule a should be prefered over rule b when
+ * both match a packet: its Compression Residue is shorter or, if both
+ * are equal, its Rule ID is lower.
+ */
+int rule_is_better(const struct compiled_rule *a, const struct compiled_rule *b);
+
+/**
+ * \brief Looks for value in the list of a mapping.
+ *
+ * @return The position of value in the list, or -1 if it is not in it.
+ */
+int mapping_lookup(const struct schc_ruleset *ruleset, uint8_t mapping,
+		const uint8_t value[SCHC_FIELD_LEN]);
+
+/**
+ * \brief Returns the value at position index of the list of a mapping,
+ * or NULL if the list is shorter.
+ */
+const uint8_t *mapping_value(const struct schc_ruleset *ruleset,
+		uint8_t mapping, uint32_t index);
+
+#ifdef SCHC_RULE_MATRIX
+
+/**
+ * \brief Returns the best rule whose EQUALS and MSB rows match a
+ * packet with the header fields hdr.
+ *
+ * The rules are returned from the best to the worst according to
+ * rule_is_better(). A rule for which rule_matrix_exact() is 0 must
+ * still be verified against the packet. Only rule sets of up to
+ * SCHC_MATRIX_MAX_RULES rules have a matrix.
+ *
+ * @return The first candidate rule, or NULL if there is none.
+ */
+const struct compiled_rule *rule_matrix_first(const struct schc_ruleset *ruleset,
+		const struct header_fields *hdr, struct rule_matrix_iter *it);
+
+/**
+ * \brief Returns the candidate that follows the last one returned, or
+ * NULL if there are no more.
+ */
+const struct compiled_rule *rule_matrix_next(const struct schc_ruleset *ruleset,
+		struct rule_matrix_iter *it);
+
+/**
+ * \brief Returns non-zero if every row of rule is in the rule matrix,
+ * so a candidate rule matches the packet for sure.
+ */
+int rule_matrix_exact(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule);
+
+#endif /* SCHC_RULE_MATRIX */
+
+/**
+ * \brief Number of keys of the rule index. Keys are numbered from 0 to
+ * rule_index_keys() - 1.
+ */
+uint8_t rule_index_keys(const struct schc_ruleset *ruleset);
+
+/**
+ * \brief Returns the first rule of the index bucket where a packet with
+ * the header fields hdr falls for the given key.
+ *
+ * Only the rules of this bucket can match the packet among the rules
+ * with this key, and they are returned from the best to the worst
+ * according to rule_is_better(). Still, the rules returned are only
+ * candidates: hash collisions are possible, and the rest of fields are
+ * not checked at all, so every rule must be verified against the packet.
+ *
+ * @return The first candidate rule, or NULL if there is none.
+ */
+const struct compiled_rule *rule_index_first(const struct schc_ruleset *ruleset,
+		uint8_t key, const struct header_fields *hdr);
+
+/**
+ * \brief Returns the candidate that follows rule for the given key, or
+ * NULL if rule was the last one.
+ */
+const struct compiled_rule *rule_index_next(const struct schc_ruleset *ruleset,
+		uint8_t key, const struct compiled_rule *rule);
 
 /**********************************************************************/
 /***        Constants                                               ***/
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the crc32.h functions.
+ *
+ * The PCLMULQDQ version folds 64 bytes at a time and then reduces the
+ * result with Barrett reduction, as explained in "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009).
+ * The x86 CRC32 instruction (SSE4.2) is not used because it computes
+ * CRC32C, not the IEEE CRC32.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define CRC32_PCLMUL
+#endif
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "crc32.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define CRC32_POLY 0xEDB88320UL /* reflected 0x04C11DB7 */
+
+/**********************************************************************/
+/***        Type Definitions                                        ***/
+/**********************************************************************/
+
+struct crc32_tables {
+	uint32_t t[8][256];
+};
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+#if defined(__AVR__)
+
+/*
+ * Half-byte table, 64 bytes instead of the 8 KB of slicing-by-8.
+ */
+static const uint32_t crc32_nibble[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+static uint32_t crc32_table(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	for ( ; len > 0 ; buf++, len--) {
+		crc ^= *buf;
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+	}
+
+	return crc;
+}
+
+#elif defined(__ARM_FEATURE_CRC32)
+
+static uint32_t crc32_table(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	for ( ; len >= 8 ; buf += 8, len -= 8) {
+		uint64_t w;
+
+		memcpy(&w, buf, sizeof(w));
+		crc = __crc32d(crc, w);
+	}
+
+	for ( ; len > 0 ; buf++, len--)
+		crc = __crc32b(crc, *buf);
+
+	return crc;
+}
+
+#else
+
+static struct crc32_tables crc32_build_tables(void)
+{
+	struct crc32_tables tables;
+
+	for (uint32_t i = 0 ; i < 256 ; i++) {
+		uint32_t crc = i;
+
+		for (int bit = 0 ; bit < 8 ; bit++)
+			crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+
+		tables.t[0][i] = crc;
+	}
+
+	for (uint32_t i = 0 ; i < 256 ; i++) {
+		for (int k = 1 ; k < 8 ; k++) {
+			uint32_t prev = tables.t[k - 1][i];
+			tables.t[k][i] = (prev >> 8) ^ tables.t[0][prev & 0xFF];
+		}
+	}
+
+	return tables;
+}
+
+/**
+ * \brief Returns the slicing-by-8 tables, built the first time they are
+ * needed (the initialization of a local static is thread-safe).
+ */
+static const struct crc32_tables *crc32_get_tables(void)
+{
+	static const struct crc32_tables tables = crc32_build_tables();
+
+	return &tables;
+}
+
+static uint32_t crc32_table(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	const struct crc32_tables *tables = crc32_get_tables();
+	const uint32_t (*t)[256] = tables->t;
+
+	for ( ; len >= 8 ; buf += 8, len -= 8) {
+		uint32_t one = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t) buf[3] << 24);
+		uint32_t two = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t) buf[7] << 24;
+
+		crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+		      t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+		      t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+		      t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+	}
+
+	for ( ; len > 0 ; buf++, len--)
+		crc = (crc >> 8) ^ t[0][(crc ^ *buf) & 0xFF];
+
+	return crc;
+}
+
+#endif
+
+#ifdef CRC32_PCLMUL
+
+static int cpu_has_pclmul(void)
+{
+	static int pclmul = -1;
+
+	if (pclmul < 0) {
+		__builtin_cpu_init();
+		pclmul = (__builtin_cpu_supports("pclmul") &&
+			  __builtin_cpu_supports("sse4.1")) ? 1 : 0;
+	}
+
+	return pclmul;
+}
+
+/**
+ * \brief Folds len bytes into the CRC state with PCLMULQDQ.
+ *
+ * @param [in] len Must be a multiple of 16 and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	/*
+	 * Constants of the bit-reflected domain, from the paper: k1 to k5
+	 * are x^n mod P(x) for the folding distances, and the last pair
+	 * is P(x) and mu = x^64 / P(x) for the Barrett reduction.
+	 */
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0x0000000000LL, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+
+	buf += 64;
+	len -= 64;
+
+	/*
+	 * Fold 64 bytes at a time, in four independent lanes.
+	 */
+	for ( ; len >= 64 ; buf += 64, len -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (buf + 0x30)));
+	}
+
+	/*
+	 * Fold the four lanes into one.
+	 */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/*
+	 * Fold the remaining 16 byte blocks.
+	 */
+	for ( ; len >= 16 ; buf += 16, len -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) buf)), x5);
+	}
+
+	/*
+	 * Fold 128 bits to 64 bits.
+	 */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/*
+	 * Barrett reduction to 32 bits.
+	 */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+#endif /* CRC32_PCLMUL */
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+uint32_t crc32_ref(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	for ( ; len > 0 ; buf++, len--) {
+		crc ^= *buf;
+
+		for (int bit = 0 ; bit < 8 ; bit++)
+			crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+	}
+
+	return crc;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+#ifdef CRC32_PCLMUL
+	if (len >= 64 && cpu_has_pclmul()) {
+		size_t n = len & ~(size_t) 15;
+
+		crc = crc32_pclmul(crc, buf, n);
+		buf += n;
+		len -= n;
+	}
+#endif /* CRC32_PCLMUL */
+
+	return crc32_table(crc, buf, len);
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
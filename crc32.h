@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef CRC32_H
+#define CRC32_H
+
+/**
+ * \file
+ *
+ * \brief CRC32 (IEEE 802.3 polynomial, reflected) used as the SCHC
+ * Reassembly Check Sequence (RCS), the MIC of the SCHC Fragmentation.
+ *
+ * The CRC is computed in a streaming way: the state starts at
+ * CRC32_INIT, every piece of data is added with crc32_update() as soon
+ * as it is available, and crc32_final() gives the value to send. So the
+ * MIC can be computed while the fragments are emitted, with no second
+ * pass over the SCHC packet.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define CRC32_INIT 0xFFFFFFFFUL
+
+/**
+ * Length in bytes of the RCS sent in the last SCHC Fragment.
+ */
+#define CRC32_LEN 4
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Reference implementation, one bit at a time. Kept to verify the
+ * optimized versions, use crc32_update() instead.
+ */
+uint32_t crc32_ref(uint32_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * \brief Adds len bytes to the CRC state.
+ *
+ * It uses the CRC32 instructions on ARMv8 (when built with them), the
+ * carry-less multiplication (PCLMULQDQ) on x86 hosts that support it,
+ * and slicing-by-8 tables otherwise. On AVR, a 16 entry table is used to
+ * save memory.
+ *
+ * @param [in] crc The state, CRC32_INIT for the first piece of data.
+ *
+ * @return The new state.
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * \brief Returns the CRC32 value from the state.
+ */
+static inline uint32_t crc32_final(uint32_t crc)
+{
+	return ~crc;
+}
+
+/**
+ * \brief Computes the CRC32 of buf in one go.
+ */
+static inline uint32_t crc32(const uint8_t *buf, size_t len)
+{
+	return crc32_final(crc32_update(CRC32_INIT, buf, len));
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* CRC32_H */
+
+// vim:tw=72
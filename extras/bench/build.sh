@@ -0,0 +1,28 @@
+
+# Builds the host benchmarks of extras/bench. The Arduino sketch is not
+# needed, only the SCHC library sources.
+#
+#   sh extras/bench/build.sh && ./schc_bench && ./gateway_bench && ./static_bench
+# {
+
+set -xe
+
+SRC=$(dirname "$0")/../..
+CXXFLAGS="-std=gnu++11 -O2 -Wall -I$SRC"
+
+g++ $CXXFLAGS -o schc_bench $SRC/extras/bench/schc_bench.cpp \
+	$SRC/schc.cpp $SRC/context.cpp $SRC/checksum.cpp $SRC/crc32.cpp \
+	$SRC/fragment.cpp $SRC/reassembly.cpp $SRC/pool.cpp $SRC/timer.cpp \
+	$SRC/metrics.cpp $SRC/trace.cpp
+
+g++ $CXXFLAGS -o gateway_bench $SRC/extras/bench/gateway_bench.cpp \
+	$SRC/schc.cpp $SRC/context.cpp $SRC/checksum.cpp $SRC/crc32.cpp \
+	$SRC/fragment.cpp $SRC/reassembly.cpp $SRC/pool.cpp $SRC/timer.cpp \
+	$SRC/ruledb.cpp $SRC/gateway.cpp $SRC/metrics.cpp $SRC/trace.cpp -lpthread
+
+g++ $CXXFLAGS -o static_bench $SRC/extras/bench/static_bench.cpp \
+	$SRC/schc.cpp $SRC/context.cpp $SRC/checksum.cpp $SRC/metrics.cpp $SRC/trace.cpp
+
+#
+# }
+#
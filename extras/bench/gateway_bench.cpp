@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Throughput of the gateway engine (gateway.h) against the
+ * number of worker threads.
+ *
+ * Synthetic traffic: every device sends one IPv6/UDP packet matching
+ * rule 1, compressed and fragmentated with No-ACK exactly as the
+ * client does. All the frames are generated before the clock starts,
+ * and split among up to SCHC_GW_MAX_PRODUCERS producer threads (one
+ * per worker) by device, which submit them as fast as the rings take
+ * them. The result is one line per worker count:
+ *
+ * \verbatim
+ * workers  producers  frames  packets  errors  seconds  frames/s  packets/s
+ * \endverbatim
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "context.h"
+#include "fragment.h"
+#include "gateway.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define DEVICES     4096
+#define ROUNDS      8
+#define PAYLOAD_LEN 100
+
+/*
+ * Devices sending at the same time, kept below SCHC_REASS_MAX_BUFFERS
+ * so a single worker can hold all their reassemblies.
+ */
+#define INTERLEAVE  256
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct frame {
+	uint64_t device;
+	uint8_t len;
+	uint8_t data[MAX_LORAWAN_PKT_LEN];
+};
+
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
+static const uint8_t ipv6_udp_header[SIZE_IPV6 + SIZE_UDP] = {
+	0x60, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x11, 0x40,
+	0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x08, 0x00, 0x27, 0xff, 0xfe, 0x00, 0x00, 0x00,
+	0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x0a, 0x00, 0x27, 0xff, 0xfe, 0x65, 0x65, 0x50,
+	0xe7, 0xdb, 0x16, 0x33,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+static struct schc_ruleset ruleset;
+static std::vector<struct frame> frames;
+static std::atomic<uint64_t> bytes_out;
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static int frame_sink(const uint8_t *frag, size_t frag_len, void *arg)
+{
+	struct frame f;
+
+	f.device = *(const uint64_t *) arg;
+	f.len = frag_len;
+	memcpy(f.data, frag, frag_len);
+	frames.push_back(f);
+
+	return 0;
+}
+
+static void output(unsigned worker, uint64_t device, const uint8_t *data,
+		size_t len, void *arg)
+{
+	(void) worker;
+	(void) device;
+	(void) data;
+	(void) arg;
+
+	bytes_out.fetch_add(len, std::memory_order_relaxed);
+}
+
+/*
+ * The devices take turns in groups of INTERLEAVE, one frame each, so
+ * the fragments of many devices are interleaved like on a real
+ * gateway.
+ */
+static int generate(void)
+{
+	struct schc_ctx ctx;
+	uint8_t ipv6_packet[SIZE_IPV6 + SIZE_UDP + PAYLOAD_LEN];
+	uint8_t schc_packet[SIZE_MTU_IPV6];
+	size_t schc_packet_len;
+	std::vector<std::vector<struct frame> > per_device(DEVICES);
+
+	schc_ctx_init(&ctx, &ruleset);
+
+	memcpy(ipv6_packet, ipv6_udp_header, sizeof(ipv6_udp_header));
+	ipv6_packet[5] = ipv6_packet[SIZE_IPV6 + 5] = SIZE_UDP + PAYLOAD_LEN;
+
+	for (uint64_t device = 0 ; device < DEVICES ; device++) {
+		for (int i = 0 ; i < PAYLOAD_LEN ; i++)
+			ipv6_packet[sizeof(ipv6_udp_header) + i] = device + i;
+
+		if (schc_compress(&ctx, ipv6_packet, sizeof(ipv6_packet), UPLINK,
+				  schc_packet, sizeof(schc_packet), &schc_packet_len) != 0)
+			return -1;
+
+		frames.clear();
+		if (schc_fragmentate(schc_packet, schc_packet_len, frame_sink,
+				     &device) != 0)
+			return -1;
+		per_device[device] = frames;
+	}
+
+	frames.clear();
+	for (uint64_t first = 0 ; first < DEVICES ; first += INTERLEAVE) {
+		for (size_t n = 0 ; ; n++) {
+			size_t before = frames.size();
+
+			for (uint64_t device = first ; device < first + INTERLEAVE &&
+			     device < DEVICES ; device++) {
+				if (n < per_device[device].size())
+					frames.push_back(per_device[device][n]);
+			}
+			if (frames.size() == before)
+				break;
+		}
+	}
+
+	return 0;
+}
+
+static void produce(struct schc_gw *gw, unsigned producer,
+		const std::vector<struct frame> *stream)
+{
+	for (int round = 0 ; round < ROUNDS ; round++) {
+		for (size_t i = 0 ; i < stream->size() ; i++) {
+			const struct frame *f = &(*stream)[i];
+
+			while (schc_gw_submit(gw, producer, f->device, f->data,
+					      f->len) != 0)
+				std::this_thread::yield();
+		}
+	}
+}
+
+static void run(unsigned nworkers)
+{
+	struct schc_gw_config config;
+	struct schc_gw *gw;
+	struct schc_gw_stats total = { 0, 0, 0 };
+	unsigned nproducers = nworkers < SCHC_GW_MAX_PRODUCERS ?
+			      nworkers : SCHC_GW_MAX_PRODUCERS;
+	std::vector<std::vector<struct frame> > streams(nproducers);
+	std::vector<std::thread> producers;
+
+	/* Every fragment of a device must go through the same producer */
+	for (size_t i = 0 ; i < frames.size() ; i++)
+		streams[frames[i].device % nproducers].push_back(frames[i]);
+
+	config.nworkers = nworkers;
+	config.nproducers = nproducers;
+	config.ruleset = &ruleset;
+	config.ruledb = NULL;
+	config.output = output;
+	config.downlink = NULL;
+	config.arg = NULL;
+
+	gw = schc_gw_start(&config);
+	if (gw == NULL) {
+		fprintf(stderr, "schc_gw_start(%u) failed\n", nworkers);
+		exit(1);
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (unsigned p = 0 ; p < nproducers ; p++)
+		producers.push_back(std::thread(produce, gw, p, &streams[p]));
+	for (unsigned p = 0 ; p < nproducers ; p++)
+		producers[p].join();
+
+	/* Reading the stats afterwards, stop waits for the last frames */
+	std::vector<struct schc_gw_stats> stats(nworkers);
+
+	while (total.frames < ROUNDS * frames.size()) {
+		total.frames = 0;
+		for (unsigned w = 0 ; w < nworkers ; w++) {
+			schc_gw_stats(gw, w, &stats[w]);
+			total.frames += stats[w].frames;
+		}
+		std::this_thread::yield();
+	}
+
+	double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+
+	for (unsigned w = 0 ; w < nworkers ; w++) {
+		schc_gw_stats(gw, w, &stats[w]);
+		total.packets += stats[w].packets;
+		total.errors += stats[w].errors;
+	}
+
+	schc_gw_stop(gw);
+
+	printf("%7u %9u %9llu %8llu %7llu %8.3f %10.0f %10.0f\n", nworkers,
+	       nproducers,
+	       (unsigned long long) total.frames,
+	       (unsigned long long) total.packets,
+	       (unsigned long long) total.errors, seconds,
+	       total.frames / seconds, total.packets / seconds);
+}
+
+/**********************************************************************/
+/***        main()                                                  ***/
+/**********************************************************************/
+
+int main(int argc, char *argv[])
+{
+	unsigned max_workers = std::thread::hardware_concurrency();
+
+	if (argc > 1)
+		max_workers = atoi(argv[1]);
+	if (max_workers == 0)
+		max_workers = 1;
+	if (max_workers > SCHC_GW_MAX_WORKERS)
+		max_workers = SCHC_GW_MAX_WORKERS;
+
+	if (schc_compile_rules(&ruleset) != 0 || generate() != 0) {
+		fprintf(stderr, "could not generate the traffic\n");
+		return 1;
+	}
+
+	printf("# %u devices (%u at a time), %zu frames per round, %d rounds\n",
+	       DEVICES, INTERLEAVE, frames.size(), ROUNDS);
+	printf("workers producers    frames  packets  errors  seconds   frames/s  packets/s\n");
+
+	for (unsigned n = 1 ; n <= max_workers ; n *= 2)
+		run(n);
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Baseline of the SCHC operations: compression, decompression,
+ * fragmentation (No-ACK) and reassembly, run one after the other on a
+ * single thread.
+ *
+ * The compression and decompression run for every rule set size,
+ * payload size and hit ratio. Rule i of a rule set matches the device
+ * IID 08:00:27:ff:fe:00:00:i, and sends the 4 low bits of the device
+ * port. A hit packet comes from one of these devices, a miss from a
+ * device no rule matches. The fragmentation and the reassembly only
+ * depend on the size of the SCHC packet, so they run once per payload
+ * size, on the SCHC packets of the one rule set with every packet a
+ * hit.
+ *
+ * Every case runs for at least the minimum time (-t, in milliseconds)
+ * over PACKETS different packets. The result is one line per case, or
+ * comma separated values with -c, to be compared between commits:
+ *
+ * \verbatim
+ * op  rules  payload  hit%  packets  ns/packet  packets/s  alloc  out/packet
+ * \endverbatim
+ *
+ * - alloc: bytes allocated on the heap during the case (with malloc()
+ *   or new), which should be 0.
+ * - out/packet: average length of what the operation outputs: the SCHC
+ *   packets, the IPv6 packets, the L2 frames or the reassembled SCHC
+ *   packets.
+ *
+ * The rule sets go up to SCHC_MAX_RULES rules, and never more than
+ * SCHC_FRG_RULEID, as the Rule IDs from it on are for fragmentation.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <vector>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "context.h"
+#include "fragment.h"
+#include "reassembly.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define PACKETS 1024
+#define MIN_MS  100
+
+#define DEVICE_IID 0x080027FFFE000000ULL
+#define DEVICE     1
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct packet {
+	size_t len;
+	uint8_t data[SIZE_MTU_IPV6];
+};
+
+struct result {
+	uint64_t packets;
+	double seconds;
+	uint64_t alloc;
+	uint64_t out_bytes;
+};
+
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
+static const unsigned rule_counts[] = { 1, 8, 32, 128 };
+static const unsigned payload_lens[] = { 0, 16, 100, 512, SIZE_MTU_IPV6 - SIZE_IPV6 - SIZE_UDP };
+static const unsigned hit_percents[] = { 100, 90, 50, 0 };
+
+static struct schc_ruleset ruleset;
+static struct schc_ctx ctx;
+static struct schc_reass reass;
+
+static int csv;
+static unsigned min_ms = MIN_MS;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+/* Counted only while a case runs */
+static int counting;
+static uint64_t allocated;
+
+/* The input of the case running */
+static std::vector<struct packet> packets;
+static std::vector<struct packet> schc_packets; /** The hits, compressed */
+static std::vector<std::vector<uint8_t> > frames;
+
+/* The sinks add up what they receive */
+static uint64_t sink_bytes;
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static uint64_t rnd(void)
+{
+	/* xorshift64 */
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+
+	return rnd_state;
+}
+
+static unsigned max_rules(void)
+{
+	return SCHC_MAX_RULES < SCHC_FRG_RULEID ? SCHC_MAX_RULES : SCHC_FRG_RULEID;
+}
+
+static int build_ruleset(unsigned nrules)
+{
+	static struct packed_field rows[SCHC_MAX_RULES * (SCHC_FIELDS_COUNT + 1)];
+	size_t n = 0;
+
+	for (unsigned i = 0 ; i < nrules ; i++) {
+		const struct packed_field rule[] = {
+			SCHC_ROW(IPV6_VERSION,         4, BI, 6,                  EQUALS, NOT_SENT,         0),
+			SCHC_ROW(IPV6_TRAFFIC_CLASS,   8, BI, 0,                  EQUALS, NOT_SENT,         0),
+			SCHC_ROW(IPV6_FLOW_LABEL,     20, BI, 0,                  IGNORE, NOT_SENT,         0),
+			SCHC_ROW(IPV6_PAYLOAD_LENGTH, 16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+			SCHC_ROW(IPV6_NEXT_HEADER,     8, BI, 17,                 EQUALS, NOT_SENT,         0),
+			SCHC_ROW(IPV6_HOP_LIMIT,       8, BI, 64,                 IGNORE, NOT_SENT,         0),
+			SCHC_ROW(IPV6_DEV_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+			SCHC_ROW(IPV6_DEVIID,         64, BI, DEVICE_IID + i,     EQUALS, NOT_SENT,         0),
+			SCHC_ROW(IPV6_APP_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+			SCHC_ROW(IPV6_APPIID,         64, BI, 0x0A0027FFFE656550, EQUALS, NOT_SENT,         0),
+			SCHC_ROW(UDP_DEVPORT,         16, BI, 0xF0B0,             MSB,    LSB,              12),
+			SCHC_ROW(UDP_APPPORT,         16, BI, 5683,               EQUALS, NOT_SENT,         0),
+			SCHC_ROW(UDP_LENGTH,          16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+			SCHC_ROW(UDP_CHECKSUM,        16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0),
+			SCHC_ROW_END
+		};
+
+		memcpy(rows + n, rule, sizeof(rule));
+		n += sizeof(rule) / sizeof(rule[0]);
+	}
+
+	if (schc_ruleset_compile_packed(&ruleset, rows, n, NULL, 0) != 0)
+		return -1;
+
+	schc_ctx_init(&ctx, &ruleset);
+
+	return 0;
+}
+
+static void put_be(uint8_t *p, uint64_t v, int n)
+{
+	for (int i = n - 1 ; i >= 0 ; i--, v >>= 8)
+		p[i] = v;
+}
+
+/*
+ * An IPv6/UDP packet from device IID iid, with random payload and
+ * device port.
+ */
+static void make_packet(struct packet *p, uint64_t iid, unsigned payload_len)
+{
+	size_t udp_len = SIZE_UDP + payload_len;
+	uint8_t *d = p->data;
+
+	memset(d, 0, SIZE_IPV6 + SIZE_UDP);
+	d[0] = 0x60;
+	put_be(d + 4, udp_len, 2);
+	d[6] = 17;
+	d[7] = 64;
+	put_be(d + 8, 0xFE80000000000000ULL, 8);
+	put_be(d + 16, iid, 8);
+	put_be(d + 24, 0xFE80000000000000ULL, 8);
+	put_be(d + 32, 0x0A0027FFFE656550ULL, 8);
+	put_be(d + 40, 0xF0B0 + rnd() % 16, 2);
+	put_be(d + 42, 5683, 2);
+	put_be(d + 44, udp_len, 2);
+
+	for (unsigned i = 0 ; i < payload_len ; i++)
+		d[SIZE_IPV6 + SIZE_UDP + i] = rnd();
+
+	p->len = SIZE_IPV6 + udp_len;
+}
+
+static void make_packets(std::vector<struct packet> *packets, unsigned nrules,
+		unsigned payload_len, unsigned hit_percent)
+{
+	packets->resize(PACKETS);
+
+	for (size_t i = 0 ; i < packets->size() ; i++) {
+		uint64_t iid;
+
+		if (rnd() % 100 < hit_percent)
+			iid = DEVICE_IID + rnd() % nrules;
+		else
+			iid = DEVICE_IID + max_rules() + rnd() % 1024;
+
+		make_packet(&(*packets)[i], iid, payload_len);
+	}
+}
+
+static int frame_sink(const uint8_t *frag, size_t frag_len, void *arg)
+{
+	(void) arg;
+
+	frames.push_back(std::vector<uint8_t>(frag, frag + frag_len));
+
+	return 0;
+}
+
+static int count_sink(const uint8_t *frag, size_t frag_len, void *arg)
+{
+	(void) frag;
+	(void) arg;
+
+	sink_bytes += frag_len;
+
+	return 0;
+}
+
+static int reass_sink(uint64_t device, const uint8_t *schc_packet, size_t len,
+		void *arg)
+{
+	(void) device;
+	(void) schc_packet;
+	(void) arg;
+
+	sink_bytes += len;
+
+	return 0;
+}
+
+/*
+ * The operations measured, on item i of their input. They return the
+ * length of their output, unless it goes to a sink.
+ */
+static size_t op_compress(size_t i)
+{
+	uint8_t out[SIZE_MTU_IPV6];
+	size_t len = 0;
+
+	schc_compress(&ctx, packets[i].data, packets[i].len, UPLINK, out,
+		      sizeof(out), &len);
+
+	return len;
+}
+
+static size_t op_decompress(size_t i)
+{
+	uint8_t out[SIZE_MTU_IPV6];
+	size_t len = 0;
+
+	schc_decompress(&ctx, schc_packets[i].data, schc_packets[i].len, UPLINK,
+			out, sizeof(out), &len);
+
+	return len;
+}
+
+static size_t op_fragment(size_t i)
+{
+	schc_fragmentate(schc_packets[i].data, schc_packets[i].len, count_sink,
+			 NULL);
+
+	return 0;
+}
+
+static size_t op_reassemble(size_t i)
+{
+	schc_reass_input(&reass, DEVICE, frames[i].data(), frames[i].size(),
+			 reass_sink, NULL, NULL);
+
+	return 0;
+}
+
+/*
+ * Runs op over the n items of its input until min_ms passed, at least
+ * once.
+ */
+static struct result measure(size_t (*op)(size_t), size_t n)
+{
+	struct result r = { 0, 0, 0, 0 };
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point end = start + std::chrono::milliseconds(min_ms);
+	std::chrono::steady_clock::time_point now;
+
+	allocated = 0;
+	sink_bytes = 0;
+	counting = 1;
+
+	do {
+		for (size_t i = 0 ; i < n ; i++)
+			r.out_bytes += op(i);
+		r.packets += n;
+		now = std::chrono::steady_clock::now();
+	} while (now < end);
+
+	counting = 0;
+
+	r.seconds = std::chrono::duration<double>(now - start).count();
+	r.alloc = allocated;
+	r.out_bytes += sink_bytes;
+
+	return r;
+}
+
+static void report(const char *op, unsigned nrules, unsigned payload_len,
+		unsigned hit_percent, const struct result *r, uint64_t out_packets)
+{
+	double ns = r->seconds * 1e9 / r->packets;
+	double out = out_packets != 0 ? (double) r->out_bytes / out_packets : 0;
+
+	if (csv)
+		printf("%s,%u,%u,%u,%llu,%.1f,%.0f,%llu,%.1f\n", op, nrules,
+		       payload_len, hit_percent, (unsigned long long) r->packets,
+		       ns, r->packets / r->seconds, (unsigned long long) r->alloc, out);
+	else
+		printf("%-11s %5u %7u %4u %9llu %9.1f %10.0f %5llu %10.1f\n", op,
+		       nrules, payload_len, hit_percent,
+		       (unsigned long long) r->packets, ns, r->packets / r->seconds,
+		       (unsigned long long) r->alloc, out);
+}
+
+/*
+ * Generates the packets, and compresses them with the current rule set
+ * into schc_packets. Returns the number of hits.
+ */
+static size_t prepare(unsigned nrules, unsigned payload_len, unsigned hit_percent)
+{
+	size_t hits = 0;
+
+	make_packets(&packets, nrules, payload_len, hit_percent);
+
+	schc_packets.resize(packets.size());
+	for (size_t i = 0 ; i < packets.size() ; i++) {
+		struct packet *out = &schc_packets[hits];
+
+		if (schc_compress(&ctx, packets[i].data, packets[i].len, UPLINK,
+				  out->data, sizeof(out->data), &out->len) == 0)
+			hits++;
+	}
+	schc_packets.resize(hits);
+
+	return hits;
+}
+
+static void run_cd(unsigned nrules, unsigned payload_len, unsigned hit_percent)
+{
+	size_t hits = prepare(nrules, payload_len, hit_percent);
+	struct result r = measure(op_compress, packets.size());
+
+	/* Only the hits output something */
+	report("compress", nrules, payload_len, hit_percent, &r,
+	       r.packets / packets.size() * hits);
+
+	if (hits == 0)
+		return;
+
+	r = measure(op_decompress, schc_packets.size());
+	report("decompress", nrules, payload_len, hit_percent, &r, r.packets);
+}
+
+/*
+ * Fragmentation and reassembly, with one rule and every packet a hit.
+ */
+static int run_fr(unsigned payload_len)
+{
+	if (build_ruleset(1) != 0 || prepare(1, payload_len, 100) != PACKETS)
+		return -1;
+
+	struct result r = measure(op_fragment, schc_packets.size());
+
+	report("fragment", 1, payload_len, 100, &r, r.packets);
+
+	/* The frames of every packet, in order, from the same device */
+	frames.clear();
+	for (size_t i = 0 ; i < schc_packets.size() ; i++)
+		schc_fragmentate(schc_packets[i].data, schc_packets[i].len,
+				 frame_sink, NULL);
+
+	schc_reass_init(&reass, NULL);
+
+	/* Every packet has the same length, so as many frames */
+	uint64_t frames_per_packet = frames.size() / schc_packets.size();
+
+	r = measure(op_reassemble, frames.size());
+	r.packets /= frames_per_packet;
+	report("reassemble", 1, payload_len, 100, &r, r.packets);
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+/*
+ * Every heap allocation goes through these while a case runs. The
+ * library allocates nothing, they catch it if it ever does. With
+ * glibc, new is counted by malloc().
+ */
+void *operator new(size_t size)
+{
+#ifndef __GLIBC__
+	if (counting)
+		allocated += size;
+#endif
+
+	void *p = malloc(size);
+
+	if (p == NULL)
+		throw std::bad_alloc();
+
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+	if (counting)
+		allocated += size;
+
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+	if (counting)
+		allocated += n * size;
+
+	return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t size)
+{
+	if (counting)
+		allocated += size;
+
+	return __libc_realloc(p, size);
+}
+#endif
+
+/**********************************************************************/
+/***        main()                                                  ***/
+/**********************************************************************/
+
+int main(int argc, char *argv[])
+{
+	for (int i = 1 ; i < argc ; i++) {
+		if (strcmp(argv[i], "-c") == 0) {
+			csv = 1;
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			min_ms = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "Usage: %s [-c] [-t min_ms]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (csv) {
+		printf("op,rules,payload,hit_percent,packets,ns_per_packet,"
+		       "packets_per_s,alloc_bytes,out_bytes_per_packet\n");
+	} else {
+		printf("# %d packets per case, at least %u ms per case\n", PACKETS,
+		       min_ms);
+		printf("op          rules payload hit%%   packets ns/packet  packets/s alloc out/packet\n");
+	}
+
+	for (size_t p = 0 ; p < sizeof(payload_lens) / sizeof(payload_lens[0]) ; p++) {
+		for (size_t r = 0 ; r < sizeof(rule_counts) / sizeof(rule_counts[0]) ; r++) {
+			unsigned nrules = rule_counts[r] < max_rules() ? rule_counts[r] : max_rules();
+
+			if (build_ruleset(nrules) != 0) {
+				fprintf(stderr, "could not compile %u rules\n", nrules);
+				return 1;
+			}
+
+			for (size_t h = 0 ; h < sizeof(hit_percents) / sizeof(hit_percents[0]) ; h++)
+				run_cd(nrules, payload_lens[p], hit_percents[h]);
+		}
+
+		if (run_fr(payload_lens[p]) != 0) {
+			fprintf(stderr, "could not compress the packets to fragment\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
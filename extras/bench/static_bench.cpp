@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Compression with static rules (static_rules.h) against the
+ * interpreted rules of schc_compress() and schc_compress_batch().
+ *
+ * The rules are the ones of context.cpp, written as static rules. Two
+ * kinds of traffic are compressed:
+ *
+ * - one flow: every packet matches rule 1 and differs only in its
+ *   payload, so schc_compress() always finds it in its flow cache.
+ * - many flows: every packet has another device port and matches rule
+ *   5, so schc_compress() looks for the rule almost every time.
+ *
+ * Before the clock starts, every packet is compressed both ways and
+ * the SCHC packets compared. The result is one line per path:
+ *
+ * \verbatim
+ * traffic  path  packets  seconds  packets/s  ns/packet
+ * \endverbatim
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "context.h"
+#include "static_rules.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define PACKETS     4096
+#define ROUNDS      256
+#define PAYLOAD_LEN 100
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+/* The rules of context.cpp */
+
+typedef schc_static_rule<
+	SCHC_STATIC_ROW(IPV6_VERSION,         4, BI, 1,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_TRAFFIC_CLASS,   8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_FLOW_LABEL,     20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_PAYLOAD_LENGTH, 16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(IPV6_NEXT_HEADER,     8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_HOP_LIMIT,       8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEV_PREFIX,     64, BI, 0x1234567891234567, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEVIID,         64, BI, 0x7157084458723854, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APP_PREFIX,     64, BI, 0x1234567890123456, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APPIID,         64, BI, 0x1478585784768976, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_DEVPORT,         16, BI, 0,                  IGNORE, VALUE_SENT,       0),
+	SCHC_STATIC_ROW(UDP_APPPORT,         16, BI, 5683,               IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_LENGTH,          16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(UDP_CHECKSUM,        16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0)
+> rule0;
+
+typedef schc_static_rule<
+	SCHC_STATIC_ROW(IPV6_VERSION,         4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_TRAFFIC_CLASS,   8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_FLOW_LABEL,     20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_PAYLOAD_LENGTH, 16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(IPV6_NEXT_HEADER,     8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_HOP_LIMIT,       8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEV_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEVIID,         64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APP_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APPIID,         64, BI, 0x0A0027FFFE656550, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_DEVPORT,         16, BI, 59355,              EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_APPPORT,         16, BI, 5683,               EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_LENGTH,          16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(UDP_CHECKSUM,        16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0)
+> rule1;
+
+/* Rules 2, 3 and 4 */
+typedef schc_static_rule<
+	SCHC_STATIC_ROW(IPV6_VERSION,         4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_TRAFFIC_CLASS,   8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_FLOW_LABEL,     20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_PAYLOAD_LENGTH, 16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(IPV6_NEXT_HEADER,     8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_HOP_LIMIT,       8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEV_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEVIID,         64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APP_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APPIID,         64, BI, 0x30F008DA05CBE19A, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_DEVPORT,         16, BI, 59355,              EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_APPPORT,         16, BI, 5683,               EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_LENGTH,          16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(UDP_CHECKSUM,        16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0)
+> rule2;
+
+/* Rules 5 and 6 */
+typedef schc_static_rule<
+	SCHC_STATIC_ROW(IPV6_VERSION,         4, BI, 6,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_TRAFFIC_CLASS,   8, BI, 0,                  EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_FLOW_LABEL,     20, BI, 0,                  IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_PAYLOAD_LENGTH, 16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(IPV6_NEXT_HEADER,     8, BI, 17,                 EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_HOP_LIMIT,       8, BI, 64,                 IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEV_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_DEVIID,         64, BI, 0x080027FFFE000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APP_PREFIX,     64, BI, 0xFE80000000000000, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(IPV6_APPIID,         64, BI, 0x30F008DA05CBE19A, EQUALS, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_DEVPORT,         16, BI, 0,                  IGNORE, VALUE_SENT,       0),
+	SCHC_STATIC_ROW(UDP_APPPORT,         16, BI, 5683,               IGNORE, NOT_SENT,         0),
+	SCHC_STATIC_ROW(UDP_LENGTH,          16, BI, 0,                  IGNORE, COMPUTE_LENGTH,   0),
+	SCHC_STATIC_ROW(UDP_CHECKSUM,        16, BI, 0,                  IGNORE, COMPUTE_CHECKSUM, 0)
+> rule5;
+
+typedef schc_static_ruleset<rule0, rule1, rule2, rule2, rule2, rule5, rule5> context_rules;
+
+struct packet {
+	size_t len;
+	uint8_t data[SIZE_IPV6 + SIZE_UDP + PAYLOAD_LEN];
+};
+
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
+static const uint8_t ipv6_udp_header[SIZE_IPV6 + SIZE_UDP] = {
+	0x60, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x11, 0x40,
+	0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x08, 0x00, 0x27, 0xff, 0xfe, 0x00, 0x00, 0x00,
+	0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x0a, 0x00, 0x27, 0xff, 0xfe, 0x65, 0x65, 0x50,
+	0xe7, 0xdb, 0x16, 0x33,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t other_appiid[8] = {
+	0x30, 0xf0, 0x08, 0xda, 0x05, 0xcb, 0xe1, 0x9a,
+};
+
+static struct schc_ruleset ruleset;
+static struct schc_ctx ctx;
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static void generate(std::vector<struct packet> *packets, int many_flows)
+{
+	struct packet p;
+
+	p.len = sizeof(p.data);
+	memcpy(p.data, ipv6_udp_header, sizeof(ipv6_udp_header));
+	p.data[5] = p.data[SIZE_IPV6 + 5] = SIZE_UDP + PAYLOAD_LEN;
+
+	if (many_flows)
+		memcpy(p.data + 32, other_appiid, sizeof(other_appiid));
+
+	for (int n = 0 ; n < PACKETS ; n++) {
+		for (int i = 0 ; i < PAYLOAD_LEN ; i++)
+			p.data[sizeof(ipv6_udp_header) + i] = n + i;
+
+		if (many_flows) {
+			p.data[SIZE_IPV6] = n >> 8;
+			p.data[SIZE_IPV6 + 1] = n;
+		}
+
+		packets->push_back(p);
+	}
+}
+
+static int compress_interpreted(const struct packet *p, uint8_t *out, size_t cap,
+		size_t *len)
+{
+	return schc_compress(&ctx, p->data, p->len, UPLINK, out, cap, len);
+}
+
+static int compress_static(const struct packet *p, uint8_t *out, size_t cap,
+		size_t *len)
+{
+	return context_rules::compress(p->data, p->len, UPLINK, out, cap, len);
+}
+
+/*
+ * Both paths must give the same SCHC packets, and they must decompress
+ * back to the original packets.
+ */
+static int check(const std::vector<struct packet> &packets)
+{
+	uint8_t a[SIZE_MTU_IPV6], b[SIZE_MTU_IPV6], ipv6[SIZE_MTU_IPV6];
+	size_t a_len, b_len, ipv6_len;
+
+	for (size_t n = 0 ; n < packets.size() ; n++) {
+		const struct packet *p = &packets[n];
+
+		if (compress_interpreted(p, a, sizeof(a), &a_len) != 0 ||
+		    compress_static(p, b, sizeof(b), &b_len) != 0 ||
+		    a_len != b_len || memcmp(a, b, a_len) != 0)
+			return -1;
+
+		if (schc_decompress(&ctx, b, b_len, UPLINK, ipv6, sizeof(ipv6),
+				    &ipv6_len) != 0 || ipv6_len != p->len ||
+		    memcmp(ipv6 + SIZE_IPV6, p->data + SIZE_IPV6, 4) != 0 ||
+		    memcmp(ipv6 + SIZE_IPV6 + SIZE_UDP, p->data + SIZE_IPV6 + SIZE_UDP,
+			   PAYLOAD_LEN) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void run(const char *traffic, const char *path,
+		int (*compress)(const struct packet *, uint8_t *, size_t, size_t *),
+		const std::vector<struct packet> &packets)
+{
+	uint8_t out[SIZE_MTU_IPV6];
+	size_t len;
+	size_t bytes = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int round = 0 ; round < ROUNDS ; round++) {
+		for (size_t n = 0 ; n < packets.size() ; n++) {
+			compress(&packets[n], out, sizeof(out), &len);
+			bytes += len;
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+	double total = (double) ROUNDS * packets.size();
+
+	printf("%-10s %-11s %9.0f %8.3f %10.0f %9.1f\n", traffic, path, total,
+	       seconds, total / seconds, seconds * 1e9 / total);
+
+	/* So the compiler does not drop the loop */
+	if (bytes == 0)
+		printf("nothing compressed\n");
+}
+
+/*
+ * The same traffic through schc_compress_batch(), SCHC_BATCH_LEN
+ * packets per call.
+ */
+static void run_batch(const char *traffic, const std::vector<struct packet> &packets)
+{
+	static uint8_t arena[SCHC_BATCH_LEN * SIZE_MTU_IPV6];
+	struct schc_buf in[SCHC_BATCH_LEN], out[SCHC_BATCH_LEN];
+	size_t done = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int round = 0 ; round < ROUNDS ; round++) {
+		for (size_t first = 0 ; first < packets.size() ; first += SCHC_BATCH_LEN) {
+			size_t n = MIN(packets.size() - first, (size_t) SCHC_BATCH_LEN);
+
+			for (size_t i = 0 ; i < n ; i++) {
+				in[i].data = packets[first + i].data;
+				in[i].len = packets[first + i].len;
+			}
+
+			done += schc_compress_batch(&ctx, in, n, UPLINK, arena,
+						    sizeof(arena), out);
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+	double total = (double) ROUNDS * packets.size();
+
+	printf("%-10s %-11s %9.0f %8.3f %10.0f %9.1f\n", traffic, "batch", total,
+	       seconds, total / seconds, seconds * 1e9 / total);
+
+	if (done != total)
+		printf("%zu packets not compressed\n", (size_t) total - done);
+}
+
+/**********************************************************************/
+/***        main()                                                  ***/
+/**********************************************************************/
+
+int main(void)
+{
+	std::vector<struct packet> one_flow, many_flows;
+
+	if (schc_compile_rules(&ruleset) != 0) {
+		fprintf(stderr, "could not compile the rules\n");
+		return 1;
+	}
+
+	schc_ctx_init(&ctx, &ruleset);
+
+	generate(&one_flow, 0);
+	generate(&many_flows, 1);
+
+	if (check(one_flow) != 0 || check(many_flows) != 0) {
+		fprintf(stderr, "the static rules do not compress as the interpreted ones\n");
+		return 1;
+	}
+
+	printf("# %d packets, %d rounds, %d bytes of payload\n", PACKETS, ROUNDS,
+	       PAYLOAD_LEN);
+	printf("traffic    path          packets  seconds  packets/s ns/packet\n");
+
+	run("one-flow",   "interpreted", compress_interpreted, one_flow);
+	run_batch("one-flow", one_flow);
+	run("one-flow",   "static",      compress_static,      one_flow);
+	run("many-flows", "interpreted", compress_interpreted, many_flows);
+	run_batch("many-flows", many_flows);
+	run("many-flows", "static",      compress_static,      many_flows);
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
@@ -0,0 +1,25 @@
+# Builds the regression checks of the SCHC library, with and without
+# the rule matrix. The Arduino sketch is not needed, only the SCHC
+# library sources.
+#
+#   sh extras/check/build.sh && ./schc_check && ./schc_check_index
+# {
+
+set -xe
+
+SRC=$(dirname "$0")/../..
+CXXFLAGS="-std=gnu++11 -O2 -Wall -I$SRC"
+
+g++ $CXXFLAGS -o schc_check $SRC/extras/check/schc_check.cpp \
+	$SRC/schc.cpp $SRC/context.cpp $SRC/checksum.cpp $SRC/crc32.cpp \
+	$SRC/fragment.cpp $SRC/reassembly.cpp $SRC/pool.cpp $SRC/timer.cpp \
+	$SRC/metrics.cpp $SRC/trace.cpp
+
+g++ $CXXFLAGS -DSCHC_NO_RULE_MATRIX -o schc_check_index $SRC/extras/check/schc_check.cpp \
+	$SRC/schc.cpp $SRC/context.cpp $SRC/checksum.cpp $SRC/crc32.cpp \
+	$SRC/fragment.cpp $SRC/reassembly.cpp $SRC/pool.cpp $SRC/timer.cpp \
+	$SRC/metrics.cpp $SRC/trace.cpp
+
+#
+# }
+#
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Regression checks of the SCHC library, for the cases the
+ * benchmarks and the lossy link test do not reach.
+ *
+ * Every check prints one line, and the exit status is non-zero if any
+ * of them failed:
+ *
+ * - aoe_bad_all_1: a malformed All-1 fragment (too short, or with a
+ *   tile number out of the window) or regular tile frees the session it
+ *   created, with and without a timer wheel, so the pools are not
+ *   exhausted.
+ * - aoe_max_len: the ACK-on-Error sender refuses the packets longer
+ *   than SCHC_AOE_MAX_PKT_LEN, and the receiver delivers the longest
+ *   ones it accepts.
+ * - failed_compile: once a compilation failed, the rule set is empty
+ *   and compresses nothing, even for the packets of a flow compressed
+ *   with the previous rules.
+ * - ruleset_switch: an instance pointed to another rule set, compiled
+ *   as many times as the previous one, does not use the flows it
+ *   cached with the previous one.
+ * - batch_slot: in a schc_compress_batch() call, a flow whose header
+ *   does not fit in the flow cache, in the cache entry of a flow
+ *   compressed before it, does not change what that flow outputs.
+ *
+ * build.sh also builds schc_check_index, without the rule matrix
+ * (SCHC_NO_RULE_MATRIX), so the rules are selected with the index.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "context.h"
+#include "fragment.h"
+#include "reassembly.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define DEVICE 1
+
+/*
+ * Fails the check running if c is false.
+ */
+#define CHECK(c) do { \
+		if (!(c)) { \
+			printf("  %s:%d: %s\n", __FILE__, __LINE__, #c); \
+			return -1; \
+		} \
+	} while (0)
+
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
+static struct schc_reass reass;
+static struct schc_wheel wheel;
+static struct schc_ruleset ruleset;
+static struct schc_ctx ctx;
+
+/* An IPv6/UDP packet from fe80::1 port 0xF0B1, without payload */
+static const uint8_t ipv6_packet[SIZE_IPV6 + SIZE_UDP] = {
+	0x60, 0x00, 0x00, 0x00, 0x00, 0x08, 0x11, 0x40,
+	0xFE, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+	0xFE, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+	0xF0, 0xB1, 0x16, 0x33, 0x00, 0x08, 0x00, 0x00,
+};
+
+static const struct packed_field rows[] = {
+	SCHC_ROW(IPV6_VERSION, 4, BI, 6, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_NEXT_HEADER, 8, BI, 17, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_DEVIID, 64, BI, 1, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(UDP_DEVPORT, 16, BI, 0xF0B0, MSB, LSB, 12),
+	SCHC_ROW_END,
+};
+
+/*
+ * The first rule is cached, the second sends 128 bits and does not fit
+ * in a cache entry.
+ */
+static const struct packed_field batch_rows[] = {
+	SCHC_ROW(IPV6_VERSION, 4, BI, 6, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_NEXT_HEADER, 8, BI, 17, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_DEVIID, 64, BI, 1, EQUALS, NOT_SENT, 0),
+	SCHC_ROW_END,
+	SCHC_ROW(IPV6_VERSION, 4, BI, 6, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_NEXT_HEADER, 8, BI, 17, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_DEV_PREFIX, 64, BI, 0, IGNORE, VALUE_SENT, 0),
+	SCHC_ROW(IPV6_DEVIID, 64, BI, 0, IGNORE, VALUE_SENT, 0),
+	SCHC_ROW_END,
+};
+
+/* The same, sending the whole device port */
+static const struct packed_field other_rows[] = {
+	SCHC_ROW(IPV6_VERSION, 4, BI, 6, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_NEXT_HEADER, 8, BI, 17, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(IPV6_DEVIID, 64, BI, 1, EQUALS, NOT_SENT, 0),
+	SCHC_ROW(UDP_DEVPORT, 16, BI, 0, IGNORE, VALUE_SENT, 0),
+	SCHC_ROW_END,
+};
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static int ignore(uint64_t device, const uint8_t *data, size_t len, void *arg)
+{
+	(void) device;
+	(void) data;
+	(void) len;
+	(void) arg;
+
+	return 0;
+}
+
+static int check_aoe_bad_all_1(void)
+{
+	for (int use_wheel = 0 ; use_wheel < 2 ; use_wheel++) {
+		schc_wheel_init(&wheel, 0);
+		schc_reass_init(&reass, use_wheel ? &wheel : NULL);
+
+		/* More than there are sessions and buffers */
+		for (unsigned i = 0 ; i < 2 * SCHC_REASS_MAX_SESSIONS ; i++) {
+			uint8_t frag[SCHC_AOE_FRG_MAX_LEN] = {
+				SCHC_FRG_ACK_RULEID, (uint8_t) i, SCHC_AOE_FCN_ALL_1
+			};
+			size_t frag_len = sizeof(frag);
+
+			if (i % 3 == 0) {
+				frag_len = SCHC_AOE_ALL_1_HDR_LEN;
+			} else if (i % 3 == 1) {
+				frag[3] = SCHC_AOE_WINDOW_SIZE;
+			} else {
+				/* A regular tile, one byte too long */
+				frag[2] = 0;
+				frag_len = SCHC_AOE_HDR_LEN + SCHC_FRG_PAY_LEN + 1;
+			}
+
+			CHECK(schc_reass_input(&reass, DEVICE + i / 256, frag, frag_len,
+					       ignore, ignore, NULL) == SCHC_REASS_ERROR);
+			CHECK(reass.session_pool.used == 0);
+			CHECK(reass.buf_pool.used == 0);
+		}
+	}
+
+	return 0;
+}
+
+static int deliver(uint64_t device, const uint8_t *data, size_t len, void *arg)
+{
+	size_t *delivered = (size_t *) arg;
+
+	(void) device;
+	(void) data;
+	*delivered = len;
+
+	return 0;
+}
+
+static int check_aoe_max_len(void)
+{
+	static uint8_t packet[SCHC_AOE_MAX_PKT_LEN + 1];
+	struct schc_aoe_sender s;
+	uint8_t frag[SCHC_AOE_FRG_MAX_LEN];
+	int frag_len;
+	size_t delivered = 0;
+
+	schc_reass_init(&reass, NULL);
+
+	CHECK(schc_aoe_init(&s, packet, sizeof(packet), 0) != 0);
+	CHECK(schc_aoe_init(&s, packet, SCHC_AOE_MAX_PKT_LEN, 0) == 0);
+
+	while ((frag_len = schc_aoe_next(&s, frag, sizeof(frag))) > 0)
+		schc_reass_input(&reass, DEVICE, frag, frag_len, deliver, ignore, &delivered);
+
+	CHECK(frag_len == 0);
+	CHECK(delivered == SCHC_AOE_MAX_PKT_LEN);
+
+	return 0;
+}
+
+static int check_failed_compile(void)
+{
+	uint8_t schc_packet[SIZE_MTU_IPV6];
+	size_t schc_packet_len;
+
+	CHECK(schc_ruleset_compile_packed(&ruleset, rows, sizeof(rows) / sizeof(rows[0]),
+					  NULL, 0) == 0);
+	schc_ctx_init(&ctx, &ruleset);
+
+	/* Twice, the second from the flow cache */
+	for (int i = 0 ; i < 2 ; i++) {
+		CHECK(schc_compress(&ctx, ipv6_packet, sizeof(ipv6_packet), UPLINK,
+				    schc_packet, sizeof(schc_packet), &schc_packet_len) == 0);
+	}
+
+	/* The last rule has no SCHC_ROW_END */
+	CHECK(schc_ruleset_compile_packed(&ruleset, rows, sizeof(rows) / sizeof(rows[0]) - 1,
+					  NULL, 0) != 0);
+	CHECK(ruleset.nrules == 0);
+
+	/* No rule */
+	CHECK(schc_compress(&ctx, ipv6_packet, sizeof(ipv6_packet), UPLINK,
+			    schc_packet, sizeof(schc_packet), &schc_packet_len) != 0);
+
+	return 0;
+}
+
+static int check_ruleset_switch(void)
+{
+	uint8_t schc_packet[SIZE_MTU_IPV6];
+	uint8_t expected[SIZE_MTU_IPV6];
+	size_t schc_packet_len;
+	size_t expected_len;
+
+	/* Both compiled once, with the same generation */
+	static struct schc_ruleset first, second;
+
+	CHECK(schc_ruleset_compile_packed(&first, rows, sizeof(rows) / sizeof(rows[0]),
+					  NULL, 0) == 0);
+	CHECK(schc_ruleset_compile_packed(&second, other_rows,
+					  sizeof(other_rows) / sizeof(other_rows[0]), NULL, 0) == 0);
+
+	schc_ctx_init(&ctx, &second);
+	CHECK(schc_compress(&ctx, ipv6_packet, sizeof(ipv6_packet), UPLINK,
+			    expected, sizeof(expected), &expected_len) == 0);
+
+	schc_ctx_init(&ctx, &first);
+	for (int i = 0 ; i < 2 ; i++) {
+		CHECK(schc_compress(&ctx, ipv6_packet, sizeof(ipv6_packet), UPLINK,
+				    schc_packet, sizeof(schc_packet), &schc_packet_len) == 0);
+	}
+
+	ctx.ruleset = &second;
+	CHECK(schc_compress(&ctx, ipv6_packet, sizeof(ipv6_packet), UPLINK,
+			    schc_packet, sizeof(schc_packet), &schc_packet_len) == 0);
+	CHECK(schc_packet_len == expected_len &&
+	      memcmp(schc_packet, expected, expected_len) == 0);
+
+	return 0;
+}
+
+static int check_batch_slot(void)
+{
+	static uint8_t arena[4 * SIZE_MTU_IPV6];
+	uint8_t other[sizeof(ipv6_packet)];
+	uint8_t expected[SIZE_MTU_IPV6];
+	size_t expected_len;
+	struct schc_buf in[3] = {
+		{ ipv6_packet, sizeof(ipv6_packet) },
+		{ ipv6_packet, sizeof(ipv6_packet) },
+		{ other, sizeof(other) },
+	};
+	struct schc_buf out[3];
+
+	CHECK(schc_ruleset_compile_packed(&ruleset, batch_rows,
+					  sizeof(batch_rows) / sizeof(batch_rows[0]), NULL, 0) == 0);
+
+	schc_ctx_init(&ctx, &ruleset);
+	CHECK(schc_compress(&ctx, ipv6_packet, sizeof(ipv6_packet), UPLINK,
+			    expected, sizeof(expected), &expected_len) == 0);
+
+	/*
+	 * The device IIDs of other go through every cache entry, so some
+	 * share the one of ipv6_packet.
+	 */
+	memcpy(other, ipv6_packet, sizeof(other));
+	for (unsigned iid = 2 ; iid < 64 * SCHC_FLOW_CACHE_SIZE ; iid++) {
+		other[22] = iid >> 8;
+		other[23] = iid;
+
+		schc_ctx_init(&ctx, &ruleset);
+		CHECK(schc_compress_batch(&ctx, in, 3, UPLINK, arena, sizeof(arena), out) == 3);
+
+		for (int i = 0 ; i < 2 ; i++) {
+			CHECK(out[i].len == expected_len &&
+			      memcmp(out[i].data, expected, expected_len) == 0);
+		}
+
+		/* Longer, but right too */
+		uint8_t other_expected[SIZE_MTU_IPV6];
+		size_t other_expected_len;
+
+		schc_ctx_init(&ctx, &ruleset);
+		CHECK(schc_compress(&ctx, other, sizeof(other), UPLINK, other_expected,
+				    sizeof(other_expected), &other_expected_len) == 0);
+		CHECK(out[2].len == other_expected_len &&
+		      memcmp(out[2].data, other_expected, other_expected_len) == 0);
+	}
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        main()                                                  ***/
+/**********************************************************************/
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		int (*check)(void);
+	} checks[] = {
+		{ "aoe_bad_all_1", check_aoe_bad_all_1 },
+		{ "aoe_max_len", check_aoe_max_len },
+		{ "failed_compile", check_failed_compile },
+		{ "ruleset_switch", check_ruleset_switch },
+		{ "batch_slot", check_batch_slot },
+	};
+	int failed = 0;
+
+	for (size_t i = 0 ; i < sizeof(checks) / sizeof(checks[0]) ; i++) {
+		int ret = checks[i].check();
+
+		printf("%-20s %s\n", checks[i].name, ret == 0 ? "ok" : "FAILED");
+		if (ret != 0)
+			failed = 1;
+	}
+
+	return failed;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
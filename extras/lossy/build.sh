@@ -0,0 +1,18 @@
+# Builds the ACK-on-Error test over a simulated lossy link. The Arduino
+# sketch is not needed, only the SCHC library sources.
+#
+#   sh extras/lossy/build.sh && ./lossy_link
+# {
+
+set -xe
+
+SRC=$(dirname "$0")/../..
+CXXFLAGS="-std=gnu++11 -O2 -Wall -I$SRC"
+
+g++ $CXXFLAGS -o lossy_link $SRC/extras/lossy/lossy_link.cpp \
+	$SRC/fragment.cpp $SRC/reassembly.cpp $SRC/crc32.cpp $SRC/pool.cpp \
+	$SRC/timer.cpp $SRC/metrics.cpp $SRC/trace.cpp
+
+#
+# }
+#
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+
+/**
+ * \file
+ * \brief Sends SCHC packets with ACK-on-Error over a simulated lossy
+ * link, and checks that the sender and the receiver agree on every
+ * packet.
+ *
+ * The sender (fragment.h) and the receiver (reassembly.h) run on the
+ * same thread. Every fragment and every SCHC ACK is dropped with the
+ * given probability. The link does not reorder: a SCHC ACK is seen by
+ * the sender once schc_aoe_next() has nothing more to send, and if no
+ * SCHC ACK got through, its retransmission timer expires right away.
+ *
+ * The DTag of packet i is i modulo -d (256 by default), so the DTags
+ * are reused while the receiver still remembers the packets it
+ * delivered with them. By default there is no timer wheel: the sender
+ * calls schc_aoe_timeout() itself, and the receiver sessions never
+ * expire. With -w, the sender is a struct schc_aoe_session, and a wheel
+ * runs its retransmission timer and the inactivity timers of the
+ * receiver. Its clock only moves when the sender waits for a SCHC ACK
+ * that was lost, by SCHC_AOE_RETRANSMISSION_TIMEOUT ticks.
+ *
+ * For every loss rate, every packet ends in one of these:
+ *
+ * - ok: the sender got SCHC_AOE_DONE, and the receiver delivered it.
+ * - aborted: the sender gave up, which it knows.
+ * - silent: the sender got SCHC_AOE_DONE, but the receiver never
+ *   delivered it.
+ * - corrupt: the receiver delivered something else than the packet.
+ *
+ * The exit status is non-zero if there was any silent loss or corrupt
+ * delivery.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "fragment.h"
+#include "reassembly.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define PACKETS  3000
+#define DTAGS    256
+#define DEVICE   1
+
+/* Pending SCHC ACKs, more are dropped */
+#define MAX_ACKS 8
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct totals {
+	unsigned ok;
+	unsigned aborted;
+	unsigned silent;
+	unsigned corrupt;
+	unsigned long frames;
+	unsigned long acks;
+};
+
+struct link {
+	unsigned loss_percent;
+	struct totals *totals;
+	int status; /** Of the session, with -w */
+
+	/* The packet being sent */
+	const uint8_t *packet;
+	size_t packet_len;
+	int delivered;
+	int corrupt;
+
+	/* SCHC ACKs on their way to the sender */
+	unsigned nacks;
+	size_t ack_len[MAX_ACKS];
+	uint8_t ack[MAX_ACKS][SCHC_ACK_MAX_LEN];
+};
+
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
+static const unsigned loss_percents[] = { 0, 10, 20, 30, 40, 50 };
+
+static struct schc_reass reass;
+
+static struct schc_wheel wheel;
+static struct schc_aoe_session session;
+static uint32_t now;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static uint64_t rnd(void)
+{
+	/* xorshift64 */
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+
+	return rnd_state;
+}
+
+static int lost(const struct link *link)
+{
+	return rnd() % 100 < link->loss_percent;
+}
+
+static int deliver(uint64_t device, const uint8_t *data, size_t len, void *arg)
+{
+	struct link *link = (struct link *) arg;
+
+	if (len == link->packet_len && memcmp(data, link->packet, len) == 0)
+		link->delivered = 1;
+	else
+		link->corrupt = 1;
+
+	return 0;
+}
+
+static int send_ack(uint64_t device, const uint8_t *data, size_t len, void *arg)
+{
+	struct link *link = (struct link *) arg;
+
+	if (lost(link) || link->nacks == MAX_ACKS || len > SCHC_ACK_MAX_LEN)
+		return 0;
+
+	memcpy(link->ack[link->nacks], data, len);
+	link->ack_len[link->nacks++] = len;
+
+	return 0;
+}
+
+/*
+ * schc_aoe_session sink and done callback.
+ */
+static int session_sink(const uint8_t *frag, size_t frag_len, void *arg)
+{
+	struct link *link = (struct link *) arg;
+
+	link->totals->frames++;
+	if (!lost(link))
+		schc_reass_input(&reass, DEVICE, frag, frag_len, deliver, send_ack, link);
+
+	return 0;
+}
+
+static void session_done(struct schc_aoe_session *session, int status, void *arg)
+{
+	struct link *link = (struct link *) arg;
+
+	(void) session;
+
+	link->status = status;
+}
+
+/*
+ * Sends one packet until the sender is done or gives up.
+ *
+ * @return SCHC_AOE_DONE or SCHC_AOE_ABORT.
+ */
+static int send_packet(struct link *link, uint8_t dtag, struct totals *t)
+{
+	struct schc_aoe_sender s;
+	uint8_t frag[SCHC_AOE_FRG_MAX_LEN];
+	int frag_len;
+	int ret = SCHC_AOE_CONTINUE;
+
+	if (schc_aoe_init(&s, link->packet, link->packet_len, dtag) != 0)
+		return SCHC_AOE_ABORT;
+
+	while (ret == SCHC_AOE_CONTINUE) {
+
+		while ((frag_len = schc_aoe_next(&s, frag, sizeof(frag))) > 0) {
+			t->frames++;
+			if (!lost(link))
+				schc_reass_input(&reass, DEVICE, frag, frag_len,
+						 deliver, send_ack, link);
+		}
+
+		if (frag_len < 0)
+			return SCHC_AOE_ABORT;
+
+		if (link->nacks == 0) {
+			ret = schc_aoe_timeout(&s);
+			continue;
+		}
+
+		/* The ACKs the sender does not expect are ignored */
+		for (unsigned i = 0 ; i < link->nacks && ret == SCHC_AOE_CONTINUE ; i++) {
+			t->acks++;
+			ret = schc_aoe_ack(&s, link->ack[i], link->ack_len[i]);
+		}
+		link->nacks = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * The same with a struct schc_aoe_session: the SCHC ACKs are passed to
+ * it, and when none got through, the clock goes on until its timer
+ * expires.
+ */
+static int send_packet_session(struct link *link, uint8_t dtag, struct totals *t)
+{
+	size_t ack_len[MAX_ACKS];
+	uint8_t ack[MAX_ACKS][SCHC_ACK_MAX_LEN];
+
+	link->status = SCHC_AOE_CONTINUE;
+
+	if (schc_aoe_session_send(&session, link->packet, link->packet_len, dtag) != 0)
+		return SCHC_AOE_ABORT;
+
+	while (schc_aoe_session_busy(&session)) {
+
+		if (link->nacks == 0) {
+			now += SCHC_AOE_RETRANSMISSION_TIMEOUT;
+			schc_wheel_advance(&wheel, now);
+			continue;
+		}
+
+		/* Answering them may queue new ones */
+		unsigned nacks = link->nacks;
+
+		memcpy(ack_len, link->ack_len, sizeof(ack_len));
+		memcpy(ack, link->ack, sizeof(ack));
+		link->nacks = 0;
+
+		for (unsigned i = 0 ; i < nacks && schc_aoe_session_busy(&session) ; i++) {
+			t->acks++;
+			schc_aoe_session_ack(&session, ack[i], ack_len[i]);
+		}
+	}
+
+	return link->status;
+}
+
+static void run(unsigned loss_percent, unsigned npackets, unsigned ndtags,
+		int use_wheel, struct totals *t)
+{
+	static uint8_t packet[SCHC_REASS_BUF_LEN];
+	struct link link;
+
+	memset(&link, 0, sizeof(link));
+	memset(t, 0, sizeof(*t));
+	link.loss_percent = loss_percent;
+	link.totals = t;
+	link.packet = packet;
+
+	schc_wheel_init(&wheel, now);
+	schc_reass_init(&reass, use_wheel ? &wheel : NULL);
+	schc_aoe_session_init(&session, &wheel, session_sink, session_done, &link);
+
+	for (unsigned i = 0 ; i < npackets ; i++) {
+
+		/* Many packets fit in one or two tiles, to lose them whole */
+		if (rnd() % 2)
+			link.packet_len = 1 + rnd() % (2 * SCHC_FRG_PAY_LEN);
+		else
+			link.packet_len = 1 + rnd() % SCHC_REASS_BUF_LEN;
+
+		for (size_t j = 0 ; j < link.packet_len ; j++)
+			packet[j] = rnd();
+
+		link.delivered = 0;
+		link.corrupt = 0;
+		link.nacks = 0;
+
+		int ret = use_wheel ? send_packet_session(&link, i % ndtags, t) :
+				      send_packet(&link, i % ndtags, t);
+
+		if (link.corrupt)
+			t->corrupt++;
+		else if (ret != SCHC_AOE_DONE)
+			t->aborted++;
+		else if (!link.delivered)
+			t->silent++;
+		else
+			t->ok++;
+	}
+}
+
+/**********************************************************************/
+/***        main()                                                  ***/
+/**********************************************************************/
+
+int main(int argc, char *argv[])
+{
+	unsigned npackets = PACKETS;
+	unsigned ndtags = DTAGS;
+	int use_wheel = 0;
+	int failed = 0;
+
+	for (int i = 1 ; i < argc ; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			npackets = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			ndtags = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-w") == 0) {
+			use_wheel = 1;
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			rnd_state = strtoull(argv[++i], NULL, 0) | 1;
+		} else {
+			fprintf(stderr, "Usage: %s [-w] [-n packets] [-d dtags] [-s seed]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (ndtags == 0 || ndtags > 256) {
+		fprintf(stderr, "-d must be from 1 to 256\n");
+		return 1;
+	}
+
+	printf("# %u packets, %u DTags, %s\n", npackets, ndtags,
+	       use_wheel ? "timer wheel" : "no timer wheel");
+	printf("loss%%     ok aborted silent corrupt   frames    acks\n");
+
+	for (size_t l = 0 ; l < sizeof(loss_percents) / sizeof(loss_percents[0]) ; l++) {
+		struct totals t;
+
+		run(loss_percents[l], npackets, ndtags, use_wheel, &t);
+
+		printf("%5u %6u %7u %6u %7u %8lu %7lu\n", loss_percents[l], t.ok,
+		       t.aborted, t.silent, t.corrupt, t.frames, t.acks);
+
+		if (t.silent != 0 || t.corrupt != 0)
+			failed = 1;
+	}
+
+	return failed;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
@@ -0,0 +1,17 @@
+
+# Builds the decoder of the trace dumps (trace.h). It only needs the
+# header, the records are formatted from the event table.
+#
+#   sh extras/trace/build.sh && ./schc_trace dump.bin
+# {
+
+set -xe
+
+SRC=$(dirname "$0")/../..
+CXXFLAGS="-std=gnu++11 -O2 -Wall -I$SRC"
+
+g++ $CXXFLAGS -o schc_trace $SRC/extras/trace/schc_trace.cpp
+
+#
+# }
+#
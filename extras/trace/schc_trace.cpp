@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Decoder of the trace dumps (trace.h).
+ *
+ * Reads a dump from a file, or from stdin, and prints one line per
+ * record: the time in seconds since the first record, the event and
+ * its arguments. The input may have anything before the dump (the
+ * text printed to a Serial port for instance), the dump starts at the
+ * first "SCTR". Several dumps are decoded one after the other.
+ *
+ * \verbatim
+ * schc_trace [dump]
+ * \endverbatim
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "trace.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define SCHC_TRACE_NAME(id, name, format) name,
+#define SCHC_TRACE_FORMAT(id, name, format) format,
+
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
+static const char *const event_name[] = {
+	SCHC_TRACE_EVENTS(SCHC_TRACE_NAME)
+};
+
+static const char *const event_format[] = {
+	SCHC_TRACE_EVENTS(SCHC_TRACE_FORMAT)
+};
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+
+	for (int i = n - 1 ; i >= 0 ; i--)
+		v = (v << 8) | p[i];
+
+	return v;
+}
+
+static void print_record(const uint8_t *rec, uint64_t first, uint64_t ticks_per_second)
+{
+	uint64_t ticks = get_le(rec, 8) - first;
+	unsigned event = get_le(rec + 8, 2);
+	unsigned arg[SCHC_TRACE_ARGS];
+
+	for (int a = 0 ; a < SCHC_TRACE_ARGS ; a++)
+		arg[a] = get_le(rec + 12 + 4 * a, 4);
+
+	if (ticks_per_second != 0)
+		printf("%12.6f ", (double) ticks / ticks_per_second);
+	else
+		printf("%12llu ", (unsigned long long) ticks);
+
+	if (event >= SCHC_EV_COUNT) {
+		printf("%-17s %u %u %u\n", "unknown", arg[0], arg[1], arg[2]);
+		return;
+	}
+
+	printf("%-17s ", event_name[event]);
+	printf(event_format[event], arg[0], arg[1], arg[2]);
+	printf("\n");
+}
+
+/*
+ * Decodes the dump at buf[0], returns its length, or 0 if it is cut.
+ */
+static size_t decode(const uint8_t *buf, size_t len)
+{
+	if (len < SCHC_TRACE_HDR_LEN)
+		return 0;
+
+	unsigned version = buf[4];
+	uint64_t ticks_per_second = get_le(buf + 8, 8);
+	uint32_t n = get_le(buf + 16, 4);
+	size_t dump_len = SCHC_TRACE_HDR_LEN + (size_t) n * SCHC_TRACE_REC_LEN;
+
+	if (version != SCHC_TRACE_VERSION) {
+		fprintf(stderr, "Trace version %u not supported\n", version);
+		return SCHC_TRACE_HDR_LEN;
+	}
+
+	if (dump_len > len)
+		return 0;
+
+	const uint8_t *rec = buf + SCHC_TRACE_HDR_LEN;
+	uint64_t first = n > 0 ? get_le(rec, 8) : 0;
+
+	printf("# %u records, %llu ticks per second\n", n,
+	       (unsigned long long) ticks_per_second);
+
+	for (uint32_t i = 0 ; i < n ; i++, rec += SCHC_TRACE_REC_LEN)
+		print_record(rec, first, ticks_per_second);
+
+	return dump_len;
+}
+
+/**********************************************************************/
+/***        main()                                                  ***/
+/**********************************************************************/
+
+int main(int argc, char *argv[])
+{
+	FILE *f = stdin;
+	std::vector<uint8_t> buf;
+	uint8_t chunk[4096];
+	size_t n;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [dump]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2 && (f = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		buf.insert(buf.end(), chunk, chunk + n);
+
+	size_t pos = 0;
+	int dumps = 0;
+
+	while (pos + 4 <= buf.size()) {
+		if (memcmp(&buf[pos], "SCTR", 4) != 0) {
+			pos++;
+			continue;
+		}
+
+		size_t len = decode(&buf[pos], buf.size() - pos);
+
+		if (len == 0) {
+			fprintf(stderr, "The dump at offset %zu is cut\n", pos);
+			return 1;
+		}
+		pos += len;
+		dumps++;
+	}
+
+	if (dumps == 0) {
+		fprintf(stderr, "No trace dump found\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
@@ -0,0 +1,548 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the fragment.h functions.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "fragment.h"
+#include "metrics.h"
+#include "trace.h"
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+/*
+ * Writes the ACK-on-Error fragment carrying the given tile. The first
+ * pass over the packet ends with the last tile, so the RCS is already
+ * final whenever the All-1 fragment is built.
+ */
+static int aoe_write_tile(struct schc_aoe_sender *s, uint16_t tile,
+		uint8_t *frag, size_t frag_cap)
+{
+	size_t offset = (size_t) tile * SCHC_FRG_PAY_LEN;
+	size_t tile_len = MIN(s->schc_packet_len - offset, SCHC_FRG_PAY_LEN);
+	int last = (tile == s->ntiles - 1);
+	size_t hdr_len = last ? SCHC_AOE_ALL_1_HDR_LEN : SCHC_AOE_HDR_LEN;
+	uint8_t w = tile / SCHC_AOE_WINDOW_SIZE;
+	uint8_t fcn = SCHC_AOE_WINDOW_SIZE - 1 - tile % SCHC_AOE_WINDOW_SIZE;
+
+	if (hdr_len + tile_len > frag_cap) {
+		return -1;
+	}
+
+	memcpy(frag + hdr_len, s->schc_packet + offset, tile_len);
+	if (s->state == AOE_SENDING) {
+		s->rcs = crc32_update(s->rcs, frag + hdr_len, tile_len);
+	}
+
+	frag[0] = SCHC_FRG_ACK_RULEID;
+	frag[1] = s->dtag;
+	frag[2] = (w << 6) | (last ? SCHC_AOE_FCN_ALL_1 : fcn);
+
+	if (last) {
+		uint32_t rcs = crc32_final(s->rcs);
+
+		frag[3] = tile % SCHC_AOE_WINDOW_SIZE;
+		frag[4] = rcs >> 24;
+		frag[5] = rcs >> 16;
+		frag[6] = rcs >> 8;
+		frag[7] = rcs;
+	}
+
+	return hdr_len + tile_len;
+}
+
+/*
+ * The schc_aoe_ack() return value matching the sender state.
+ */
+static int aoe_status(const struct schc_aoe_sender *s)
+{
+	switch (s->state) {
+		case AOE_DONE:
+			return SCHC_AOE_DONE;
+		case AOE_ABORTED:
+			return SCHC_AOE_ABORT;
+		default:
+			return SCHC_AOE_CONTINUE;
+	}
+}
+
+static int bitmap_get(const uint8_t *bitmap, uint8_t i)
+{
+	return bitmap[i / 8] & (0x80 >> (i % 8));
+}
+
+static void aoe_session_end(struct schc_aoe_session *session, int status)
+{
+	schc_timer_cancel(session->wheel, &session->retransmission);
+
+	if (session->done != NULL)
+		session->done(session, status, session->arg);
+}
+
+/*
+ * Sends everything the sender has to send, and then waits for the SCHC
+ * ACK. The sink may pass a SCHC ACK to schc_aoe_session_ack() before it
+ * returns, so the sender may be done by then.
+ */
+static int aoe_session_pump(struct schc_aoe_session *session)
+{
+	struct schc_aoe_sender *s = &session->sender;
+	uint8_t frag[SCHC_AOE_FRG_MAX_LEN];
+	int frag_len;
+
+	while ((frag_len = schc_aoe_next(s, frag, sizeof(frag))) > 0) {
+		if (session->sink(frag, frag_len, session->arg) != 0) {
+			frag_len = -1;
+			break;
+		}
+	}
+
+	if (frag_len < 0 && schc_aoe_session_busy(session)) {
+		s->state = AOE_ABORTED;
+		aoe_session_end(session, SCHC_AOE_ABORT);
+	}
+
+	if (s->state == AOE_WAIT_ACK)
+		schc_timer_add(session->wheel, &session->retransmission,
+			       SCHC_AOE_RETRANSMISSION_TIMEOUT);
+
+	return aoe_status(s);
+}
+
+static void aoe_session_expired(struct schc_timer *timer, void *arg)
+{
+	struct schc_aoe_session *session = (struct schc_aoe_session *) arg;
+	int ret = schc_aoe_timeout(&session->sender);
+
+	(void) timer;
+
+	if (ret == SCHC_AOE_CONTINUE)
+		aoe_session_pump(session);
+	else
+		aoe_session_end(session, ret);
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+int schc_frag_init(struct schc_frag_iter *it, const uint8_t *schc_packet,
+		size_t schc_packet_len)
+{
+	size_t nfrag = (schc_packet_len + SCHC_FRG_PAY_LEN - 1) / SCHC_FRG_PAY_LEN;
+
+	if (nfrag == 0 || nfrag > 256) {
+		return -1;
+	}
+
+	it->schc_packet = schc_packet;
+	it->schc_packet_len = schc_packet_len;
+	it->offset = 0;
+	it->fcn = nfrag - 1;
+	it->rcs = CRC32_INIT;
+
+	return 0;
+}
+
+int schc_frag_next(struct schc_frag_iter *it, uint8_t *frag, size_t frag_cap)
+{
+	size_t bytes_left = it->schc_packet_len - it->offset;
+
+	if (bytes_left == 0) {
+		return 0;
+	}
+
+	size_t tile_len = MIN(bytes_left, SCHC_FRG_PAY_LEN);
+	int last = (tile_len == bytes_left);
+	size_t hdr_len = SCHC_FRG_HDR_LEN + (last ? CRC32_LEN : 0);
+
+	if (hdr_len + tile_len > frag_cap) {
+		return -1;
+	}
+
+	/*
+	 * The tile is copied once, and the RCS is updated from the copy,
+	 * which is already in cache.
+	 */
+	uint8_t *tile = frag + hdr_len;
+
+	memcpy(tile, it->schc_packet + it->offset, tile_len);
+	it->rcs = crc32_update(it->rcs, tile, tile_len);
+	it->offset += tile_len;
+
+	frag[0] = SCHC_FRG_RULEID;
+	frag[1] = it->fcn--;
+
+	if (last) {
+		uint32_t rcs = crc32_final(it->rcs);
+
+		frag[2] = rcs >> 24;
+		frag[3] = rcs >> 16;
+		frag[4] = rcs >> 8;
+		frag[5] = rcs;
+	}
+
+	return hdr_len + tile_len;
+}
+
+int schc_fragmentate(const uint8_t *schc_packet, size_t schc_packet_len,
+		schc_frag_sink sink, void *arg)
+{
+	struct schc_metrics *m = schc_metrics_get();
+	schc_tick_t start = schc_metrics_start(m);
+
+	SCHC_TRACE1(FRAGMENT, schc_packet_len);
+
+	/*
+	 * If the packet len is equal or less than the max size of a
+	 * L2 packet, we send the packet as is, without fragmentation
+	 */
+	if (schc_packet_len <= MAX_SCHC_PKT_LEN) {
+		int ret = sink(schc_packet, schc_packet_len, arg);
+
+		if (ret != 0) {
+			return ret;
+		}
+		SCHC_METRIC_ADD(m, frag_packets, 1);
+		SCHC_METRIC_ADD(m, frag_frames, 1);
+		schc_metrics_latency(m, SCHC_LAT_FRAGMENT, start, 1);
+		return 0;
+	}
+
+	struct schc_frag_iter it;
+	uint8_t frag[SCHC_FRG_MAX_LEN];
+	int frag_len;
+
+	if (schc_frag_init(&it, schc_packet, schc_packet_len) != 0) {
+		return -1;
+	}
+
+	while ((frag_len = schc_frag_next(&it, frag, sizeof(frag))) > 0) {
+		SCHC_TRACE2(FRAG_SEND, frag[1], frag_len);
+		if (sink(frag, frag_len, arg) != 0) {
+			return -1;
+		}
+		SCHC_METRIC_ADD(m, frag_frames, 1);
+	}
+
+	if (frag_len == 0) {
+		SCHC_METRIC_ADD(m, frag_packets, 1);
+		schc_metrics_latency(m, SCHC_LAT_FRAGMENT, start, 1);
+	}
+
+	return frag_len;
+}
+
+int schc_aoe_init(struct schc_aoe_sender *s, const uint8_t *schc_packet,
+		size_t schc_packet_len, uint8_t dtag)
+{
+	if (schc_packet_len == 0 || schc_packet_len > SCHC_AOE_MAX_PKT_LEN) {
+		return -1;
+	}
+
+	s->schc_packet = schc_packet;
+	s->schc_packet_len = schc_packet_len;
+	s->ntiles = (schc_packet_len + SCHC_FRG_PAY_LEN - 1) / SCHC_FRG_PAY_LEN;
+	s->tile = 0;
+	s->tile_end = s->ntiles;
+	s->dtag = dtag;
+	s->state = AOE_SENDING;
+	s->window = 0;
+	s->attempts = 0;
+	s->ack_req = 0;
+	s->all_1 = 0;
+	s->rcs = CRC32_INIT;
+
+	SCHC_METRIC_ADD(schc_metrics_get(), frag_packets, 1);
+
+	return 0;
+}
+
+int schc_aoe_next(struct schc_aoe_sender *s, uint8_t *frag, size_t frag_cap)
+{
+	int frag_len;
+	struct schc_metrics *m = schc_metrics_get();
+
+	switch (s->state) {
+		case AOE_SENDING:
+			frag_len = aoe_write_tile(s, s->tile, frag, frag_cap);
+			if (frag_len > 0) {
+				SCHC_METRIC_ADD(m, frag_frames, 1);
+				if (++s->tile == s->ntiles) {
+					/* The All-1 fragment asks for the SCHC ACK */
+					s->state = AOE_WAIT_ACK;
+				}
+			}
+			return frag_len;
+
+		case AOE_RESENDING:
+			for ( ; s->tile < s->tile_end ; s->tile++) {
+				if (bitmap_get(s->bitmap, s->tile % SCHC_AOE_WINDOW_SIZE))
+					continue;
+
+				frag_len = aoe_write_tile(s, s->tile, frag, frag_cap);
+				if (frag_len > 0) {
+					SCHC_METRIC_ADD(m, frag_frames, 1);
+					s->tile++;
+				}
+				return frag_len;
+			}
+			s->state = AOE_WAIT_ACK;
+			/* FALLTHROUGH */
+
+		case AOE_WAIT_ACK:
+			if (s->all_1) {
+				frag_len = aoe_write_tile(s, s->ntiles - 1, frag, frag_cap);
+				if (frag_len > 0) {
+					SCHC_METRIC_ADD(m, frag_frames, 1);
+					s->all_1 = 0;
+				}
+				return frag_len;
+			}
+			if (!s->ack_req) {
+				return 0;
+			}
+			if (frag_cap < SCHC_AOE_HDR_LEN) {
+				return -1;
+			}
+
+			frag[0] = SCHC_FRG_ACK_RULEID;
+			frag[1] = s->dtag;
+			frag[2] = ((s->tile_end - 1) / SCHC_AOE_WINDOW_SIZE) << 6;
+			s->ack_req = 0;
+
+			return SCHC_AOE_HDR_LEN;
+
+		default:
+			return 0;
+	}
+}
+
+int schc_aoe_ack(struct schc_aoe_sender *s, const uint8_t *ack, size_t ack_len)
+{
+	uint8_t dtag, w;
+	int c;
+	uint8_t bitmap[SCHC_ACK_BITMAP_LEN];
+
+	if (s->state != AOE_WAIT_ACK ||
+	    schc_ack_parse(ack, ack_len, &dtag, &w, &c, bitmap) != 0 ||
+	    dtag != s->dtag) {
+		return aoe_status(s);
+	}
+
+	if (c) {
+		s->state = AOE_DONE;
+		return SCHC_AOE_DONE;
+	}
+
+	uint16_t first = w * SCHC_AOE_WINDOW_SIZE;
+	uint16_t end = MIN(first + SCHC_AOE_WINDOW_SIZE, s->ntiles);
+	int missing = 0;
+	int all_1_missing = 0;
+
+	if (first >= s->ntiles) {
+		return SCHC_AOE_CONTINUE;
+	}
+
+	/* The receiver reports the lowest window with missing tiles */
+	if (w > s->window) {
+		s->window = w;
+		s->attempts = 0;
+	}
+
+	for (uint16_t i = first ; i < end ; i++) {
+		if (!bitmap_get(bitmap, i - first)) {
+			missing = 1;
+			all_1_missing = (i == s->ntiles - 1);
+		}
+	}
+
+	/*
+	 * The receiver has every tile of the window, so it should not
+	 * report it: the RCS did not match, sending it again is useless.
+	 */
+	if (!missing || ++s->attempts > SCHC_MAX_ACK_REQUESTS) {
+		s->state = AOE_ABORTED;
+		return SCHC_AOE_ABORT;
+	}
+
+	memcpy(s->bitmap, bitmap, sizeof(bitmap));
+	s->tile = first;
+	s->tile_end = end;
+	s->ack_req = !all_1_missing;
+	s->all_1 = 0;
+	s->state = AOE_RESENDING;
+
+	return SCHC_AOE_CONTINUE;
+}
+
+int schc_aoe_timeout(struct schc_aoe_sender *s)
+{
+	if (s->state != AOE_WAIT_ACK) {
+		return aoe_status(s);
+	}
+
+	if (++s->attempts > SCHC_MAX_ACK_REQUESTS) {
+		s->state = AOE_ABORTED;
+		return SCHC_AOE_ABORT;
+	}
+
+	/* The RCS tells the receiver which packet the request is for */
+	s->ack_req = 0;
+	s->all_1 = 1;
+
+	return SCHC_AOE_CONTINUE;
+}
+
+void schc_aoe_session_init(struct schc_aoe_session *session,
+		struct schc_wheel *wheel, schc_frag_sink sink,
+		schc_aoe_done_cb done, void *arg)
+{
+	memset(&session->sender, 0, sizeof(session->sender));
+	session->sender.state = AOE_DONE; /* with nothing */
+	session->wheel = wheel;
+	session->sink = sink;
+	session->done = done;
+	session->arg = arg;
+
+	schc_timer_init(&session->retransmission, aoe_session_expired, session);
+}
+
+int schc_aoe_session_send(struct schc_aoe_session *session,
+		const uint8_t *schc_packet, size_t schc_packet_len, uint8_t dtag)
+{
+	if (schc_aoe_session_busy(session) ||
+	    schc_aoe_init(&session->sender, schc_packet, schc_packet_len, dtag) != 0) {
+		return -1;
+	}
+
+	return aoe_session_pump(session) == SCHC_AOE_ABORT;
+}
+
+int schc_aoe_session_ack(struct schc_aoe_session *session,
+		const uint8_t *ack, size_t ack_len)
+{
+	int busy = schc_aoe_session_busy(session);
+	int ret = schc_aoe_ack(&session->sender, ack, ack_len);
+
+	if (!schc_aoe_session_busy(session)) {
+		/* Unless it was done before this ACK */
+		if (busy)
+			aoe_session_end(session, ret);
+		return ret;
+	}
+
+	if (session->sender.state != AOE_RESENDING) {
+		/* Ignored, the timer goes on */
+		return ret;
+	}
+
+	schc_timer_cancel(session->wheel, &session->retransmission);
+
+	return aoe_session_pump(session);
+}
+
+int schc_aoe_session_busy(const struct schc_aoe_session *session)
+{
+	return session->sender.state != AOE_DONE &&
+	       session->sender.state != AOE_ABORTED;
+}
+
+int schc_ack_build(uint8_t *ack, size_t ack_cap, uint8_t dtag, uint8_t w,
+		int c, const uint8_t *bitmap)
+{
+	uint8_t bm[SCHC_ACK_BITMAP_LEN];
+	size_t bitmap_len = 0;
+
+	if (!c) {
+		memcpy(bm, bitmap, sizeof(bm));
+		/* The padding bits of the last byte do not stand for a tile */
+		bm[sizeof(bm) - 1] |= (1 << (sizeof(bm) * 8 - SCHC_AOE_WINDOW_SIZE)) - 1;
+
+		bitmap_len = sizeof(bm);
+		while (bitmap_len > 0 && bm[bitmap_len - 1] == 0xFF)
+			bitmap_len--;
+	}
+
+	if (SCHC_AOE_HDR_LEN + bitmap_len > ack_cap) {
+		return -1;
+	}
+
+	ack[0] = SCHC_FRG_ACK_RULEID;
+	ack[1] = dtag;
+	ack[2] = (w << 6) | (c ? 0x20 : 0);
+	memcpy(ack + SCHC_AOE_HDR_LEN, bm, bitmap_len);
+
+	return SCHC_AOE_HDR_LEN + bitmap_len;
+}
+
+int schc_ack_parse(const uint8_t *ack, size_t ack_len, uint8_t *dtag,
+		uint8_t *w, int *c, uint8_t *bitmap)
+{
+	if (ack_len < SCHC_AOE_HDR_LEN || ack_len > SCHC_ACK_MAX_LEN ||
+	    ack[0] != SCHC_FRG_ACK_RULEID) {
+		return -1;
+	}
+
+	*dtag = ack[1];
+	*w = ack[2] >> 6;
+	*c = (ack[2] & 0x20) != 0;
+
+	/* The bytes not sent had all the bits set */
+	memset(bitmap, 0xFF, SCHC_ACK_BITMAP_LEN);
+	if (!*c) {
+		memcpy(bitmap, ack + SCHC_AOE_HDR_LEN, ack_len - SCHC_AOE_HDR_LEN);
+	}
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
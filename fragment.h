@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+/**
+ * \file
+ *
+ * \brief SCHC Fragmentation (SCHC F/R sender side).
+ *
+ * The fragments are produced one at a time, either pulling them with
+ * schc_frag_next() into a caller buffer, or letting schc_fragmentate()
+ * push them to a sink callback. In both cases the memory used does not
+ * depend on the length of the SCHC packet, and every byte of the packet
+ * is copied only once, to the fragment being built.
+ *
+ * Format of the SCHC Fragments:
+ *
+ * \verbatim
+ * +---------+-----+----------- ... -----------+
+ * | Rule ID | FCN |          Tile             |   all but the last
+ * +---------+-----+----------- ... -----------+
+ *
+ * +---------+-----+---------+------ ... ------+
+ * | Rule ID | FCN |   RCS   |      Tile       |   last one (FCN = 0)
+ * +---------+-----+---------+------ ... ------+
+ *    8 bits  8 bits 32 bits
+ * \endverbatim
+ *
+ * The FCN goes down from the number of fragments minus one to zero, so
+ * the last fragment is the one with FCN zero. The RCS is the CRC32 of
+ * the whole SCHC packet.
+ *
+ * This is the No-ACK mode: nothing tells the sender that a fragment was
+ * lost. For lossy links there is also the ACK-on-Error mode, where the
+ * tiles are grouped in windows of SCHC_AOE_WINDOW_SIZE tiles and the
+ * receiver reports the missing ones in a SCHC ACK, so only those are
+ * sent again. All its headers are byte aligned:
+ *
+ * \verbatim
+ * +---------+------+-----+-----+------ ... ------+
+ * | Rule ID | DTag |  W  | FCN |      Tile       |   regular fragment
+ * +---------+------+-----+-----+------ ... ------+
+ *
+ * +---------+------+-----+-----+-----+---------+-- ... --+
+ * | Rule ID | DTag |  W  |All-1| Pos |   RCS   |  Tile   |   last one
+ * +---------+------+-----+-----+-----+---------+-- ... --+
+ *
+ * +---------+------+-----+-----+
+ * | Rule ID | DTag |  W  |  0  |                      ACK REQ
+ * +---------+------+-----+-----+
+ *
+ * +---------+------+-----+---+-------+---- ... ----+
+ * | Rule ID | DTag |  W  | C |   0   |   Bitmap    |   SCHC ACK
+ * +---------+------+-----+---+-------+---- ... ----+
+ *    8 bits  8 bits 2 bits 1b  5 bits
+ * \endverbatim
+ *
+ * In each window the FCN goes down from SCHC_AOE_WINDOW_SIZE - 1 to 0,
+ * and the last tile of the packet always goes in the All-1 fragment.
+ * Pos is the position of that tile in window W, so the receiver knows
+ * the number of tiles even if the fragments before it were lost.
+ * The bit i (MSB first) of the bitmap is set if the tile i of window W
+ * was received. The trailing bytes of the bitmap with all the bits set
+ * are not sent. The bitmap is only sent when C (the RCS was checked
+ * and is correct) is zero.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "crc32.h"
+#include "timer.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * Length of the header of a SCHC Fragment (Rule ID and FCN).
+ */
+#define SCHC_FRG_HDR_LEN 2
+
+/**
+ * Maximum length of a SCHC Fragment, the last one.
+ */
+#define SCHC_FRG_MAX_LEN (SCHC_FRG_HDR_LEN + CRC32_LEN + SCHC_FRG_PAY_LEN)
+
+// ACK-on-Error {
+
+/**
+ * Length of the header of an ACK-on-Error fragment (Rule ID, DTag and
+ * W/FCN).
+ */
+#define SCHC_AOE_HDR_LEN 3
+
+/**
+ * Length of the header of the All-1 fragment (with Pos and RCS), and
+ * maximum length of an ACK-on-Error fragment.
+ */
+#define SCHC_AOE_ALL_1_HDR_LEN (SCHC_AOE_HDR_LEN + 1 + CRC32_LEN)
+#define SCHC_AOE_FRG_MAX_LEN (SCHC_AOE_ALL_1_HDR_LEN + SCHC_FRG_PAY_LEN)
+
+/**
+ * Tiles per window, the FCN of the All-1 fragment, and the number of
+ * windows the W field can tell apart.
+ */
+#define SCHC_AOE_WINDOW_SIZE 63
+#define SCHC_AOE_FCN_ALL_1   63
+#define SCHC_AOE_MAX_WINDOWS 4
+
+/**
+ * Maximum number of tiles of a SCHC packet sent in ACK-on-Error mode.
+ */
+#define SCHC_AOE_MAX_TILES (SCHC_AOE_WINDOW_SIZE * SCHC_AOE_MAX_WINDOWS)
+
+/**
+ * Longest SCHC packet sent in ACK-on-Error mode: an IPv6 MTU, the
+ * longest SCHC packet schc_compress() builds and the size of the
+ * reassembly buffers (SCHC_REASS_BUF_LEN), unless fewer bytes fit in
+ * SCHC_AOE_MAX_TILES tiles. The receiver drops anything longer.
+ */
+#define SCHC_AOE_MAX_PKT_LEN MIN(SCHC_AOE_MAX_TILES * SCHC_FRG_PAY_LEN, SIZE_MTU_IPV6)
+
+/**
+ * Length of the uncompressed bitmap of a window, and maximum length of
+ * a SCHC ACK.
+ */
+#define SCHC_ACK_BITMAP_LEN ((SCHC_AOE_WINDOW_SIZE + 7) / 8)
+#define SCHC_ACK_MAX_LEN (SCHC_AOE_HDR_LEN + SCHC_ACK_BITMAP_LEN)
+
+/**
+ * Maximum number of ACK rounds (SCHC ACKs received with missing tiles,
+ * plus retransmission timer expirations) for a window before the sender
+ * gives up.
+ */
+#ifndef SCHC_MAX_ACK_REQUESTS
+#define SCHC_MAX_ACK_REQUESTS 8
+#endif
+
+/**
+ * Ticks (see timer.h) a struct schc_aoe_session waits for a SCHC ACK
+ * before its retransmission timer expires.
+ */
+#ifndef SCHC_AOE_RETRANSMISSION_TIMEOUT
+#define SCHC_AOE_RETRANSMISSION_TIMEOUT 20000UL /* 20 seconds of millis() */
+#endif
+
+/**
+ * Return values of schc_aoe_ack().
+ */
+#define SCHC_AOE_ABORT    -1
+#define SCHC_AOE_CONTINUE  0
+#define SCHC_AOE_DONE      1
+
+// } ACK-on-Error
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * \brief Called for every SCHC Fragment (or for the whole SCHC packet,
+ * if it does not need fragmentation) to send it.
+ *
+ * The fragment is only valid during the call.
+ *
+ * @return 0 if successfull, non-zero to abort the fragmentation.
+ */
+typedef int (*schc_frag_sink)(const uint8_t *frag, size_t frag_len, void *arg);
+
+/**
+ * \brief State of the fragmentation of a SCHC packet. The packet is not
+ * copied, it must remain valid until the last fragment is produced.
+ */
+struct schc_frag_iter {
+	const uint8_t *schc_packet;
+	size_t schc_packet_len;
+	size_t offset;  /** Bytes of the packet already fragmented */
+	uint8_t fcn;    /** FCN of the next fragment */
+	uint32_t rcs;   /** CRC32 state of the bytes already fragmented */
+};
+
+/**
+ * \brief States of the ACK-on-Error sender.
+ */
+enum schc_aoe_state {
+	AOE_SENDING,   /** Sending the tiles for the first time */
+	AOE_RESENDING, /** Sending the tiles missing in the last SCHC ACK */
+	AOE_WAIT_ACK,  /** Everything sent, waiting for a SCHC ACK */
+	AOE_DONE,      /** The receiver reassembled the packet */
+	AOE_ABORTED    /** Too many attempts, or the RCS did not match */
+};
+
+/**
+ * \brief State of the ACK-on-Error sender of a SCHC packet.
+ *
+ * Like with the No-ACK iterator, the packet is not copied and must
+ * remain valid until the sender is done. The state does not depend on
+ * the packet length: the tiles are sent again from the packet itself.
+ */
+struct schc_aoe_sender {
+	const uint8_t *schc_packet;
+	size_t schc_packet_len;
+	uint16_t ntiles;
+	uint16_t tile;      /** Next tile to send, or to check if missing */
+	uint16_t tile_end;  /** End of the window being resent */
+	uint8_t dtag;
+	uint8_t state;      /** enum schc_aoe_state */
+	uint8_t window;     /** Lowest window not acknowledged yet */
+	uint8_t attempts;   /** ACK rounds for this window */
+	uint8_t ack_req;    /** Non-zero if an ACK REQ must be sent */
+	uint8_t all_1;      /** Non-zero if the All-1 must be sent again */
+	uint32_t rcs;       /** CRC32 state, final once the All-1 is built */
+	uint8_t bitmap[SCHC_ACK_BITMAP_LEN]; /** Of the window being resent */
+};
+
+struct schc_aoe_session;
+
+/**
+ * \brief Called when a struct schc_aoe_session is done with its packet,
+ * with SCHC_AOE_DONE or SCHC_AOE_ABORT.
+ */
+typedef void (*schc_aoe_done_cb)(struct schc_aoe_session *session,
+		int status, void *arg);
+
+/**
+ * \brief An ACK-on-Error sender driven by a timer wheel.
+ *
+ * The fragments go to sink as soon as schc_aoe_next() returns them.
+ * When it returns 0, the retransmission timer is added to the wheel,
+ * and it is cancelled by the SCHC ACK that makes the sender resend
+ * tiles or finish. If it expires first, schc_aoe_timeout() is called
+ * and the All-1 is sent again.
+ */
+struct schc_aoe_session {
+	struct schc_aoe_sender sender;
+	struct schc_wheel *wheel;
+	struct schc_timer retransmission;
+	schc_frag_sink sink;
+	schc_aoe_done_cb done; /** May be NULL */
+	void *arg;
+};
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Starts the fragmentation of a SCHC packet.
+ *
+ * @return 0 if successfull, non-zero if the packet needs more fragments
+ * than the FCN can count.
+ */
+int schc_frag_init(struct schc_frag_iter *it, const uint8_t *schc_packet,
+		size_t schc_packet_len);
+
+/**
+ * \brief Writes the next SCHC Fragment to frag.
+ *
+ * @param [out] frag Where the fragment is written, at least
+ * SCHC_FRG_MAX_LEN bytes long.
+ *
+ * @return The length of the fragment, 0 if there are no more fragments,
+ * or -1 if frag_cap is too small.
+ */
+int schc_frag_next(struct schc_frag_iter *it, uint8_t *frag, size_t frag_cap);
+
+/**
+ * \brief Sends the SCHC Packet to sink, as a whole if it is short
+ * enough, or as a series of SCHC Fragments.
+ *
+ * Only one fragment exists at a time, in the stack of this function.
+ *
+ * @return 0 if successfull, non-zero if there was an error or if sink
+ * aborted the fragmentation.
+ */
+int schc_fragmentate(const uint8_t *schc_packet, size_t schc_packet_len,
+		schc_frag_sink sink, void *arg);
+
+/**
+ * \brief Starts the ACK-on-Error fragmentation of a SCHC packet.
+ *
+ * @param dtag Tells this packet apart from the previous one, so the
+ * receiver does not mix their tiles.
+ *
+ * @return 0 if successfull, non-zero if the packet is empty or longer
+ * than SCHC_AOE_MAX_PKT_LEN.
+ */
+int schc_aoe_init(struct schc_aoe_sender *s, const uint8_t *schc_packet,
+		size_t schc_packet_len, uint8_t dtag);
+
+/**
+ * \brief Writes to frag the next fragment (or ACK REQ) to send.
+ *
+ * It must be called until it returns 0, then the caller waits for a
+ * SCHC ACK, and passes it to schc_aoe_ack(), or calls
+ * schc_aoe_timeout() if none arrives in time.
+ *
+ * @param [out] frag At least SCHC_AOE_FRG_MAX_LEN bytes long.
+ *
+ * @return The length of the fragment, 0 if there is nothing to send
+ * now, or -1 if frag_cap is too small.
+ */
+int schc_aoe_next(struct schc_aoe_sender *s, uint8_t *frag, size_t frag_cap);
+
+/**
+ * \brief Processes a SCHC ACK received for this packet.
+ *
+ * If tiles are missing, the following calls to schc_aoe_next() return
+ * them, and then an ACK REQ, unless the All-1 fragment is among them.
+ *
+ * @return SCHC_AOE_DONE if the receiver has the whole packet,
+ * SCHC_AOE_CONTINUE if there are tiles to send again (or the ACK was not
+ * for this packet, or is malformed, and was ignored), or SCHC_AOE_ABORT
+ * if the sender gave up.
+ */
+int schc_aoe_ack(struct schc_aoe_sender *s, const uint8_t *ack, size_t ack_len);
+
+/**
+ * \brief Called when no SCHC ACK arrived in time after schc_aoe_next()
+ * returned 0: the next call to schc_aoe_next() returns the All-1
+ * fragment again.
+ *
+ * A bare ACK REQ would not do: if the receiver is done with a previous
+ * packet that had the same DTag, and every fragment of this one was
+ * lost, it would answer the ACK REQ with C=1. The RCS in the All-1 tells
+ * it that this is another packet.
+ *
+ * This is the retransmission timer of the sender, see struct
+ * schc_aoe_session.
+ *
+ * @return SCHC_AOE_CONTINUE, or SCHC_AOE_ABORT if there were too many
+ * attempts.
+ */
+int schc_aoe_timeout(struct schc_aoe_sender *s);
+
+/**
+ * \brief Initializes an ACK-on-Error session, with no packet to send.
+ *
+ * @param wheel Runs the retransmission timer.
+ * @param sink Sends the fragments. Returning non-zero aborts the packet.
+ * @param done Called when a packet is done, may be NULL.
+ */
+void schc_aoe_session_init(struct schc_aoe_session *session,
+		struct schc_wheel *wheel, schc_frag_sink sink,
+		schc_aoe_done_cb done, void *arg);
+
+/**
+ * \brief Starts sending a SCHC packet, which must remain valid until
+ * the session is done with it.
+ *
+ * @return 0 if successfull, non-zero if the session is still busy with
+ * a packet, or the packet can not be sent (see schc_aoe_init()), or sink
+ * failed.
+ */
+int schc_aoe_session_send(struct schc_aoe_session *session,
+		const uint8_t *schc_packet, size_t schc_packet_len, uint8_t dtag);
+
+/**
+ * \brief Processes a SCHC ACK received for the session, sending the
+ * missing tiles if there are any.
+ *
+ * @return As schc_aoe_ack().
+ */
+int schc_aoe_session_ack(struct schc_aoe_session *session,
+		const uint8_t *ack, size_t ack_len);
+
+/**
+ * \brief Returns non-zero while the session is sending a packet or
+ * waiting for its SCHC ACK.
+ */
+int schc_aoe_session_busy(const struct schc_aoe_session *session);
+
+/**
+ * \brief Builds a SCHC ACK, compressing the bitmap.
+ *
+ * @param bitmap The SCHC_ACK_BITMAP_LEN bytes bitmap of window w,
+ * ignored if c is non-zero. The bits past the last tile of the packet
+ * should be set, so they are not sent.
+ *
+ * @return The length of the SCHC ACK, or -1 if ack_cap is too small.
+ */
+int schc_ack_build(uint8_t *ack, size_t ack_cap, uint8_t dtag, uint8_t w,
+		int c, const uint8_t *bitmap);
+
+/**
+ * \brief Parses a SCHC ACK, decompressing the bitmap.
+ *
+ * @param [out] bitmap SCHC_ACK_BITMAP_LEN bytes, all set if c is
+ * non-zero.
+ *
+ * @return 0 if successfull, non-zero if ack is not a valid SCHC ACK.
+ */
+int schc_ack_parse(const uint8_t *ack, size_t ack_len, uint8_t *dtag,
+		uint8_t *w, int *c, uint8_t *bitmap);
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* FRAGMENT_H */
+
+// vim:tw=72
@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the gateway.h functions.
+ *
+ * The rings are the classic bounded SPSC queue: the producer only
+ * writes tail, the consumer only writes head, each on its own cache
+ * line, and each side keeps a cached copy of the other index so it
+ * only reads the shared one when the ring looks full (or empty).
+ */
+
+#ifndef ARDUINO
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "gateway.h"
+#include "metrics.h"
+#include "reassembly.h"
+#include "timer.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define CACHE_LINE 64
+
+/*
+ * Frames taken from a ring before looking at the next one, and empty
+ * polls before a worker starts to yield the CPU.
+ */
+#define WORKER_BATCH 32
+#define WORKER_SPIN  256
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct gw_frame {
+	uint64_t device;
+	uint16_t len;
+	uint8_t data[MAX_LORAWAN_PKT_LEN];
+};
+
+struct gw_ring {
+	alignas(CACHE_LINE) std::atomic<size_t> head; /** Consumer */
+	size_t tail_cache;
+	alignas(CACHE_LINE) std::atomic<size_t> tail; /** Producer */
+	size_t head_cache;
+	alignas(CACHE_LINE) struct gw_frame frames[SCHC_GW_RING_SIZE];
+};
+
+struct gw_worker {
+	struct schc_gw *gw;
+	unsigned id;
+	int reader; /** Of the rule database */
+	std::thread thread;
+	struct schc_ctx ctx;
+	struct schc_wheel wheel;
+	struct schc_reass reass;
+	uint8_t ipv6_packet[SIZE_MTU_IPV6];
+	struct schc_metrics metrics;
+	alignas(CACHE_LINE) std::atomic<uint64_t> frames;
+	std::atomic<uint64_t> packets;
+	std::atomic<uint64_t> errors;
+};
+
+struct schc_gw {
+	struct schc_gw_config config;
+	std::atomic<int> stop;
+	std::chrono::steady_clock::time_point epoch;
+	struct gw_worker *workers[SCHC_GW_MAX_WORKERS];
+	struct gw_ring *rings[SCHC_GW_MAX_PRODUCERS][SCHC_GW_MAX_WORKERS];
+};
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static int ring_push(struct gw_ring *ring, uint64_t device,
+		const uint8_t *data, size_t len)
+{
+	size_t tail = ring->tail.load(std::memory_order_relaxed);
+
+	if (tail - ring->head_cache == SCHC_GW_RING_SIZE) {
+		ring->head_cache = ring->head.load(std::memory_order_acquire);
+		if (tail - ring->head_cache == SCHC_GW_RING_SIZE)
+			return -1;
+	}
+
+	struct gw_frame *frame = &ring->frames[tail & (SCHC_GW_RING_SIZE - 1)];
+
+	frame->device = device;
+	frame->len = len;
+	memcpy(frame->data, data, len);
+
+	ring->tail.store(tail + 1, std::memory_order_release);
+
+	return 0;
+}
+
+/*
+ * Returns the oldest frame, or NULL if the ring is empty. It stays
+ * valid until ring_pop_done().
+ */
+static const struct gw_frame *ring_peek(struct gw_ring *ring)
+{
+	size_t head = ring->head.load(std::memory_order_relaxed);
+
+	if (head == ring->tail_cache) {
+		ring->tail_cache = ring->tail.load(std::memory_order_acquire);
+		if (head == ring->tail_cache)
+			return NULL;
+	}
+
+	return &ring->frames[head & (SCHC_GW_RING_SIZE - 1)];
+}
+
+static void ring_pop_done(struct gw_ring *ring)
+{
+	ring->head.store(ring->head.load(std::memory_order_relaxed) + 1,
+			 std::memory_order_release);
+}
+
+static int ring_empty(struct gw_ring *ring)
+{
+	return ring->head.load(std::memory_order_acquire) ==
+	       ring->tail.load(std::memory_order_acquire);
+}
+
+static uint32_t gw_now(const struct schc_gw *gw)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - gw->epoch).count();
+}
+
+/*
+ * schc_reass_input() sinks, arg is the worker.
+ */
+static int worker_deliver(uint64_t device, const uint8_t *schc_packet,
+		size_t len, void *arg)
+{
+	struct gw_worker *w = (struct gw_worker *) arg;
+	size_t ipv6_packet_len;
+
+	if (schc_decompress(&w->ctx, schc_packet, len, UPLINK, w->ipv6_packet,
+			    sizeof(w->ipv6_packet), &ipv6_packet_len) != 0) {
+		w->errors.store(w->errors.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+		return -1;
+	}
+
+	w->packets.store(w->packets.load(std::memory_order_relaxed) + 1,
+			 std::memory_order_relaxed);
+	w->gw->config.output(w->id, device, w->ipv6_packet, ipv6_packet_len,
+			     w->gw->config.arg);
+
+	return 0;
+}
+
+static int worker_send_ack(uint64_t device, const uint8_t *ack, size_t len,
+		void *arg)
+{
+	struct gw_worker *w = (struct gw_worker *) arg;
+
+	if (w->gw->config.downlink != NULL)
+		w->gw->config.downlink(w->id, device, ack, len, w->gw->config.arg);
+
+	return 0;
+}
+
+static void worker_run(struct gw_worker *w)
+{
+	struct schc_gw *gw = w->gw;
+	unsigned idle = 0;
+
+	schc_metrics_init(&w->metrics);
+	schc_metrics_attach(&w->metrics);
+
+	for (;;) {
+		unsigned done = 0;
+
+		/* The flows of the previous rule set are flushed by the ctx */
+		if (gw->config.ruledb != NULL) {
+			schc_ruledb_quiescent(gw->config.ruledb, w->reader);
+			w->ctx.ruleset = schc_ruledb_get(gw->config.ruledb);
+		}
+
+		for (unsigned p = 0 ; p < gw->config.nproducers ; p++) {
+			struct gw_ring *ring = gw->rings[p][w->id];
+			const struct gw_frame *frame;
+
+			for (int n = 0 ; n < WORKER_BATCH && (frame = ring_peek(ring)) != NULL ; n++) {
+				if (schc_reass_input(&w->reass, frame->device, frame->data,
+						     frame->len, worker_deliver,
+						     worker_send_ack, w) == SCHC_REASS_ERROR)
+					w->errors.store(w->errors.load(std::memory_order_relaxed) + 1,
+							std::memory_order_relaxed);
+				ring_pop_done(ring);
+				done++;
+			}
+		}
+
+		if (done != 0) {
+			w->frames.store(w->frames.load(std::memory_order_relaxed) + done,
+					std::memory_order_relaxed);
+			idle = 0;
+		}
+
+		schc_wheel_advance(&w->wheel, gw_now(gw));
+
+		if (done != 0)
+			continue;
+
+		/* Nothing was queued: see if we must stop, or rest a bit */
+		if (gw->stop.load(std::memory_order_acquire)) {
+			unsigned p;
+
+			for (p = 0 ; p < gw->config.nproducers ; p++) {
+				if (!ring_empty(gw->rings[p][w->id]))
+					break;
+			}
+			if (p == gw->config.nproducers)
+				break;
+		}
+
+		if (++idle > WORKER_SPIN)
+			std::this_thread::yield();
+	}
+
+	schc_metrics_detach(&w->metrics);
+
+	if (gw->config.ruledb != NULL) {
+		schc_ruledb_offline(gw->config.ruledb, w->reader, 1);
+		w->reader = -1;
+	}
+}
+
+static void gw_free(struct schc_gw *gw)
+{
+	for (unsigned i = 0 ; i < SCHC_GW_MAX_WORKERS ; i++) {
+		if (gw->workers[i] != NULL && gw->workers[i]->reader >= 0)
+			schc_ruledb_offline(gw->config.ruledb, gw->workers[i]->reader, 1);
+		delete gw->workers[i];
+		for (unsigned p = 0 ; p < SCHC_GW_MAX_PRODUCERS ; p++)
+			delete gw->rings[p][i];
+	}
+
+	delete gw;
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+struct schc_gw *schc_gw_start(const struct schc_gw_config *config)
+{
+	if (config->nworkers == 0 || config->nworkers > SCHC_GW_MAX_WORKERS ||
+	    config->nproducers == 0 || config->nproducers > SCHC_GW_MAX_PRODUCERS ||
+	    (config->ruleset == NULL && config->ruledb == NULL) ||
+	    config->output == NULL)
+		return NULL;
+
+	struct schc_gw *gw = new (std::nothrow) struct schc_gw();
+
+	if (gw == NULL)
+		return NULL;
+
+	gw->config = *config;
+	gw->stop.store(0);
+	gw->epoch = std::chrono::steady_clock::now();
+
+	/* Everything is allocated before any thread starts */
+	for (unsigned i = 0 ; i < config->nworkers ; i++) {
+
+		struct gw_worker *w = new (std::nothrow) struct gw_worker();
+
+		gw->workers[i] = w;
+		if (w == NULL) {
+			gw_free(gw);
+			return NULL;
+		}
+
+		w->gw = gw;
+		w->id = i;
+		w->reader = -1;
+
+		if (config->ruledb != NULL) {
+			w->reader = schc_ruledb_register(config->ruledb);
+			if (w->reader < 0) {
+				gw_free(gw);
+				return NULL;
+			}
+			schc_ctx_init(&w->ctx, schc_ruledb_get(config->ruledb));
+		} else {
+			schc_ctx_init(&w->ctx, config->ruleset);
+		}
+
+		schc_wheel_init(&w->wheel, gw_now(gw));
+		schc_reass_init(&w->reass, &w->wheel);
+
+		for (unsigned p = 0 ; p < config->nproducers ; p++) {
+			struct gw_ring *ring = new (std::nothrow) struct gw_ring();
+
+			gw->rings[p][i] = ring;
+			if (ring == NULL) {
+				gw_free(gw);
+				return NULL;
+			}
+		}
+	}
+
+	for (unsigned i = 0 ; i < config->nworkers ; i++)
+		gw->workers[i]->thread = std::thread(worker_run, gw->workers[i]);
+
+	return gw;
+}
+
+unsigned schc_gw_worker_of(const struct schc_gw *gw, uint64_t device)
+{
+	/* splitmix64 finalizer, the DevEUIs of a batch are often consecutive */
+	device ^= device >> 30;
+	device *= 0xbf58476d1ce4e5b9ULL;
+	device ^= device >> 27;
+	device *= 0x94d049bb133111ebULL;
+	device ^= device >> 31;
+
+	return device % gw->config.nworkers;
+}
+
+int schc_gw_submit(struct schc_gw *gw, unsigned producer, uint64_t device,
+		const uint8_t *frame, size_t len)
+{
+	if (producer >= gw->config.nproducers || len > MAX_LORAWAN_PKT_LEN)
+		return -1;
+
+	return ring_push(gw->rings[producer][schc_gw_worker_of(gw, device)],
+			 device, frame, len);
+}
+
+void schc_gw_stats(const struct schc_gw *gw, unsigned worker,
+		struct schc_gw_stats *stats)
+{
+	const struct gw_worker *w = gw->workers[worker];
+
+	stats->frames = w->frames.load(std::memory_order_relaxed);
+	stats->packets = w->packets.load(std::memory_order_relaxed);
+	stats->errors = w->errors.load(std::memory_order_relaxed);
+}
+
+void schc_gw_stop(struct schc_gw *gw)
+{
+	gw->stop.store(1, std::memory_order_release);
+
+	for (unsigned i = 0 ; i < gw->config.nworkers ; i++)
+		gw->workers[i]->thread.join();
+
+	gw_free(gw);
+}
+
+#endif /* ARDUINO */
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+/**
+ * \file
+ *
+ * \brief Multi-core SCHC gateway engine (host only).
+ *
+ * The uplink LoRaWAN frames are spread among N worker threads by the
+ * hash of their device, so all the fragments of a device are always
+ * reassembled by the same worker. Every worker has its own SCHC C/D
+ * instance and reassembly instance (see struct schc_ctx and struct
+ * schc_reass), all of them sharing one read-only rule set, so the
+ * workers never lock anything. The rule set may come from a rule
+ * database (see ruledb.h), then the workers switch to every new rule
+ * set loaded, between two batches of frames.
+ *
+ * The frames reach the workers through lock-free single-producer
+ * single-consumer rings: one ring per producer and worker. A producer
+ * is any thread calling schc_gw_submit(), each one with its own
+ * producer number.
+ *
+ * \verbatim
+ *  producer 0 ---ring---+--> worker 0: reassembly -> decompression -> output
+ *             \         |
+ *  producer 1 -+-ring---+--> worker 1: ...
+ * \endverbatim
+ */
+
+#ifndef ARDUINO
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "context.h"
+#include "ruledb.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define SCHC_GW_MAX_WORKERS   64
+#define SCHC_GW_MAX_PRODUCERS 8
+
+/**
+ * Frames per ring, a power of two. When a ring is full,
+ * schc_gw_submit() fails instead of blocking.
+ */
+#ifndef SCHC_GW_RING_SIZE
+#define SCHC_GW_RING_SIZE 1024
+#endif
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * \brief Receives every IPv6 packet reassembled and decompressed by a
+ * worker, or every SCHC ACK to be sent down to a device. Called from
+ * the worker thread, the data is only valid during the call.
+ */
+typedef void (*schc_gw_sink)(unsigned worker, uint64_t device,
+		const uint8_t *data, size_t len, void *arg);
+
+struct schc_gw_config {
+	unsigned nworkers;
+	unsigned nproducers;
+	const struct schc_ruleset *ruleset;
+	struct schc_ruledb *ruledb; /** If not NULL, used instead of ruleset */
+	schc_gw_sink output;    /** IPv6 packets */
+	schc_gw_sink downlink;  /** SCHC ACKs, may be NULL */
+	void *arg;
+};
+
+struct schc_gw_stats {
+	uint64_t frames;   /** Frames processed */
+	uint64_t packets;  /** IPv6 packets output */
+	uint64_t errors;   /** Frames or packets dropped */
+};
+
+struct schc_gw;
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Allocates the workers and their rings, and starts the worker
+ * threads.
+ *
+ * @return The gateway, or NULL if the configuration is not valid,
+ * there was no memory, or the rule database has no room for the
+ * workers as readers.
+ */
+struct schc_gw *schc_gw_start(const struct schc_gw_config *config);
+
+/**
+ * \brief Queues an uplink frame for the worker of device. It must
+ * always be called from the same thread for a given producer.
+ *
+ * @return 0 if successfull, non-zero if the ring is full (or the frame
+ * is longer than MAX_LORAWAN_PKT_LEN). The frame is not queued then.
+ */
+int schc_gw_submit(struct schc_gw *gw, unsigned producer, uint64_t device,
+		const uint8_t *frame, size_t len);
+
+/**
+ * \brief The worker which handles the frames of device.
+ */
+unsigned schc_gw_worker_of(const struct schc_gw *gw, uint64_t device);
+
+/**
+ * \brief Reads the counters of a worker. They are updated while the
+ * worker runs, so they may be slightly behind. Every worker also
+ * attaches a block of metrics (see metrics.h) while it runs, which
+ * schc_metrics_snapshot() adds up.
+ */
+void schc_gw_stats(const struct schc_gw *gw, unsigned worker,
+		struct schc_gw_stats *stats);
+
+/**
+ * \brief Waits until the workers process all the queued frames, stops
+ * them and frees the gateway. No producer may call schc_gw_submit()
+ * anymore.
+ */
+void schc_gw_stop(struct schc_gw *gw);
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* ARDUINO */
+
+#endif /* GATEWAY_H */
+
+// vim:tw=72
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the metrics.h functions.
+ *
+ * The attached blocks are kept in a list, and the counts of the
+ * detached ones are added to a block of their own. The list is only
+ * changed or walked under a lock, the counters never are.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#include <mutex>
+#endif
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "metrics.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define HIST_HALF (1U << (SCHC_HIST_SUB_BITS - 1))
+
+#define METRICS_LINE_LEN 80
+
+/**********************************************************************/
+/***        Global Variables                                        ***/
+/**********************************************************************/
+
+SCHC_THREAD_LOCAL struct schc_metrics *schc_metrics_current;
+
+/**********************************************************************/
+/***        Static Variables                                        ***/
+/**********************************************************************/
+
+static struct schc_metrics *attached;
+static struct schc_metrics detached;
+
+#ifndef ARDUINO
+static std::mutex metrics_lock;
+#endif
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+/*
+ * The Arduino sketch has a single thread, and its timers do not run
+ * from interrupts: nothing to lock there.
+ */
+static void metrics_lock_take(void)
+{
+#ifndef ARDUINO
+	metrics_lock.lock();
+#endif
+}
+
+static void metrics_lock_give(void)
+{
+#ifndef ARDUINO
+	metrics_lock.unlock();
+#endif
+}
+
+/*
+ * Adds every counter of m to total, which is only seen by the caller.
+ */
+static void metrics_add(struct schc_metrics *total, const struct schc_metrics *m)
+{
+	const schc_counter_t *src = (const schc_counter_t *) m;
+	schc_counter_t *dst = (schc_counter_t *) total;
+	size_t n = offsetof(struct schc_metrics, next) / sizeof(schc_counter_t);
+
+	/*
+	 * The struct is made only of counters before next. The max of the
+	 * histograms are added as well, and fixed below.
+	 */
+	for (size_t i = 0 ; i < n ; i++)
+		dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+
+#if SCHC_METRICS_HIST
+	for (int op = 0 ; op < SCHC_LAT_COUNT ; op++) {
+		schc_counter_t max = __atomic_load_n(&m->latency[op].max, __ATOMIC_RELAXED);
+
+		total->latency[op].max -= max;
+		if (max > total->latency[op].max)
+			total->latency[op].max = max;
+	}
+#endif
+}
+
+static unsigned hist_index(uint64_t v)
+{
+	if (v >> SCHC_HIST_MAX_BITS)
+		v = (1ULL << SCHC_HIST_MAX_BITS) - 1;
+
+	if (v < 2 * HIST_HALF)
+		return v;
+
+	unsigned shift = 1;
+
+	while ((v >> shift) >= 2 * HIST_HALF)
+		shift++;
+
+	return shift * HIST_HALF + (v >> shift);
+}
+
+/*
+ * Largest value recorded in bucket i.
+ */
+static uint64_t hist_value(unsigned i)
+{
+	if (i < 2 * HIST_HALF)
+		return i;
+
+	unsigned shift = i / HIST_HALF - 1;
+	uint64_t mantissa = i - shift * HIST_HALF;
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+/*
+ * Writes v in decimal, returns the end of the string.
+ */
+static char *put_u64(char *p, uint64_t v)
+{
+	char tmp[20];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+
+	while (n > 0)
+		*p++ = tmp[--n];
+	*p = '\0';
+
+	return p;
+}
+
+static char *put_str(char *p, const char *s)
+{
+	while (*s != '\0')
+		*p++ = *s++;
+	*p = '\0';
+
+	return p;
+}
+
+/*
+ * name{label="value"} v, the label is left out if it is NULL.
+ */
+static int export_line(schc_metrics_sink sink, void *arg, const char *name,
+		const char *label, const char *value, uint64_t v)
+{
+	char line[METRICS_LINE_LEN];
+	char *p = put_str(line, name);
+
+	if (label != NULL) {
+		p = put_str(p, "{");
+		p = put_str(p, label);
+		p = put_str(p, "=\"");
+		p = put_str(p, value);
+		p = put_str(p, "\"}");
+	}
+	p = put_str(p, " ");
+	put_u64(p, v);
+
+	return sink(line, arg);
+}
+
+/*
+ * name num/den, with three decimals. Nothing if den is 0.
+ */
+static int export_ratio(schc_metrics_sink sink, void *arg, const char *name,
+		uint64_t num, uint64_t den)
+{
+	if (den == 0)
+		return 0;
+
+	char line[METRICS_LINE_LEN];
+	uint64_t thousandths = (num * 1000 + den / 2) / den;
+	char *p = put_str(line, name);
+
+	p = put_str(p, " ");
+	p = put_u64(p, thousandths / 1000);
+	p = put_str(p, ".");
+	*p++ = '0' + thousandths / 100 % 10;
+	*p++ = '0' + thousandths / 10 % 10;
+	*p++ = '0' + thousandths % 10;
+	*p = '\0';
+
+	return sink(line, arg);
+}
+
+#if SCHC_METRICS_HIST
+static int export_hist(schc_metrics_sink sink, void *arg, const char *name,
+		const struct schc_hist *h)
+{
+	static const unsigned permille[] = { 500, 900, 990, 999, 1000 };
+	static const char *const quantile[] = { "0.5", "0.9", "0.99", "0.999", "1" };
+	char sub[METRICS_LINE_LEN / 2];
+
+	for (size_t i = 0 ; i < sizeof(permille) / sizeof(permille[0]) ; i++) {
+		if (export_line(sink, arg, name, "quantile", quantile[i],
+				schc_hist_percentile(h, permille[i])) != 0)
+			return -1;
+	}
+
+	put_str(put_str(sub, name), "_count");
+	if (export_line(sink, arg, sub, NULL, NULL, h->count) != 0)
+		return -1;
+
+	put_str(put_str(sub, name), "_sum");
+	if (export_line(sink, arg, sub, NULL, NULL, h->sum) != 0)
+		return -1;
+
+	return 0;
+}
+#endif
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+void schc_metrics_init(struct schc_metrics *m)
+{
+	memset(m, 0, sizeof(*m));
+}
+
+void schc_metrics_attach(struct schc_metrics *m)
+{
+	struct schc_metrics *b;
+
+	metrics_lock_take();
+	for (b = attached ; b != NULL && b != m ; b = b->next)
+		;
+	if (b == NULL) {
+		m->next = attached;
+		attached = m;
+	}
+	metrics_lock_give();
+
+	schc_metrics_current = m;
+}
+
+void schc_metrics_detach(struct schc_metrics *m)
+{
+	struct schc_metrics **prev;
+
+	if (schc_metrics_current == m)
+		schc_metrics_current = NULL;
+
+	metrics_lock_take();
+	for (prev = &attached ; *prev != NULL ; prev = &(*prev)->next) {
+		if (*prev == m) {
+			*prev = m->next;
+			metrics_add(&detached, m);
+			break;
+		}
+	}
+	metrics_lock_give();
+}
+
+void schc_metrics_snapshot(struct schc_metrics *total)
+{
+	schc_metrics_init(total);
+
+	metrics_lock_take();
+	metrics_add(total, &detached);
+	for (struct schc_metrics *b = attached ; b != NULL ; b = b->next)
+		metrics_add(total, b);
+	metrics_lock_give();
+}
+
+int schc_metrics_export(const struct schc_metrics *m, schc_metrics_sink sink,
+		void *arg)
+{
+	const struct {
+		const char *name;
+		schc_counter_t value;
+	} counters[] = {
+		{ "schc_compressed_packets", m->compressed },
+		{ "schc_compress_errors", m->compress_errors },
+		{ "schc_compress_bytes_in", m->compress_bytes_in },
+		{ "schc_compress_bytes_out", m->compress_bytes_out },
+		{ "schc_decompressed_packets", m->decompressed },
+		{ "schc_decompress_errors", m->decompress_errors },
+		{ "schc_fragmented_packets", m->frag_packets },
+		{ "schc_fragments", m->frag_frames },
+		{ "schc_reass_frames", m->reass_frames },
+		{ "schc_reass_done", m->reass_done },
+		{ "schc_reass_errors", m->reass_errors },
+		{ "schc_reass_timeouts", m->reass_timeouts },
+	};
+
+	for (size_t i = 0 ; i < sizeof(counters) / sizeof(counters[0]) ; i++) {
+		if (export_line(sink, arg, counters[i].name, NULL, NULL,
+				counters[i].value) != 0)
+			return -1;
+	}
+
+	if (export_ratio(sink, arg, "schc_compress_ratio", m->compress_bytes_out,
+			 m->compress_bytes_in) != 0 ||
+	    export_ratio(sink, arg, "schc_fragments_per_packet", m->frag_frames,
+			 m->frag_packets) != 0)
+		return -1;
+
+	for (unsigned id = 0 ; id < SCHC_METRICS_RULE_IDS ; id++) {
+		char rule[4];
+
+		if (m->rule_hits[id] == 0)
+			continue;
+
+		put_u64(rule, id);
+		if (export_line(sink, arg, "schc_rule_hits", "rule", rule,
+				m->rule_hits[id]) != 0)
+			return -1;
+	}
+
+#if SCHC_METRICS_HIST
+	if (export_hist(sink, arg, "schc_compress_latency_" SCHC_METRICS_UNIT,
+			&m->latency[SCHC_LAT_COMPRESS]) != 0 ||
+	    export_hist(sink, arg, "schc_fragment_latency_" SCHC_METRICS_UNIT,
+			&m->latency[SCHC_LAT_FRAGMENT]) != 0 ||
+	    export_hist(sink, arg, "schc_reassemble_latency_" SCHC_METRICS_UNIT,
+			&m->latency[SCHC_LAT_REASSEMBLE]) != 0)
+		return -1;
+#endif
+
+	return 0;
+}
+
+uint64_t schc_hist_percentile(const struct schc_hist *h, unsigned permille)
+{
+	/* Rank of the value, rounded up */
+	uint64_t rank = ((uint64_t) h->count * permille + 999) / 1000;
+	uint64_t seen = 0;
+
+	if (h->count == 0)
+		return 0;
+	if (rank == 0)
+		rank = 1;
+
+	for (unsigned i = 0 ; i < SCHC_HIST_BUCKETS ; i++) {
+		seen += h->bucket[i];
+		if (seen >= rank) {
+			uint64_t v = hist_value(i);
+
+			return v < h->max ? v : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+void schc_hist_record(struct schc_hist *h, uint64_t v, schc_counter_t n)
+{
+	schc_counter_add(&h->bucket[hist_index(v)], n);
+	schc_counter_add(&h->count, n);
+	schc_counter_add(&h->sum, v * n);
+	if (v > h->max)
+		__atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+schc_tick_t schc_metrics_now(void)
+{
+#ifdef ARDUINO
+	return micros();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
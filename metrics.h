@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * \file
+ *
+ * \brief Counters and latency histograms of the SCHC operations.
+ *
+ * Every thread that compresses, fragments or reassembles owns a block
+ * of metrics (struct schc_metrics) and attaches it with
+ * schc_metrics_attach(). The library then updates the block of the
+ * calling thread, so a counter is only ever written by one thread and
+ * it is a plain add, with no locked instruction. On the host the blocks
+ * are aligned to a cache line, the threads never share one.
+ *
+ * Any thread can add up the blocks with schc_metrics_snapshot(), and
+ * schc_metrics_export() prints the result one line per value, in the
+ * text format of Prometheus:
+ *
+ * \verbatim
+ * schc_compressed_packets 1000
+ * schc_compress_ratio 0.192
+ * schc_rule_hits{rule="1"} 1000
+ * schc_compress_latency_ns{quantile="0.99"} 351
+ * \endverbatim
+ *
+ * The latencies go to log-linear histograms, as in HdrHistogram: the
+ * values below 2^SCHC_HIST_SUB_BITS have a bucket each, and every
+ * power of two above is split in 2^(SCHC_HIST_SUB_BITS - 1) buckets,
+ * so the error is below 1 / 2^(SCHC_HIST_SUB_BITS - 1) at any scale.
+ * They are in nanoseconds on the host and in microseconds on Arduino,
+ * where they are disabled by default to save RAM.
+ *
+ * If no block is attached the library counts nothing, and with
+ * SCHC_NO_METRICS the calls are compiled out.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#ifndef SCHC_NO_METRICS
+#define SCHC_METRICS
+#endif
+
+/**
+ * Rule IDs with a hit counter of their own, the higher ones are counted
+ * together in the last one.
+ */
+#ifndef SCHC_METRICS_RULE_IDS
+#ifdef __AVR__
+#define SCHC_METRICS_RULE_IDS 16
+#else
+#define SCHC_METRICS_RULE_IDS 256
+#endif
+#endif
+
+#ifndef SCHC_METRICS_HIST
+#ifdef __AVR__
+#define SCHC_METRICS_HIST 0
+#else
+#define SCHC_METRICS_HIST 1
+#endif
+#endif
+
+/**
+ * Precision of the histograms, and number of bits of the largest value
+ * recorded (the larger ones are recorded as it).
+ */
+#ifndef SCHC_HIST_SUB_BITS
+#ifdef __AVR__
+#define SCHC_HIST_SUB_BITS 3
+#else
+#define SCHC_HIST_SUB_BITS 5
+#endif
+#endif
+
+#ifndef SCHC_HIST_MAX_BITS
+#ifdef __AVR__
+#define SCHC_HIST_MAX_BITS 24
+#else
+#define SCHC_HIST_MAX_BITS 40
+#endif
+#endif
+
+#define SCHC_HIST_BUCKETS \
+	((SCHC_HIST_MAX_BITS - SCHC_HIST_SUB_BITS + 2) << (SCHC_HIST_SUB_BITS - 1))
+
+#ifdef ARDUINO
+#define SCHC_METRICS_UNIT "us"
+#define SCHC_METRICS_ALIGN
+#define SCHC_THREAD_LOCAL
+#else
+#define SCHC_METRICS_UNIT "ns"
+#define SCHC_METRICS_ALIGN alignas(64)
+#define SCHC_THREAD_LOCAL thread_local
+#endif
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+#ifdef __AVR__
+typedef uint32_t schc_counter_t;
+#else
+typedef uint64_t schc_counter_t;
+#endif
+
+enum schc_latency {
+	SCHC_LAT_COMPRESS,
+	SCHC_LAT_FRAGMENT,
+	SCHC_LAT_REASSEMBLE,
+	SCHC_LAT_COUNT
+};
+
+struct schc_hist {
+	schc_counter_t count;
+	schc_counter_t sum;
+	schc_counter_t max;
+	schc_counter_t bucket[SCHC_HIST_BUCKETS];
+};
+
+struct SCHC_METRICS_ALIGN schc_metrics {
+	/* schc_compress(), schc_compress_batch() */
+	schc_counter_t compressed;
+	schc_counter_t compress_errors; /** No rule matched, or no room */
+	schc_counter_t compress_bytes_in;
+	schc_counter_t compress_bytes_out;
+	schc_counter_t rule_hits[SCHC_METRICS_RULE_IDS];
+
+	/* schc_decompress() */
+	schc_counter_t decompressed;
+	schc_counter_t decompress_errors;
+
+	/* schc_fragmentate(), schc_aoe_next() */
+	schc_counter_t frag_packets; /** SCHC packets sent */
+	schc_counter_t frag_frames;  /** L2 frames they took */
+
+	/* schc_reass_input() */
+	schc_counter_t reass_frames;
+	schc_counter_t reass_done;     /** Packets delivered */
+	schc_counter_t reass_errors;
+	schc_counter_t reass_timeouts; /** Sessions that expired unfinished */
+
+#if SCHC_METRICS_HIST
+	struct schc_hist latency[SCHC_LAT_COUNT];
+#endif
+
+	struct schc_metrics *next; /** Registered blocks */
+};
+
+/**
+ * \brief Receives the lines of schc_metrics_export(), with no newline.
+ * Returns non-zero to stop the export.
+ */
+typedef int (*schc_metrics_sink)(const char *line, void *arg);
+
+#ifdef ARDUINO
+typedef uint32_t schc_tick_t;
+#else
+typedef uint64_t schc_tick_t;
+#endif
+
+/**********************************************************************/
+/***        Global Variables                                        ***/
+/**********************************************************************/
+
+/**
+ * The block of the calling thread, set by schc_metrics_attach().
+ */
+extern SCHC_THREAD_LOCAL struct schc_metrics *schc_metrics_current;
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Sets every counter of m to zero.
+ */
+void schc_metrics_init(struct schc_metrics *m);
+
+/**
+ * \brief Makes m the block of the calling thread, and adds it to the
+ * ones schc_metrics_snapshot() reads. m may be attached to one thread
+ * only.
+ */
+void schc_metrics_attach(struct schc_metrics *m);
+
+/**
+ * \brief Removes m from the snapshots. Its counts are kept in the
+ * totals, so they never go backwards. If m was the block of the calling
+ * thread, the thread counts nothing anymore.
+ */
+void schc_metrics_detach(struct schc_metrics *m);
+
+/**
+ * \brief Adds up the attached blocks and the detached ones into total.
+ * The counters are read while they are updated, so they may be slightly
+ * behind.
+ */
+void schc_metrics_snapshot(struct schc_metrics *total);
+
+/**
+ * \brief Writes m to sink, one line per value. Only the rules with hits
+ * are listed.
+ *
+ * @return 0 if successfull, non-zero if the sink stopped the export.
+ */
+int schc_metrics_export(const struct schc_metrics *m, schc_metrics_sink sink,
+		void *arg);
+
+/**
+ * \brief Returns the value below which there are permille thousandths
+ * of the recorded values, within the precision of the histogram, or 0
+ * if it is empty.
+ */
+uint64_t schc_hist_percentile(const struct schc_hist *h, unsigned permille);
+
+/**
+ * \brief Adds n values of v to h.
+ */
+void schc_hist_record(struct schc_hist *h, uint64_t v, schc_counter_t n);
+
+/**
+ * \brief The clock of the latencies, in SCHC_METRICS_UNIT.
+ */
+schc_tick_t schc_metrics_now(void);
+
+/**********************************************************************/
+/***        Inline Functions                                        ***/
+/**********************************************************************/
+
+/*
+ * Used by the library. Only the owner thread writes a counter, the
+ * relaxed load and store let the other threads read it while it
+ * changes.
+ */
+static inline void schc_counter_add(schc_counter_t *c, schc_counter_t n)
+{
+	__atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n,
+			 __ATOMIC_RELAXED);
+}
+
+static inline struct schc_metrics *schc_metrics_get(void)
+{
+#ifdef SCHC_METRICS
+	return schc_metrics_current;
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * \brief Start time of an operation, 0 if its latency is not recorded.
+ */
+static inline schc_tick_t schc_metrics_start(const struct schc_metrics *m)
+{
+#if SCHC_METRICS_HIST
+	if (m != NULL)
+		return schc_metrics_now();
+#endif
+	(void) m;
+	return 0;
+}
+
+/**
+ * \brief Records the latency of n operations that took the time since
+ * start, in total.
+ */
+static inline void schc_metrics_latency(struct schc_metrics *m,
+		enum schc_latency op, schc_tick_t start, schc_counter_t n)
+{
+#if SCHC_METRICS_HIST
+	if (m != NULL && n != 0)
+		schc_hist_record(&m->latency[op], (schc_metrics_now() - start) / n, n);
+#endif
+	(void) m;
+	(void) op;
+	(void) start;
+	(void) n;
+}
+
+static inline void schc_metrics_compressed(struct schc_metrics *m,
+		uint8_t rule_id, size_t bytes_in, size_t bytes_out)
+{
+	if (m == NULL)
+		return;
+
+	schc_counter_add(&m->compressed, 1);
+	schc_counter_add(&m->compress_bytes_in, bytes_in);
+	schc_counter_add(&m->compress_bytes_out, bytes_out);
+#if SCHC_METRICS_RULE_IDS < 256
+	if (rule_id >= SCHC_METRICS_RULE_IDS)
+		rule_id = SCHC_METRICS_RULE_IDS - 1;
+#endif
+	schc_counter_add(&m->rule_hits[rule_id], 1);
+}
+
+/**
+ * \brief Adds n to the counter c of the calling thread, if any. For
+ * instance SCHC_METRIC_ADD(m, reass_errors, 1).
+ */
+#define SCHC_METRIC_ADD(m, c, n) \
+	do { \
+		if ((m) != NULL) \
+			schc_counter_add(&(m)->c, (n)); \
+	} while (0)
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* METRICS_H */
+
+// vim:tw=72
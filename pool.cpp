@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the pool.h functions.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "pool.h"
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+void schc_pool_init(struct schc_pool *pool, void *mem, size_t obj_size,
+		uint16_t capacity)
+{
+	pool->mem = (uint8_t *) mem;
+	pool->obj_size = obj_size;
+	pool->capacity = capacity;
+	pool->bump = 0;
+	pool->free = SCHC_POOL_END;
+	pool->used = 0;
+}
+
+void *schc_pool_get(struct schc_pool *pool)
+{
+	uint8_t *obj;
+
+	if (pool->free != SCHC_POOL_END) {
+		obj = pool->mem + (size_t) pool->free * pool->obj_size;
+		/* The link may be unaligned for the object type */
+		memcpy(&pool->free, obj, sizeof(pool->free));
+	} else if (pool->bump < pool->capacity) {
+		obj = pool->mem + (size_t) pool->bump++ * pool->obj_size;
+	} else {
+		return NULL;
+	}
+
+	pool->used++;
+
+	return obj;
+}
+
+int schc_pool_put(struct schc_pool *pool, void *obj)
+{
+	size_t offset = (uint8_t *) obj - pool->mem;
+
+	if ((uint8_t *) obj < pool->mem || offset % pool->obj_size != 0 ||
+	    offset / pool->obj_size >= pool->bump) {
+		return -1;
+	}
+
+	memcpy(obj, &pool->free, sizeof(pool->free));
+	pool->free = offset / pool->obj_size;
+	pool->used--;
+
+	return 0;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
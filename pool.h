@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * \file
+ *
+ * \brief Fixed-size object pools.
+ *
+ * A pool hands out objects of a single type from a static array whose
+ * capacity is fixed at compile time, so the memory used is known
+ * beforehand and the heap is never touched. Acquiring and releasing an
+ * object are O(1): the free objects are kept in a list threaded through
+ * the objects themselves, and the objects never used yet are taken in
+ * order, so the pool needs no initialization.
+ *
+ * A pool is either defined static with SCHC_POOL_DEFINE(), or set up
+ * with schc_pool_init() on an array of the caller, for instance one
+ * embedded in a bigger struct.
+ *
+ * \verbatim
+ * SCHC_POOL_DEFINE(session_pool, struct session, 16);
+ *
+ * struct session *s = (struct session *) schc_pool_get(&session_pool);
+ * if (s == NULL)
+ *         return -1; // exhausted
+ * ...
+ * schc_pool_put(&session_pool, s);
+ * \endverbatim
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define SCHC_POOL_END 0xFFFF
+
+/**
+ * \brief Defines a static pool named name of capacity objects of type.
+ *
+ * The objects must be at least 2 bytes long, to hold the free list
+ * link, and there can be up to 65534 of them.
+ */
+#define SCHC_POOL_DEFINE(name, type, capacity) \
+	static_assert(sizeof(type) >= sizeof(uint16_t), "pool object too small"); \
+	static_assert((capacity) > 0 && (capacity) < SCHC_POOL_END, "bad pool capacity"); \
+	static type name##_mem[capacity]; \
+	static struct schc_pool name = { \
+		(uint8_t *) name##_mem, sizeof(type), (capacity), 0, SCHC_POOL_END, 0 \
+	}
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * \brief A pool, see SCHC_POOL_DEFINE().
+ */
+struct schc_pool {
+	uint8_t *mem;
+	size_t obj_size;
+	uint16_t capacity;
+	uint16_t bump;  /** Objects from bump on were never acquired */
+	uint16_t free;  /** First released object, or SCHC_POOL_END */
+	uint16_t used;
+};
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Sets up a pool of the capacity objects of obj_size bytes at
+ * mem, all of them free. The requirements of SCHC_POOL_DEFINE() apply.
+ */
+void schc_pool_init(struct schc_pool *pool, void *mem, size_t obj_size,
+		uint16_t capacity);
+
+/**
+ * \brief Acquires an object. Its contents are undefined.
+ *
+ * @return The object, or NULL if the pool is exhausted.
+ */
+void *schc_pool_get(struct schc_pool *pool);
+
+/**
+ * \brief Releases an object acquired from the pool.
+ *
+ * @return 0 if successfull, non-zero if obj is not an object of the
+ * pool (it is not released then).
+ */
+int schc_pool_put(struct schc_pool *pool, void *obj);
+
+/**
+ * \brief Number of objects acquired and not released yet.
+ */
+static inline uint16_t schc_pool_used(const struct schc_pool *pool)
+{
+	return pool->used;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* POOL_H */
+
+// vim:tw=72
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the reassembly.h functions.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "reassembly.h"
+#include "crc32.h"
+#include "metrics.h"
+#include "trace.h"
+
+/* Every packet the ACK-on-Error sender accepts must fit in a buffer */
+static_assert(SCHC_AOE_MAX_PKT_LEN <= SCHC_REASS_BUF_LEN, "SCHC_AOE_MAX_PKT_LEN too long");
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static uint16_t session_hash(uint64_t device, uint8_t rule_id, uint8_t dtag)
+{
+	uint32_t h = 2166136261UL; /* FNV-1a */
+
+	for (int i = 0 ; i < 8 ; i++) {
+		h ^= (uint8_t) (device >> (8 * i));
+		h *= 16777619UL;
+	}
+	h ^= rule_id;
+	h *= 16777619UL;
+	h ^= dtag;
+	h *= 16777619UL;
+
+	return (h ^ (h >> 16)) & (SCHC_REASS_BUCKETS - 1);
+}
+
+static struct reass_session *session_find(struct schc_reass *r,
+		uint64_t device, uint8_t rule_id, uint8_t dtag)
+{
+	struct reass_session *s = r->bucket[session_hash(device, rule_id, dtag)];
+
+	while (s != NULL &&
+	       (s->device != device || s->rule_id != rule_id || s->dtag != dtag))
+		s = s->next;
+
+	return s;
+}
+
+static void done_unlink(struct reass_session *s)
+{
+	struct schc_reass *r = s->reass;
+
+	if (s->done_prev != NULL)
+		s->done_prev->done_next = s->done_next;
+	else
+		r->done_head = s->done_next;
+
+	if (s->done_next != NULL)
+		s->done_next->done_prev = s->done_prev;
+	else
+		r->done_tail = s->done_prev;
+}
+
+/*
+ * Marks the session as delivered. It gives its buffer back, it only
+ * lives to answer ACK REQs now.
+ */
+static void done_push(struct reass_session *s)
+{
+	struct schc_reass *r = s->reass;
+
+	schc_pool_put(&r->buf_pool, s->buf);
+	s->buf = NULL;
+	s->state = REASS_AOE_DONE;
+	s->done_next = NULL;
+	s->done_prev = r->done_tail;
+
+	if (r->done_tail != NULL)
+		r->done_tail->done_next = s;
+	else
+		r->done_head = s;
+	r->done_tail = s;
+}
+
+static void session_free(struct reass_session *s)
+{
+	struct schc_reass *r = s->reass;
+	struct reass_session **prev = &r->bucket[session_hash(s->device, s->rule_id, s->dtag)];
+
+	while (*prev != s)
+		prev = &(*prev)->next;
+	*prev = s->next;
+
+	if (s->state == REASS_AOE_DONE)
+		done_unlink(s);
+
+	if (s->buf != NULL)
+		schc_pool_put(&r->buf_pool, s->buf);
+
+	if (r->wheel != NULL)
+		schc_timer_cancel(r->wheel, &s->inactivity);
+
+	schc_pool_put(&r->session_pool, s);
+}
+
+static void session_expired(struct schc_timer *timer, void *arg)
+{
+	struct reass_session *s = (struct reass_session *) arg;
+
+	(void) timer;
+
+	/* A delivered session only waited for ACK REQs */
+	if (s->state != REASS_AOE_DONE) {
+		SCHC_TRACE3(REASS_TIMEOUT, s->device, s->rule_id, s->dtag);
+		SCHC_METRIC_ADD(schc_metrics_get(), reass_timeouts, 1);
+	}
+
+	session_free(s);
+}
+
+/*
+ * A fragment arrived for the session, restarts its inactivity timer.
+ */
+static void session_touch(struct reass_session *s)
+{
+	if (s->reass->wheel != NULL)
+		schc_timer_add(s->reass->wheel, &s->inactivity, SCHC_REASS_INACTIVITY_TIMEOUT);
+}
+
+/*
+ * Prepares the session for a new packet. Returns non-zero if there is
+ * no buffer left.
+ */
+static int session_reset(struct reass_session *s, uint8_t state)
+{
+	if (s->buf == NULL &&
+	    (s->buf = (struct reass_buf *) schc_pool_get(&s->reass->buf_pool)) == NULL)
+		return -1;
+
+	s->state = state;
+	s->fcn = 0;
+	s->max_w = 0;
+	s->ntiles = 0;
+	s->len = 0;
+	s->rcs = CRC32_INIT;
+	memset(s->bitmap, 0, sizeof(s->bitmap));
+
+	return 0;
+}
+
+/*
+ * Takes a free session, or else the oldest delivered one.
+ */
+static struct reass_session *session_new(struct schc_reass *r,
+		uint64_t device, uint8_t rule_id, uint8_t dtag, uint8_t state)
+{
+	if (schc_pool_used(&r->session_pool) == SCHC_REASS_MAX_SESSIONS &&
+	    r->done_head != NULL)
+		session_free(r->done_head);
+
+	struct reass_session *s =
+		(struct reass_session *) schc_pool_get(&r->session_pool);
+
+	if (s == NULL)
+		return NULL;
+
+	s->reass = r;
+	s->buf = NULL;
+	schc_timer_init(&s->inactivity, session_expired, s);
+	if (session_reset(s, state) != 0) {
+		schc_pool_put(&r->session_pool, s);
+		return NULL;
+	}
+
+	uint16_t b = session_hash(device, rule_id, dtag);
+
+	s->device = device;
+	s->rule_id = rule_id;
+	s->dtag = dtag;
+	s->next = r->bucket[b];
+	r->bucket[b] = s;
+
+	return s;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+	       ((uint32_t) p[2] << 8) | p[3];
+}
+
+static int no_ack_input(struct schc_reass *r, uint64_t device, const uint8_t *frag, size_t frag_len,
+		schc_reass_sink deliver, void *arg)
+{
+	if (frag_len < SCHC_FRG_HDR_LEN)
+		return SCHC_REASS_ERROR;
+
+	uint8_t fcn = frag[1];
+	struct reass_session *s = session_find(r, device, SCHC_FRG_RULEID, 0);
+
+	/*
+	 * A fragment was lost, the packet can not be reassembled. This
+	 * fragment may be the first one of the next packet.
+	 */
+	if (s != NULL && s->fcn != fcn) {
+		session_free(s);
+		s = NULL;
+	}
+
+	if (s == NULL) {
+		s = session_new(r, device, SCHC_FRG_RULEID, 0, REASS_NO_ACK);
+		if (s == NULL)
+			return SCHC_REASS_ERROR;
+		s->fcn = fcn;
+	}
+
+	session_touch(s);
+
+	size_t hdr_len = SCHC_FRG_HDR_LEN + (fcn == 0 ? CRC32_LEN : 0);
+
+	if (frag_len < hdr_len ||
+	    (fcn != 0 && frag_len - hdr_len != SCHC_FRG_PAY_LEN) ||
+	    s->len + frag_len - hdr_len > SCHC_REASS_BUF_LEN) {
+		session_free(s);
+		return SCHC_REASS_ERROR;
+	}
+
+	size_t tile_len = frag_len - hdr_len;
+
+	/* The RCS is computed as the tiles arrive, in order */
+	memcpy(s->buf->data + s->len, frag + hdr_len, tile_len);
+	s->rcs = crc32_update(s->rcs, s->buf->data + s->len, tile_len);
+	s->len += tile_len;
+
+	if (fcn != 0) {
+		s->fcn = fcn - 1;
+		return SCHC_REASS_PENDING;
+	}
+
+	int ret = SCHC_REASS_ERROR;
+
+	if (crc32_final(s->rcs) == get_be32(frag + SCHC_FRG_HDR_LEN)) {
+		deliver(device, s->buf->data, s->len, arg);
+		ret = SCHC_REASS_DONE;
+	}
+	session_free(s);
+
+	return ret;
+}
+
+/*
+ * Copies to bm the bitmap of window w, with the bits past the last tile
+ * set. Returns non-zero if there are tiles missing.
+ */
+static int aoe_window_bitmap(const struct reass_session *s, uint8_t w,
+		uint8_t *bm)
+{
+	int missing = 0;
+
+	memcpy(bm, s->bitmap[w], SCHC_ACK_BITMAP_LEN);
+
+	for (int t = 0 ; t < SCHC_AOE_WINDOW_SIZE ; t++) {
+		if (s->ntiles != 0 && w * SCHC_AOE_WINDOW_SIZE + t >= s->ntiles)
+			bm[t / 8] |= 0x80 >> (t % 8);
+		else if (!(bm[t / 8] & (0x80 >> (t % 8))))
+			missing = 1;
+	}
+
+	return missing;
+}
+
+/*
+ * Answers the All-1 fragment or an ACK REQ. The SCHC ACK reports the
+ * lowest window with missing tiles. If the All-1 has not arrived yet,
+ * the number of windows is unknown, so every window past the highest
+ * one seen is missing.
+ */
+static int aoe_ack(uint64_t device, struct reass_session *s,
+		schc_reass_sink deliver, schc_reass_sink send_ack, void *arg)
+{
+	uint8_t bm[SCHC_ACK_BITMAP_LEN];
+	uint8_t ack[SCHC_ACK_MAX_LEN];
+	int ack_len;
+	uint8_t w;
+
+	for (w = 0 ; w < SCHC_AOE_MAX_WINDOWS ; w++) {
+
+		if (aoe_window_bitmap(s, w, bm)) {
+			ack_len = schc_ack_build(ack, sizeof(ack), s->dtag, w, 0, bm);
+			if (send_ack)
+				send_ack(device, ack, ack_len, arg);
+			return SCHC_REASS_PENDING;
+		}
+
+		if (s->ntiles != 0 && (w + 1) * SCHC_AOE_WINDOW_SIZE >= s->ntiles)
+			break;
+	}
+
+	/*
+	 * Every tile is here. A wrong RCS is reported with a complete
+	 * bitmap, and the sender gives up.
+	 */
+	int ok = (crc32(s->buf->data, s->len) == s->rcs);
+
+	ack_len = schc_ack_build(ack, sizeof(ack), s->dtag, w, ok, bm);
+	if (send_ack)
+		send_ack(device, ack, ack_len, arg);
+
+	if (!ok) {
+		session_free(s);
+		return SCHC_REASS_ERROR;
+	}
+
+	deliver(device, s->buf->data, s->len, arg);
+	done_push(s);
+
+	return SCHC_REASS_DONE;
+}
+
+static int aoe_input(struct schc_reass *r, uint64_t device, const uint8_t *frag, size_t frag_len,
+		schc_reass_sink deliver, schc_reass_sink send_ack, void *arg)
+{
+	if (frag_len < SCHC_AOE_HDR_LEN)
+		return SCHC_REASS_ERROR;
+
+	uint8_t dtag = frag[1];
+	uint8_t w = frag[2] >> 6;
+	uint8_t fcn = frag[2] & 0x3F;
+	struct reass_session *s = session_find(r, device, SCHC_FRG_ACK_RULEID, dtag);
+
+	if (s == NULL) {
+		s = session_new(r, device, SCHC_FRG_ACK_RULEID, dtag, REASS_AOE);
+		if (s == NULL)
+			return SCHC_REASS_ERROR;
+	}
+
+	session_touch(s);
+
+	if (s->state == REASS_AOE_DONE) {
+
+		/* The last SCHC ACK was lost, send it again */
+		if (frag_len == SCHC_AOE_HDR_LEN ||
+		    (fcn == SCHC_AOE_FCN_ALL_1 && frag_len > SCHC_AOE_ALL_1_HDR_LEN &&
+		     get_be32(frag + SCHC_AOE_HDR_LEN + 1) == s->rcs)) {
+			uint8_t ack[SCHC_ACK_MAX_LEN];
+			int ack_len = schc_ack_build(ack, sizeof(ack), dtag,
+					(s->ntiles - 1) / SCHC_AOE_WINDOW_SIZE, 1, NULL);
+			if (send_ack)
+				send_ack(device, ack, ack_len, arg);
+			return SCHC_REASS_PENDING;
+		}
+
+		/* Any other fragment starts a new packet with the same DTag */
+		done_unlink(s);
+		if (session_reset(s, REASS_AOE) != 0) {
+			s->state = REASS_AOE;
+			session_free(s);
+			return SCHC_REASS_ERROR;
+		}
+	}
+
+	s->max_w = MAX(s->max_w, w);
+
+	if (frag_len == SCHC_AOE_HDR_LEN) {
+		/* ACK REQ */
+		return aoe_ack(device, s, deliver, send_ack, arg);
+	}
+
+	if (fcn == SCHC_AOE_FCN_ALL_1) {
+
+		if (frag_len <= SCHC_AOE_ALL_1_HDR_LEN ||
+		    frag[3] >= SCHC_AOE_WINDOW_SIZE) {
+			session_free(s);
+			return SCHC_REASS_ERROR;
+		}
+
+		uint16_t t = w * SCHC_AOE_WINDOW_SIZE + frag[3];
+		size_t tile_len = frag_len - SCHC_AOE_ALL_1_HDR_LEN;
+		size_t len = (size_t) t * SCHC_FRG_PAY_LEN + tile_len;
+
+		if (tile_len > SCHC_FRG_PAY_LEN || len > SCHC_REASS_BUF_LEN) {
+			session_free(s);
+			return SCHC_REASS_ERROR;
+		}
+
+		memcpy(s->buf->data + len - tile_len, frag + SCHC_AOE_ALL_1_HDR_LEN, tile_len);
+		s->bitmap[w][frag[3] / 8] |= 0x80 >> (frag[3] % 8);
+		s->ntiles = t + 1;
+		s->len = len;
+		s->rcs = get_be32(frag + SCHC_AOE_HDR_LEN + 1);
+
+		return aoe_ack(device, s, deliver, send_ack, arg);
+	}
+
+	uint8_t pos = SCHC_AOE_WINDOW_SIZE - 1 - fcn;
+	uint16_t t = w * SCHC_AOE_WINDOW_SIZE + pos;
+
+	if (frag_len - SCHC_AOE_HDR_LEN != SCHC_FRG_PAY_LEN ||
+	    (size_t) (t + 1) * SCHC_FRG_PAY_LEN > SCHC_REASS_BUF_LEN ||
+	    (s->ntiles != 0 && t >= s->ntiles - 1)) {
+		session_free(s);
+		return SCHC_REASS_ERROR;
+	}
+
+	memcpy(s->buf->data + (size_t) t * SCHC_FRG_PAY_LEN, frag + SCHC_AOE_HDR_LEN,
+			SCHC_FRG_PAY_LEN);
+	s->bitmap[w][pos / 8] |= 0x80 >> (pos % 8);
+
+	return SCHC_REASS_PENDING;
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+void schc_reass_init(struct schc_reass *reass, struct schc_wheel *wheel)
+{
+	memset(reass->bucket, 0, sizeof(reass->bucket));
+	reass->done_head = reass->done_tail = NULL;
+	reass->wheel = wheel;
+
+	schc_pool_init(&reass->session_pool, reass->sessions,
+			sizeof(reass->sessions[0]), SCHC_REASS_MAX_SESSIONS);
+	schc_pool_init(&reass->buf_pool, reass->bufs,
+			sizeof(reass->bufs[0]), SCHC_REASS_MAX_BUFFERS);
+}
+
+int schc_reass_input(struct schc_reass *reass, uint64_t device, const uint8_t *frag, size_t frag_len,
+		schc_reass_sink deliver, schc_reass_sink send_ack, void *arg)
+{
+	struct schc_metrics *m = schc_metrics_get();
+	schc_tick_t start = schc_metrics_start(m);
+	int ret;
+
+	SCHC_METRIC_ADD(m, reass_frames, 1);
+
+	if (frag_len == 0) {
+		SCHC_TRACE1(REASS_ERROR, device);
+		SCHC_METRIC_ADD(m, reass_errors, 1);
+		return SCHC_REASS_ERROR;
+	}
+
+	SCHC_TRACE3(REASS_INPUT, device, frag[0], frag_len);
+
+	switch (frag[0]) {
+		case SCHC_FRG_RULEID:
+			ret = no_ack_input(reass, device, frag, frag_len, deliver, arg);
+			break;
+
+		case SCHC_FRG_ACK_RULEID:
+			ret = aoe_input(reass, device, frag, frag_len, deliver, send_ack, arg);
+			break;
+
+		default:
+			/* Not fragmented */
+			deliver(device, frag, frag_len, arg);
+			ret = SCHC_REASS_DONE;
+			break;
+	}
+
+	if (ret == SCHC_REASS_DONE) {
+		SCHC_TRACE1(REASS_DONE, device);
+		SCHC_METRIC_ADD(m, reass_done, 1);
+	} else if (ret == SCHC_REASS_ERROR) {
+		SCHC_TRACE1(REASS_ERROR, device);
+		SCHC_METRIC_ADD(m, reass_errors, 1);
+	}
+
+	/* The time of the sinks is included */
+	schc_metrics_latency(m, SCHC_LAT_REASSEMBLE, start, 1);
+
+	return ret;
+}
+
+size_t schc_reass_sessions(const struct schc_reass *reass)
+{
+	return schc_pool_used(&reass->session_pool);
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
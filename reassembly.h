@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef REASSEMBLY_H
+#define REASSEMBLY_H
+
+/**
+ * \file
+ *
+ * \brief SCHC Reassembly (SCHC F/R receiver side).
+ *
+ * Every packet being reassembled has its own session, found by the
+ * device that sent it, the Rule ID and the DTag of its fragments, so
+ * the fragments of many packets (from many devices, on a gateway) can
+ * arrive interleaved. The sessions are kept in a hash table, and each
+ * one being reassembled has its own buffer of SCHC_REASS_BUF_LEN bytes.
+ *
+ * Both fragmentation modes of fragment.h are understood:
+ *
+ * - No-ACK: the fragments must arrive in order, a missing FCN drops
+ *   the session. The fragments have no DTag, so a device can only send
+ *   one packet at a time per Rule ID.
+ * - ACK-on-Error: the tiles are stored as they arrive, in any order,
+ *   and the All-1 fragment and the ACK REQs are answered with a SCHC
+ *   ACK. Once complete, the session is kept (without using its
+ *   buffer anymore) to answer again if the final SCHC ACK is lost, until
+ *   it expires or is reused for a new packet.
+ *
+ * See fragment.h for the format of the fragments.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "fragment.h"
+#include "timer.h"
+#include "pool.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * Maximum number of sessions, number of buckets of the session table
+ * (a power of two, at least twice the number of sessions), and maximum
+ * number of packets reassembled at the same time (each one needs a
+ * reassembly buffer, delivered sessions do not). Both the sessions and
+ * the buffers come from fixed-size pools (see pool.h), so running out
+ * of them drops the fragment that needed one.
+ */
+#ifndef SCHC_REASS_MAX_SESSIONS
+#ifdef __AVR__
+#define SCHC_REASS_MAX_SESSIONS 2
+#else
+#define SCHC_REASS_MAX_SESSIONS 2048
+#endif
+#endif
+
+#ifndef SCHC_REASS_BUCKETS
+#ifdef __AVR__
+#define SCHC_REASS_BUCKETS 4
+#else
+#define SCHC_REASS_BUCKETS 4096
+#endif
+#endif
+
+#ifndef SCHC_REASS_MAX_BUFFERS
+#ifdef __AVR__
+#define SCHC_REASS_MAX_BUFFERS 1
+#else
+#define SCHC_REASS_MAX_BUFFERS 1024
+#endif
+#endif
+
+/**
+ * Ticks (see timer.h) without fragments after which a session is
+ * dropped, with its buffer. Delivered ACK-on-Error sessions are also
+ * dropped then.
+ */
+#ifndef SCHC_REASS_INACTIVITY_TIMEOUT
+#define SCHC_REASS_INACTIVITY_TIMEOUT 600000UL /* 10 minutes of millis() */
+#endif
+
+/**
+ * Size of the reassembly buffer of a session: the longest SCHC packet
+ * that can be reassembled. It is an IPv6 MTU, the longest SCHC packet
+ * schc_compress() can build from an IPv6 packet, and the ACK-on-Error
+ * sender does not send longer ones (SCHC_AOE_MAX_PKT_LEN).
+ */
+#define SCHC_REASS_BUF_LEN SIZE_MTU_IPV6
+
+/**
+ * Return values of schc_reass_input().
+ */
+#define SCHC_REASS_ERROR    -1
+#define SCHC_REASS_PENDING   0
+#define SCHC_REASS_DONE      1
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+enum reass_state {
+	REASS_NO_ACK,   /** No-ACK, receiving */
+	REASS_AOE,      /** ACK-on-Error, receiving */
+	REASS_AOE_DONE  /** ACK-on-Error, delivered */
+};
+
+struct reass_buf {
+	uint8_t data[SCHC_REASS_BUF_LEN];
+};
+
+struct reass_session {
+	struct schc_reass *reass; /** Owner */
+	uint64_t device;
+	uint8_t rule_id;
+	uint8_t dtag;
+	uint8_t state;      /** enum reass_state */
+	uint8_t fcn;        /** No-ACK: FCN of the next fragment */
+	uint8_t max_w;      /** ACK-on-Error: highest window seen */
+	uint16_t ntiles;    /** ACK-on-Error: 0 until the All-1 arrives */
+	size_t len;         /** Bytes received (No-ACK) or packet length */
+	uint32_t rcs;       /** CRC32 state (No-ACK) or RCS of the All-1 */
+	struct reass_buf *buf; /** NULL once delivered */
+	struct schc_timer inactivity;
+	struct reass_session *next;      /** Next session of the bucket */
+	struct reass_session *done_prev; /** Delivered ACK-on-Error */
+	struct reass_session *done_next; /** sessions, oldest first */
+	uint8_t bitmap[SCHC_AOE_MAX_WINDOWS][SCHC_ACK_BITMAP_LEN];
+};
+
+/**
+ * \brief A reassembly instance: its session table, and the pools of
+ * sessions and buffers. Its members are private to reassembly.cpp.
+ *
+ * Like the SCHC C/D instances (struct schc_ctx), every thread can run
+ * its own reassembly instance without locking, as long as the fragments
+ * of a device always go to the same instance.
+ */
+struct schc_reass {
+	struct schc_wheel *wheel;
+	struct schc_pool session_pool;
+	struct schc_pool buf_pool;
+	struct reass_session *done_head;
+	struct reass_session *done_tail;
+	struct reass_session *bucket[SCHC_REASS_BUCKETS];
+	struct reass_session sessions[SCHC_REASS_MAX_SESSIONS];
+	struct reass_buf bufs[SCHC_REASS_MAX_BUFFERS];
+};
+
+/**
+ * \brief Called with every SCHC packet reassembled, or with every SCHC
+ * ACK to be sent back to device.
+ *
+ * The data is only valid during the call.
+ *
+ * @return 0 if successfull, non-zero otherwise.
+ */
+typedef int (*schc_reass_sink)(uint64_t device, const uint8_t *data,
+		size_t len, void *arg);
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Initializes a reassembly instance, with no sessions.
+ *
+ * @param wheel Runs the inactivity timers of the sessions. If NULL, the
+ * sessions never expire, and are only reused when delivered.
+ */
+void schc_reass_init(struct schc_reass *reass, struct schc_wheel *wheel);
+
+/**
+ * \brief Processes a SCHC packet or SCHC Fragment received from device.
+ *
+ * A SCHC packet which was not fragmented is handed to deliver as is.
+ *
+ * @param device Identifies the sender, for instance its LoRaWAN
+ * DevEUI. A device reassembling the packets of its gateway can use 0.
+ * @param deliver Receives the SCHC packets, once reassembled and
+ * checked against their RCS.
+ * @param send_ack Receives the SCHC ACKs of the ACK-on-Error sessions.
+ *
+ * @return SCHC_REASS_DONE if a packet was delivered, SCHC_REASS_PENDING
+ * if the fragment was stored (or was a duplicate), or SCHC_REASS_ERROR
+ * if it was malformed, there was no free session, or the RCS of the
+ * packet did not match.
+ */
+int schc_reass_input(struct schc_reass *reass, uint64_t device, const uint8_t *frag, size_t frag_len,
+		schc_reass_sink deliver, schc_reass_sink send_ack, void *arg);
+
+/**
+ * \brief Number of sessions in use.
+ */
+size_t schc_reass_sessions(const struct schc_reass *reass);
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* REASSEMBLY_H */
+
+// vim:tw=72
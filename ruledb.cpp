@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+
+/**
+ * \file
+ * \brief Implementation of the ruledb.h functions.
+ *
+ * The readers follow a quiescent state based reclamation: the database
+ * counts epochs, and every reader stores the epoch it saw in its last
+ * quiescent state (0 while offline). Once a new rule set is swapped in
+ * and the epoch incremented, a reader seeing the new epoch can only get
+ * the new rule set, so the old one is freed when every online reader
+ * stored the new epoch.
+ */
+
+#ifndef ARDUINO
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "ruledb.h"
+#include "crc32.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define CACHE_LINE 64
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct ruledb_reader {
+	alignas(CACHE_LINE) std::atomic<uint64_t> epoch;
+	std::atomic<int> used;
+};
+
+struct schc_ruledb {
+	std::atomic<const struct schc_ruleset *> ruleset;
+	std::atomic<uint64_t> epoch;
+
+	/* Only used by the loading thread */
+	std::mutex load_lock;
+	struct schc_ruleset *current;
+
+	struct ruledb_reader readers[SCHC_RULEDB_MAX_READERS];
+};
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static uint16_t get_be16(const uint8_t *p)
+{
+	return (uint16_t) p[0] << 8 | p[1];
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+	       (uint32_t) p[2] << 8 | p[3];
+}
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+ * \brief Reads a rule file and compiles it.
+ *
+ * @return A new rule set, or NULL if the file could not be read or is
+ * not valid.
+ */
+static struct schc_ruleset *rulefile_read(const char *path)
+{
+	uint8_t hdr[SCHC_RULEFILE_HDR_LEN];
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL)
+		return NULL;
+
+	if (fread(hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr, SCHC_RULEFILE_MAGIC, 4) != 0 ||
+	    get_be16(hdr + 4) != SCHC_RULEFILE_VERSION) {
+		fclose(f);
+		return NULL;
+	}
+
+	size_t nrows = get_be16(hdr + 6);
+	size_t nwords = get_be16(hdr + 8);
+	size_t len = nrows * sizeof(struct packed_field) + nwords * SCHC_FIELD_LEN;
+
+	/* One more than needed, so nothing is 0 bytes long */
+	uint8_t *data = new (std::nothrow) uint8_t[len + 1];
+	uint64_t *lists = new (std::nothrow) uint64_t[nwords + 1];
+	struct schc_ruleset *ruleset = new (std::nothrow) struct schc_ruleset();
+	int ok = (data != NULL && lists != NULL && ruleset != NULL &&
+		  fread(data, 1, len + 1, f) == len &&
+		  crc32(data, len) == get_be32(hdr + 10));
+
+	fclose(f);
+
+	if (ok) {
+		const uint8_t *words = data + nrows * sizeof(struct packed_field);
+
+		for (size_t w = 0 ; w < nwords ; w++)
+			lists[w] = schc_slot_get(words + w * SCHC_FIELD_LEN);
+
+		/* struct packed_field is only bytes, it can be read in place */
+		ok = (schc_ruleset_compile_packed(ruleset, (const struct packed_field *) data,
+						  nrows, lists, nwords) == 0);
+	}
+
+	delete[] data;
+	delete[] lists;
+
+	if (!ok) {
+		delete ruleset;
+		return NULL;
+	}
+
+	return ruleset;
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+int schc_ruleset_save(const struct schc_ruleset *ruleset, const char *path)
+{
+	uint8_t hdr[SCHC_RULEFILE_HDR_LEN];
+	char tmp[1024];
+	size_t nrows = 0;
+	size_t nwords = 0;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))
+		return -1;
+
+	for (size_t i = 0 ; i < ruleset->nrules ; i++)
+		nrows += ruleset->rules[i].nfields + 1;
+	for (uint8_t i = 0 ; i < ruleset->nmappings ; i++)
+		nwords += 1 + ruleset->mappings[i].n;
+
+	if (nrows > 0xFFFF || nwords > 0xFFFF)
+		return -1;
+
+	size_t len = nrows * sizeof(struct packed_field) + nwords * SCHC_FIELD_LEN;
+	uint8_t *data = new (std::nothrow) uint8_t[len + 1];
+
+	if (data == NULL)
+		return -1;
+
+	struct packed_field *row = (struct packed_field *) data;
+	const struct packed_field end = SCHC_ROW_END;
+
+	for (size_t i = 0 ; i < ruleset->nrules ; i++) {
+		const struct compiled_rule *rule = &ruleset->rules[i];
+
+		for (int j = 0 ; j < rule->nfields ; j++) {
+			struct compiled_field field_tmp;
+
+			packed_field_write(rule_field(ruleset, rule, j, &field_tmp), row++);
+		}
+		*row++ = end;
+	}
+
+	uint8_t *word = (uint8_t *) row;
+
+	for (uint8_t i = 0 ; i < ruleset->nmappings ; i++) {
+		const struct schc_mapping *m = &ruleset->mappings[i];
+
+		schc_slot_set(word, m->n);
+		word += SCHC_FIELD_LEN;
+		for (int j = 0 ; j < m->n ; j++) {
+			memcpy(word, ruleset->map_values[m->first + j], SCHC_FIELD_LEN);
+			word += SCHC_FIELD_LEN;
+		}
+	}
+
+	memcpy(hdr, SCHC_RULEFILE_MAGIC, 4);
+	put_be16(hdr + 4, SCHC_RULEFILE_VERSION);
+	put_be16(hdr + 6, nrows);
+	put_be16(hdr + 8, nwords);
+	put_be32(hdr + 10, crc32(data, len));
+
+	FILE *f = fopen(tmp, "wb");
+	int ret = -1;
+
+	if (f != NULL) {
+		ret = (fwrite(hdr, sizeof(hdr), 1, f) != 1 ||
+		       fwrite(data, 1, len, f) != len);
+		if (fclose(f) != 0 || (ret == 0 && rename(tmp, path) != 0))
+			ret = -1;
+		if (ret != 0)
+			unlink(tmp);
+	}
+
+	delete[] data;
+
+	return ret;
+}
+
+struct schc_ruledb *schc_ruledb_open(const char *path)
+{
+	struct schc_ruledb *db = new (std::nothrow) struct schc_ruledb();
+
+	if (db == NULL)
+		return NULL;
+
+	db->current = rulefile_read(path);
+
+	if (db->current == NULL) {
+		delete db;
+		return NULL;
+	}
+
+	db->ruleset.store(db->current);
+	db->epoch.store(1);
+
+	for (int i = 0 ; i < SCHC_RULEDB_MAX_READERS ; i++) {
+		db->readers[i].epoch.store(0);
+		db->readers[i].used.store(0);
+	}
+
+	return db;
+}
+
+int schc_ruledb_load(struct schc_ruledb *db, const char *path)
+{
+	std::lock_guard<std::mutex> lock(db->load_lock);
+	struct schc_ruleset *ruleset = rulefile_read(path);
+
+	if (ruleset == NULL)
+		return -1;
+
+	/*
+	 * The new set may be allocated where a freed one was: a newer
+	 * generation still tells the instances to flush their flows.
+	 */
+	ruleset->generation = db->current->generation + 1;
+
+	db->ruleset.store(ruleset);
+
+	uint64_t epoch = db->epoch.fetch_add(1) + 1;
+
+	/* Grace period: the readers still in an older epoch may use the old set */
+	for (int i = 0 ; i < SCHC_RULEDB_MAX_READERS ; i++) {
+		struct ruledb_reader *reader = &db->readers[i];
+
+		for (;;) {
+			uint64_t seen = reader->epoch.load();
+
+			if (!reader->used.load() || seen == 0 || seen >= epoch)
+				break;
+			std::this_thread::yield();
+		}
+	}
+
+	delete db->current;
+	db->current = ruleset;
+
+	return 0;
+}
+
+const struct schc_ruleset *schc_ruledb_get(struct schc_ruledb *db)
+{
+	return db->ruleset.load();
+}
+
+int schc_ruledb_register(struct schc_ruledb *db)
+{
+	for (int i = 0 ; i < SCHC_RULEDB_MAX_READERS ; i++) {
+		int unused = 0;
+
+		if (db->readers[i].used.compare_exchange_strong(unused, 1)) {
+			db->readers[i].epoch.store(db->epoch.load());
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void schc_ruledb_quiescent(struct schc_ruledb *db, int reader)
+{
+	db->readers[reader].epoch.store(db->epoch.load());
+}
+
+void schc_ruledb_offline(struct schc_ruledb *db, int reader, int unregister)
+{
+	db->readers[reader].epoch.store(0);
+
+	if (unregister)
+		db->readers[reader].used.store(0);
+}
+
+void schc_ruledb_close(struct schc_ruledb *db)
+{
+	delete db->current;
+	delete db;
+}
+
+#endif /* ARDUINO */
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
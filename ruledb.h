@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+
+#ifndef RULEDB_H
+#define RULEDB_H
+
+/**
+ * \file
+ *
+ * \brief Binary rule files and lock-free rule set swapping (host only).
+ *
+ * A rule file holds the rules as the packed rows and mapping lists of
+ * schc_ruleset_compile_packed(), after a small header:
+ *
+ * \verbatim
+ * +-------+---------+-------+--------+-------+---- ... ----+---- ... ----+
+ * | magic | version | nrows | nwords | CRC32 |    rows     |    lists    |
+ * +-------+---------+-------+--------+-------+---- ... ----+---- ... ----+
+ *  4 bytes  2 bytes 2 bytes  2 bytes 4 bytes  12 bytes each  8 bytes each
+ * \endverbatim
+ *
+ * The rows are struct packed_field as SCHC_ROW() writes them, with
+ * SCHC_ROW_END after every rule. The lists are the words given to
+ * schc_ruleset_compile_packed(): the number of values of every list,
+ * followed by its values. Every number is big-endian, and the CRC32 is
+ * the one of the rows and lists, so the file does not depend on the
+ * host nor on the limits of the build that wrote it (SCHC_MAX_RULES...),
+ * as long as its rules fit in the one reading it.
+ *
+ * The file is written by schc_ruleset_save() from a compiled rule set.
+ * The rule database reads it and compiles it again: the index, the rule
+ * matrix, the mapping tables and the flow key fields are always rebuilt
+ * from the rules, never trusted from the file.
+ *
+ * So the file is not memory-mapped and used in place: a mapped rule set
+ * would be a struct schc_ruleset of this build (its ABI, its limits and
+ * the same size whatever the number of rules), and checking its tables
+ * against its rules costs as much as building them. Loading a file reads
+ * and compiles it instead, in about 40 us for 128 rules on a desktop
+ * host, and only the loading thread pays for it. The readers use the
+ * compiled rule set as they would any other.
+ *
+ * A rule set holds at most SCHC_MAX_RULES rules (128), as the Rule IDs
+ * are 8 bits, and so at most SCHC_MAX_FIELDS rows and SCHC_MAX_MAPPINGS
+ * lists of SCHC_MAPPING_VALUES values in all. The 16-bit nrows and
+ * nwords never limit it.
+ *
+ * A rule database holds the current rule set. Loading a new file swaps
+ * it in with a single atomic store. The old one is freed once every
+ * reader went through a quiescent state (a point where it holds no
+ * pointer to a rule set), so the readers never wait nor lock: only the
+ * thread loading the new file waits.
+ */
+
+#ifndef ARDUINO
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "context.h"
+
+#ifdef SCHC_FLASH_RULES
+#error "The rule files need the rules in RAM, undefine SCHC_FLASH_RULES"
+#endif
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define SCHC_RULEFILE_MAGIC   "SCHC"
+#define SCHC_RULEFILE_VERSION 5
+
+/**
+ * Length of the header of a rule file, before the rows.
+ */
+#define SCHC_RULEFILE_HDR_LEN 14
+
+/**
+ * Maximum number of readers of a rule database.
+ */
+#define SCHC_RULEDB_MAX_READERS 64
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct schc_ruledb;
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Writes a compiled rule set to a rule file. The file is written
+ * aside and renamed, so a database using the old file is not affected.
+ *
+ * @return 0 if successfull, non-zero if the file could not be written.
+ */
+int schc_ruleset_save(const struct schc_ruleset *ruleset, const char *path);
+
+/**
+ * \brief Reads and compiles a rule file, and creates a database with it
+ * as the current rule set.
+ *
+ * @return The database, or NULL if the file could not be read or is
+ * not valid.
+ */
+struct schc_ruledb *schc_ruledb_open(const char *path);
+
+/**
+ * \brief Reads and compiles a rule file and makes it the current rule
+ * set of db. It waits until no reader can use the previous rule set,
+ * and frees it. Only one thread may load files at a time.
+ *
+ * @return 0 if successfull, non-zero if the file could not be read or
+ * is not valid. The current rule set is kept then.
+ */
+int schc_ruledb_load(struct schc_ruledb *db, const char *path);
+
+/**
+ * \brief Returns the current rule set. The reader may use it until its
+ * next call to schc_ruledb_quiescent() or schc_ruledb_offline().
+ */
+const struct schc_ruleset *schc_ruledb_get(struct schc_ruledb *db);
+
+/**
+ * \brief Registers a new reader of db, which starts online.
+ *
+ * @return The reader number, or -1 if there are SCHC_RULEDB_MAX_READERS
+ * readers already.
+ */
+int schc_ruledb_register(struct schc_ruledb *db);
+
+/**
+ * \brief Tells that reader holds no pointer to a rule set of db
+ * anymore. It must be called often, for instance between packets or
+ * batches of packets, or schc_ruledb_load() will wait for it.
+ */
+void schc_ruledb_quiescent(struct schc_ruledb *db, int reader);
+
+/**
+ * \brief Tells that reader will not use db until its next call to
+ * schc_ruledb_quiescent(), and unregisters it if it will not use db
+ * anymore.
+ */
+void schc_ruledb_offline(struct schc_ruledb *db, int reader, int unregister);
+
+/**
+ * \brief Frees the current rule set and db. There must be no reader
+ * online.
+ */
+void schc_ruledb_close(struct schc_ruledb *db);
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* ARDUINO */
+
+#endif /* RULEDB_H */
+
+// vim:tw=72
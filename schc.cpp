@@ -42,14 +42,25 @@
  * schc_decompress().
  *
  * \note Only a subset of operations of the SCHC C/D are implemented,
- * not all of them.
+ * not all of them. schc_decompress() is driven by the same compiled
+ * rules as schc_compress(), doing the inverse of every action.
  *
- * \note The SCHC Fragmentation/Reassembly (SCHC F/R) is not
- * implemented.
+ * \note The SCHC Fragmentation/Reassembly (SCHC F/R) is in
+ * fragment.cpp.
  *
- * \note The rule Field Length is not used at all in this
- * implementation, we hardcoded everything in the struct
- * field_description. Solving this requires thinking.
+ * \note The rules are not interpreted from their textual form on every
+ * packet. schc_compile_rules() parses the Target Values once into a
+ * struct schc_ruleset, and schc_compress() works with its binary rules.
+ * There are no global variables: all the state is in the struct
+ * schc_ctx passed to every call.
+ *
+ * \note Every instance caches the flows it compresses (see struct
+ * schc_flow), so the rule is only looked for on the first packet of a
+ * flow.
+ *
+ * \note The Compression Residue is bit-granular: every field sent uses
+ * exactly its rule Field Length, and the payload follows the last bit of
+ * the residue. Only the end of the SCHC packet is padded to a byte.
  *
  * To understand better the structure of a schc_packet:
  *
@@ -77,42 +88,15 @@
 
 #include "schc.h"
 #include "context.h"
+#include "bitbuf.h"
+#include "checksum.h"
+#include "metrics.h"
+#include "trace.h"
 
 /**********************************************************************/
 /***        Macro Definitions                                       ***/
 /**********************************************************************/
 
-// #define DEBUG
-
-#ifdef DEBUG
-
-	#warning "DEBUG MODE ACTIVATED!"
-
-	#define PRINT(...) Serial.print(__VA_ARGS__)
-	#define PRINTLN(...) Serial.println(__VA_ARGS__)
-	#define PRINT_ARRAY(add, len) \
-	do { \
-		int i; \
-		for (i = 0 ; i < (len) ; i++) { \
-			if (i % 10 == 0) \
-				Serial.println(); \
-			if (i % 50 == 0) \
-				Serial.println(); \
-			Serial.print((((uint8_t*)(add))[i]), HEX); \
-			Serial.print(" "); \
-		} \
-		Serial.println(); \
-	} while(0)
-
-#else /* DEBUG */
-
-	#define PRINT(...)
-	#define PRINTLN(...)
-	#define PRINT_ARRAY(add, len)
-
-#endif /* DEBUG */
-
-
 /**********************************************************************/
 /***        Type Definitions                                        ***/
 /**********************************************************************/
@@ -139,317 +123,596 @@
 
 
 
-static int schc_fragmentate(const uint8_t *schc_packet, size_t schc_packet_len)
+/**
+ * \brief Reads a big-endian value of n bytes from the wire.
+ */
+static inline uint32_t wire_get(const uint8_t *p, int n)
 {
+	uint32_t value = 0;
 
-	/*
-	 * If the packet len is equal or less than the max size of a
-	 * L2 packet, we send the packet as is, without fragmentation
-	 */
-	if (schc_packet_len <= MAX_SCHC_PKT_LEN) {
+	for (int i = 0 ; i < n ; i++)
+		value = (value << 8) | p[i];
 
+	return value;
+}
 
-		memcpy(tx_buff, schc_packet, schc_packet_len);
-		tx_buff_len = schc_packet_len;
+/**
+ * \brief Extracts the header fields of an IPv6/UDP packet, straight from
+ * its wire bytes, into the binary layout used by the compiled rules.
+ *
+ * This is done only once per packet, so the matching and compression
+ * of every rule row is a fixed size compare/copy. The payload is not
+ * copied, hdr points to it inside ipv6_packet.
+ *
+ * @return 0 if successfull, -1 if the packet is not a valid IPv6/UDP
+ * packet.
+ */
+static int extract_header_fields(const uint8_t *ipv6_packet, size_t len,
+		enum direction direction, struct header_fields *hdr)
+{
+	if (len < SIZE_IPV6 + SIZE_UDP || (ipv6_packet[0] >> 4) != 6 ||
+	    ipv6_packet[6] != 17 /* UDP */) {
+		return -1;
+	}
 
+	const uint8_t *ip = ipv6_packet;
+	const uint8_t *udp = ipv6_packet + SIZE_IPV6;
 
-		PRINT_ARRAY(tx_buff, tx_buff_len);
+	/*
+	 * The device is the source of the uplink packets and the destination
+	 * of the downlink ones.
+	 */
+	int dev_addr = (direction == DOWNLINK) ? 24 : 8;
+	int app_addr = (direction == DOWNLINK) ? 8 : 24;
+	int dev_port = (direction == DOWNLINK) ? 2 : 0;
+	int app_port = (direction == DOWNLINK) ? 0 : 2;
+
+	schc_slot_set(hdr->field[IPV6_VERSION],        ip[0] >> 4);
+	schc_slot_set(hdr->field[IPV6_TRAFFIC_CLASS],  wire_get(ip, 2) >> 4 & 0xFF);
+	schc_slot_set(hdr->field[IPV6_FLOW_LABEL],     wire_get(ip + 1, 3) & 0xFFFFF);
+	schc_slot_set(hdr->field[IPV6_PAYLOAD_LENGTH], wire_get(ip + 4, 2));
+	schc_slot_set(hdr->field[IPV6_NEXT_HEADER],    ip[6]);
+	schc_slot_set(hdr->field[IPV6_HOP_LIMIT],      ip[7]);
+
+	memcpy(hdr->field[IPV6_DEV_PREFIX], ip + dev_addr,     SCHC_FIELD_LEN);
+	memcpy(hdr->field[IPV6_DEVIID],     ip + dev_addr + 8, SCHC_FIELD_LEN);
+	memcpy(hdr->field[IPV6_APP_PREFIX], ip + app_addr,     SCHC_FIELD_LEN);
+	memcpy(hdr->field[IPV6_APPIID],     ip + app_addr + 8, SCHC_FIELD_LEN);
+
+	schc_slot_set(hdr->field[UDP_DEVPORT],  wire_get(udp + dev_port, 2));
+	schc_slot_set(hdr->field[UDP_APPPORT],  wire_get(udp + app_port, 2));
+	schc_slot_set(hdr->field[UDP_LENGTH],   wire_get(udp + 4, 2));
+	schc_slot_set(hdr->field[UDP_CHECKSUM], wire_get(udp + 6, 2));
+
+	hdr->payload = ipv6_packet + SIZE_IPV6 + SIZE_UDP;
+	hdr->payload_len = len - SIZE_IPV6 - SIZE_UDP;
 
-		return 0;
+	return 0;
+}
 
+/**
+ * \brief Appends the compression residue to the SCHC packet, using the
+ * CA action defined in rule_row.
+ *
+ * \note That this function might not append any bits to the
+ * compression residue. Such thing is possible depending on the rule.
+ *
+ * @param [in] ruleset The rule set of rule_row, with its mappings.
+ *
+ * @param [in] rule_row The compiled rule row to check the Compression
+ * Action (CA) to do to the packet field. Must not be NULL.
+ *
+ * @param [in] hdr The header fields of the original ipv6_packet from
+ * which we extract the information in case we need to copy some
+ * information to the compression residue.
+ *
+ * @param [in,out] residue The writer of the SCHC packet. The function
+ * appends exactly as many bits as the CA needs (the Field Length for
+ * VALUE_SENT), with no alignment. The idea is to call this function many
+ * times in sequence, every call will append new bits to the residue, and
+ * after the last call, the application payload is appended.
+ *
+ * @return Zero if success, non-zero if error.
+ *
+ * \note Only implements the following CA:
+ * - COMPUTE_LENGTH
+ * - COMPUTE_CHECKSUM
+ * - NOT_SENT
+ * - VALUE_SENT
+ * - LSB
+ * - MAPPING_SENT
+ *   TODO implement the rest.
+ */
+static int do_compression_action(const struct schc_ruleset *ruleset,
+		const struct compiled_field *rule_row,
+		const struct header_fields *hdr, struct bit_writer *residue)
+{
+	if (rule_row == NULL || hdr == NULL) {
+		return -1;
 	}
 
-	/*
-	 * We start the fragmentation procedure.
-	 */
+	switch (rule_row->CDA) {
+		case NOT_SENT:
+		case COMPUTE_LENGTH:
+		case COMPUTE_CHECKSUM:
+			return 0;
 
+		case VALUE_SENT:
+			bit_writer_put(residue, schc_slot_get(hdr->field[rule_row->fieldid]),
+					rule_row->field_length);
+			return 0;
 
+		case LSB:
+			bit_writer_put(residue, schc_slot_get(hdr->field[rule_row->fieldid]),
+					rule_row->lsb_bits);
+			return 0;
 
-	int nfrag = schc_packet_len / SCHC_FRG_PAY_LEN + (schc_packet_len % SCHC_FRG_PAY_LEN != 0);
+		case MAPPING_SENT: {
+			int index = mapping_lookup(ruleset, rule_row->mapping,
+					hdr->field[rule_row->fieldid]);
 
-	schc_fragment fragments[nfrag];
+			if (index < 0)
+				return -1;
 
-	memset(fragments, 0, sizeof(fragments));
+			bit_writer_put(residue, index,
+					ruleset->mappings[rule_row->mapping].index_bits);
+			return 0;
+		}
 
-	size_t bytes_left = schc_packet_len;
+		default:
+			break;
+	}
 
-	for (int i = 0 ; i < nfrag ; i++) {
+	return -1;
+}
 
-		fragments[i].rule_id = 0x80; /* TODO hardcoded, make this generic */
-		fragments[i].fcn = nfrag - i -1;
+/**
+ * \brief Applies the Matching Operator of rule_row to the packet field.
+ *
+ * MSB compares the field and the TV under a mask of the rule_row
+ * field_length - lsb_bits most significant bits, and MATCH_MAPPING is a
+ * lookup in the perfect hash table of the mapping.
+ *
+ * @return 1 if the field matches, 0 if it does not.
+ */
+static int check_matching(const struct schc_ruleset *ruleset,
+		const struct compiled_field *rule_row,
+		const struct header_fields *hdr)
+{
+	switch (rule_row->MO) {
+		case IGNORE:
+			return 1;
 
-		size_t frg_siz = MIN(sizeof(fragments[i].payload), bytes_left);
+		case EQUALS:
+			return memcmp(hdr->field[rule_row->fieldid], rule_row->tv,
+					SCHC_FIELD_LEN) == 0;
 
+		case MSB: {
+			uint64_t diff = schc_slot_get(hdr->field[rule_row->fieldid]) ^
+					schc_slot_get(rule_row->tv);
 
-		// We send the LoRaWAN packet {
+			return rule_row->lsb_bits == 64 || (diff >> rule_row->lsb_bits) == 0;
+		}
 
+		case MATCH_MAPPING:
+			return mapping_lookup(ruleset, rule_row->mapping,
+					hdr->field[rule_row->fieldid]) >= 0;
 
-		if (i + 1 < nfrag) {
-			// This is not the last SCHC_Fragment
-			memcpy(tx_buff, &fragments[i], MIN(sizeof(fragments[i]), sizeof(tx_buff)));
-			tx_buff_len = frg_siz + (sizeof(fragments[i]) - sizeof(fragments[i].payload));
-		} else {
-			// This is the Last Fragment
-			// uint16_t checksum (uint16_t *addr, int len);
+		default:
+			break;
+	}
 
-			uint16_t mic = checksum((uint16_t*)schc_packet, schc_packet_len);
+	return 0;
+}
 
-			mic = htons(mic);
-			memcpy(&tx_buff[2], &mic, sizeof(mic));
-			memcpy(&tx_buff[4], fragments[i].payload, MIN(sizeof(tx_buff), frg_siz));
-			tx_buff_len = frg_siz + sizeof(mic) + (sizeof(fragments[i]) - sizeof(fragments[i].payload));
+/**
+ * \brief Checks every row of the rule against the packet.
+ *
+ * @return 1 if all the Matching Operators of the rule succeed, 0
+ * otherwise.
+ */
+static int rule_matches(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule, const struct header_fields *hdr)
+{
+	struct compiled_field tmp;
 
-			
+	for (int i = 0 ; i < rule->nfields ; i++) {
+		if (!check_matching(ruleset, rule_field(ruleset, rule, i, &tmp), hdr)) {
+			return 0;
 		}
+	}
+
+	return 1;
+}
+
+/**
+ * \brief Looks for the rule to compress a packet.
+ *
+ * Rule sets of up to SCHC_MATRIX_MAX_RULES rules use the rule matrix,
+ * if there is one: the candidates come from the best to the worst, so
+ * the first one that matches is returned. Otherwise, with the index,
+ * for every key only the rules in the bucket of the packet can match.
+ * Among all the rules that match, the one giving the shortest
+ * Compression Residue is returned.
+ *
+ * @return The rule, or NULL if no rule matches.
+ */
+static const struct compiled_rule *select_rule(const struct schc_ruleset *ruleset,
+		const struct header_fields *hdr)
+{
+#ifdef SCHC_RULE_MATRIX
+	if (ruleset->nrules <= SCHC_MATRIX_MAX_RULES) {
+		struct rule_matrix_iter it;
+		const struct compiled_rule *candidate;
+
+		for (candidate = rule_matrix_first(ruleset, hdr, &it) ; candidate != NULL ;
+		     candidate = rule_matrix_next(ruleset, &it)) {
+
+			if (rule_matrix_exact(ruleset, candidate) ||
+			    rule_matches(ruleset, candidate, hdr))
+				return candidate;
 
+			SCHC_TRACE1(RULE_MISS, candidate->rule_id);
+		}
 
-		// PRINT("schc_fragmentate, nfrags: ");
-		// PRINTLN(nfrag, DEC);
-		// PRINTLN("schc_fragmentate, send following Fragment over radio: ");
-		// PRINT_ARRAY(tx_buff, tx_buff_len);
+		return NULL;
+	}
+#endif
 
+	const struct compiled_rule *rule = NULL;
 
+	for (uint8_t key = 0 ; key < rule_index_keys(ruleset) ; key++) {
 
+		const struct compiled_rule *candidate;
 
-		// lorawan_send();
+		for (candidate = rule_index_first(ruleset, key, hdr) ; candidate != NULL ;
+		     candidate = rule_index_next(ruleset, key, candidate)) {
 
+			if (!rule_matches(ruleset, candidate, hdr)) {
+				SCHC_TRACE1(RULE_MISS, candidate->rule_id);
+				continue;
+			}
 
-		// } We send the LoRaWAN packet
+			if (rule == NULL || rule_is_better(candidate, rule))
+				rule = candidate;
 
-		bytes_left -= frg_siz;
+			break; /* the rest of the bucket is worse than candidate */
+		}
 	}
 
+	return rule;
+}
+
+/**
+ * \brief Writes the Rule ID and the Compression Residue of the packet.
+ *
+ * @return Zero if success, non-zero if a CA is not supported.
+ */
+static int write_compressed_header(const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule, const struct header_fields *hdr,
+		struct bit_writer *w)
+{
+	struct compiled_field tmp;
+
+	bit_writer_put(w, rule->rule_id, 8);
+
+	for (int j = 0 ; j < rule->nfields ; j++) {
+		if (do_compression_action(ruleset, rule_field(ruleset, rule, j, &tmp),
+					  hdr, w) != 0) {
+			return -1;
+		}
+	}
 
 	return 0;
+}
+
+/**
+ * \brief Builds the flow key of a packet: the slots of the fields in
+ * ruleset->flow_fields, one after the other.
+ *
+ * @return The length of the key, or -1 if it does not fit in
+ * SCHC_FLOW_KEY_LEN.
+ */
+static int flow_key(const struct schc_ruleset *ruleset,
+		const struct header_fields *hdr, uint8_t key[SCHC_FLOW_KEY_LEN])
+{
+	int len = 0;
+
+	for (int id = 0 ; id < SCHC_FIELDS_COUNT ; id++) {
 
+		if (!(ruleset->flow_fields & (1U << id)))
+			continue;
+
+		if (len + SCHC_FIELD_LEN > SCHC_FLOW_KEY_LEN)
+			return -1;
+
+		memcpy(key + len, hdr->field[id], SCHC_FIELD_LEN);
+		len += SCHC_FIELD_LEN;
+	}
 
+	return len;
 }
 
+static struct schc_flow *flow_slot(struct schc_ctx *ctx, const uint8_t *key,
+		int key_len)
+{
+	uint32_t h = 2166136261UL; /* FNV-1a */
+
+	for (int i = 0 ; i < key_len ; i++) {
+		h ^= key[i];
+		h *= 16777619UL;
+	}
+
+	return &ctx->flows[(h ^ (h >> 16)) & (SCHC_FLOW_CACHE_SIZE - 1)];
+}
 
 /**
- * \brief Appends the compression residue to the SCHC packet, using the
- * CA action defined in rule_row.
- *
- * \note That this function might not append any bytes to the
- * compression residue. Such thing is possible depending on the rule.
- *
- * @param [in] rule_row The rule row to check the Compression Action
- * (CA) to do to the ipv6_packet target value. Must not be NULL.
+ * \brief Stores the flow of the packet, compressed with rule, in its
+ * cache entry.
  *
- * @param [in] ipv6_packet The original ipv6_packet from wihch we
- * extract the information in case we need to copy some information to
- * the compression residue.
- *
- * @param [in,out] schc_packet The target SCHC compressed packet result of
- * aplying the CA. The function appends as many bytes as it needs
- * depending on the rule_row->CDA. Must be not-null. If the function
- * returns error, the contents of the schc_packet are undefined.
+ * @return Zero if success, non-zero if the compressed header does not
+ * fit in the entry or a CA is not supported (the entry is left as it
+ * was then).
+ */
+static int flow_fill(struct schc_flow *flow, const struct schc_ruleset *ruleset,
+		const struct compiled_rule *rule, const struct header_fields *hdr,
+		const uint8_t *key, int key_len)
+{
+	uint8_t buf[SCHC_FLOW_HDR_LEN];
+	struct bit_writer w;
+
+	bit_writer_init(&w, buf, sizeof(buf));
+
+	if (write_compressed_header(ruleset, rule, hdr, &w) != 0)
+		return -1;
+
+	uint16_t hdr_bits = bit_writer_bits(&w);
+	int len = bit_writer_finish(&w);
+
+	if (len < 0)
+		return -1;
+
+	memcpy(flow->hdr, buf, len);
+	memcpy(flow->key, key, key_len);
+	flow->hdr_bits = hdr_bits;
+	flow->rule_id = rule->rule_id;
+	flow->valid = 1;
+
+	return 0;
+}
+
+/**
+ * \brief Flushes the flow cache of the instance if it uses another rule
+ * set, or if its rule set was compiled again, since the flows were
+ * cached.
+ */
+static void flow_cache_sync(struct schc_ctx *ctx)
+{
+	if (ctx->flows_ruleset == ctx->ruleset &&
+	    ctx->generation == ctx->ruleset->generation)
+		return;
+
+	for (int i = 0 ; i < SCHC_FLOW_CACHE_SIZE ; i++)
+		ctx->flows[i].valid = 0;
+	ctx->flows_ruleset = ctx->ruleset;
+	ctx->generation = ctx->ruleset->generation;
+}
+
+/**
+ * \brief Finds how to compress a packet.
  *
- * function must append bytes to the Compression Residue. Once the
- * function returns, it will point to the next available byte in the
- * schc_packet. The idea is to call this function many times in
- * sequence, every call will append new bytes to the schc_packet, and
- * after the last call, it points where the application payload should
- * be.
+ * The packets of a flow already seen get the Rule ID and residue cached
+ * for it. Otherwise we look for the rule with select_rule(), and the
+ * result is cached for the next packets of the flow.
  *
- * @return Zero if success, non-zero if error.
+ * @param [out] flow The cache entry of the flow, or NULL if the flow
+ * is not cached.
  *
- * \note Only implements the following CA:
- * - COMPUTE_LENGTH
- * - COMPUTE_CHECKSUM
- * - NOT_SENT
- *   TODO implement the rest.
+ * @param [out] rule The rule to compress the packet with.
  *
- * We just need a quick implementation to start testing with a real
- * scenario, so we don't bother with all the complex compression
- * actions, like the MSB or Map Matching. We need an ad-hoc solution for
- * our tests.
+ * @param [out] filled The cache entry the flow was stored in, or NULL.
+ * If it could not be stored, this is still the entry it would have
+ * gone in, though it was not changed.
  *
+ * @return 0 if successfull, -1 if no rule matches the packet.
  */
-static int do_compression_action(const struct field_description *rule_row,
+static int compress_lookup(struct schc_ctx *ctx, const struct header_fields *hdr,
+		const struct schc_flow **flow, const struct compiled_rule **rule,
+		const struct schc_flow **filled)
 {
-	if (rule_row == NULL || ipv6_packet == NULL) {
-		return -1;
-	}
+	const struct schc_ruleset *ruleset = ctx->ruleset;
+	uint8_t key[SCHC_FLOW_KEY_LEN];
+	int key_len = flow_key(ruleset, hdr, key);
+	struct schc_flow *slot = (key_len < 0) ? NULL : flow_slot(ctx, key, key_len);
 
-	if (rule_row->CDA == COMPUTE_LENGTH || rule_row->CDA == NOT_SENT ||
-	    rule_row->CDA == COMPUTE_CHECKSUM) {
+	*flow = NULL;
+	*filled = NULL;
+
+	if (slot != NULL && slot->valid && memcmp(slot->key, key, key_len) == 0) {
+		*flow = slot;
+		*rule = rule_find(ruleset, slot->rule_id);
 		return 0;
 	}
 
-	size_t n = 0;
-	uint32_t udp_flow_label;
-	uint16_t ipv6_payload_length;
-	uint16_t udp_dev_port;
-
-	uint16_t udp_app_port;
-	uint16_t udp_length;
-	uint16_t udp_checksum;
-
-	if (rule_row->CDA == VALUE_SENT) {
-
-		switch (rule_row->fieldid) {
-			case IPV6_NEXT_HEADER:
-				n = 1;
-				return 0;
-			case IPV6_HOP_LIMIT:
-				n = 1;
-				return 0;
-			case IPV6_DEV_PREFIX:
-				n = 8;
-				return 0;
-			case IPV6_DEVIID:
-				n = 8;
-				return 0;
-			case IPV6_APP_PREFIX:
-				n = 8;
-				return 0;
-			case IPV6_APPIID:
-				n = 8;
-				return 0;
-			case UDP_DEVPORT:
-				n = 2;
-				udp_dev_port = htons(ipv6_packet->udp_dev_port);
-				return 0;
-			case UDP_APPPORT:
-				n = 2;
-				udp_app_port = htons(ipv6_packet->udp_app_port);
-				return 0;
-			case UDP_LENGTH:
-				n = 2;
-				udp_length = htons(ipv6_packet->udp_length);
-				return 0;
-			case UDP_CHECKSUM:
-				n = 2;
-				udp_checksum = htons(ipv6_packet->udp_checksum);
-				return 0;
-				n = 1;
-				return 0;
-				n = 1;
-				return 0;
-				n = 1;
-				return 0;
-				n = 1;
-				return 0;
-				n = 2;
-				return 0;
-				return 0;
-				n = 1;
-				return 0;
-				n = 1;
-				return 0;
-				return 0;
-			default:
-				break;
+	*rule = select_rule(ruleset, hdr);
+
+	if (*rule == NULL)
+		return -1;
+
+	if (slot == NULL)
+		return 0;
+
+	*filled = slot;
+
+	if (flow_fill(slot, ruleset, *rule, hdr, key, key_len) == 0)
+		*flow = slot;
+
+	return 0;
+}
+
+/**
+ * \brief Writes the SCHC packet: the Rule ID and the Compression Residue,
+ * copied from the flow if it is cached or written with rule otherwise,
+ * and then the payload.
+ *
+ * @return The length of the SCHC packet, or -1 if it does not fit in
+ * schc_packet_cap bytes or a CA is not supported.
+ */
+static int compress_emit(const struct schc_ruleset *ruleset,
+		const struct header_fields *hdr, const struct schc_flow *flow,
+		const struct compiled_rule *rule, uint8_t *schc_packet,
+		size_t schc_packet_cap)
+{
+	struct bit_writer w;
+
+	bit_writer_init(&w, schc_packet, schc_packet_cap);
+
+	if (flow != NULL)
+		bit_writer_put_bits(&w, flow->hdr, flow->hdr_bits);
+	else if (write_compressed_header(ruleset, rule, hdr, &w) != 0)
+		return -1;
+
+	SCHC_TRACE3(COMPRESS_DONE, rule->rule_id, bit_writer_bits(&w) - 8, flow != NULL);
+
+	/*
+	 * At this point, Compression Ressidue is already in the packet.
+	 * We concatenate the app_payload to the packet, right after the
+	 * last bit of the residue. Then the last byte is padded with zeros.
+	 */
+	bit_writer_put_bytes(&w, hdr->payload, hdr->payload_len);
+
+	return bit_writer_finish(&w);
+}
+
+/**
+ * \brief Writes the header fields to the wire, the inverse of
+ * extract_header_fields().
+ *
+ * The IPv6 payload length, UDP length and UDP checksum are written as
+ * they are in hdr, they must be computed before.
+ */
+static void write_header_fields(const struct header_fields *hdr,
+		enum direction direction, uint8_t *ipv6_packet)
+{
+	uint8_t *ip = ipv6_packet;
+	uint8_t *udp = ipv6_packet + SIZE_IPV6;
+
+	int dev_addr = (direction == DOWNLINK) ? 24 : 8;
+	int app_addr = (direction == DOWNLINK) ? 8 : 24;
+	int dev_port = (direction == DOWNLINK) ? 2 : 0;
+	int app_port = (direction == DOWNLINK) ? 0 : 2;
+
+	uint8_t version = schc_slot_get(hdr->field[IPV6_VERSION]);
+	uint8_t traffic_class = schc_slot_get(hdr->field[IPV6_TRAFFIC_CLASS]);
+	uint32_t flow_label = schc_slot_get(hdr->field[IPV6_FLOW_LABEL]);
+
+	ip[0] = version << 4 | traffic_class >> 4;
+	ip[1] = traffic_class << 4 | (flow_label >> 16 & 0x0F);
+	ip[2] = flow_label >> 8;
+	ip[3] = flow_label;
+	memcpy(ip + 4, hdr->field[IPV6_PAYLOAD_LENGTH] + SCHC_FIELD_LEN - 2, 2);
+	ip[6] = hdr->field[IPV6_NEXT_HEADER][SCHC_FIELD_LEN - 1];
+	ip[7] = hdr->field[IPV6_HOP_LIMIT][SCHC_FIELD_LEN - 1];
+
+	memcpy(ip + dev_addr,     hdr->field[IPV6_DEV_PREFIX], SCHC_FIELD_LEN);
+	memcpy(ip + dev_addr + 8, hdr->field[IPV6_DEVIID],     SCHC_FIELD_LEN);
+	memcpy(ip + app_addr,     hdr->field[IPV6_APP_PREFIX], SCHC_FIELD_LEN);
+	memcpy(ip + app_addr + 8, hdr->field[IPV6_APPIID],     SCHC_FIELD_LEN);
+
+	memcpy(udp + dev_port, hdr->field[UDP_DEVPORT]  + SCHC_FIELD_LEN - 2, 2);
+	memcpy(udp + app_port, hdr->field[UDP_APPPORT]  + SCHC_FIELD_LEN - 2, 2);
+	memcpy(udp + 4,        hdr->field[UDP_LENGTH]   + SCHC_FIELD_LEN - 2, 2);
+	memcpy(udp + 6,        hdr->field[UDP_CHECKSUM] + SCHC_FIELD_LEN - 2, 2);
+}
+
+/**
+ * \brief Restores the value of a field from the rule and the
+ * compression residue, the inverse of do_compression_action().
+ *
+ * The fields with COMPUTE_LENGTH or COMPUTE_CHECKSUM are left untouched,
+ * they are computed once the payload is known.
+ *
+ * @return Zero if success, non-zero if error.
+ */
+static int do_decompression_action(const struct schc_ruleset *ruleset,
+		const struct compiled_field *rule_row, struct bit_reader *residue,
+		struct header_fields *hdr)
+{
+	switch (rule_row->CDA) {
+		case NOT_SENT:
+			memcpy(hdr->field[rule_row->fieldid], rule_row->tv, SCHC_FIELD_LEN);
+			return 0;
+
+		case COMPUTE_LENGTH:
+		case COMPUTE_CHECKSUM:
+			return 0;
+
+		case VALUE_SENT:
+			schc_slot_set(hdr->field[rule_row->fieldid],
+					bit_reader_get(residue, rule_row->field_length));
+			return residue->underflow ? -1 : 0;
+
+		case LSB:
+			schc_slot_set(hdr->field[rule_row->fieldid],
+					schc_slot_get(rule_row->tv) |
+					bit_reader_get(residue, rule_row->lsb_bits));
+			return residue->underflow ? -1 : 0;
+
+		case MAPPING_SENT: {
+			const uint8_t *value = mapping_value(ruleset, rule_row->mapping,
+					bit_reader_get(residue,
+						ruleset->mappings[rule_row->mapping].index_bits));
+
+			if (residue->underflow || value == NULL)
+				return -1;
+
+			memcpy(hdr->field[rule_row->fieldid], value, SCHC_FIELD_LEN);
+			return 0;
 		}
+
+		default:
+			break;
 	}
 
 	return -1;
 }
 
-static int check_matching(struct field_description rule_row, struct field_values ipv6_packet)
+/**
+ * \brief Copies len bytes of payload from the SCHC packet to dst and
+ * returns their partial checksum (see checksum.h), in a single pass.
+ */
+static uint32_t copy_payload_sum(struct bit_reader *residue, uint8_t *dst, size_t len)
 {
+	uint32_t sum = 0;
+	size_t i = 0;
+
+	/*
+	 * We go through the accumulator of the reader until it gets empty,
+	 * which only happens if the payload is byte-aligned (or when it is
+	 * all read). From then on we work straight on the buffer.
+	 */
+	for ( ; residue->nbits != 0 && i < len ; i++) {
+		dst[i] = bit_reader_get(residue, 8);
+		sum += (i & 1) ? dst[i] : dst[i] << 8;
+	}
+
+	if (i == len)
+		return sum;
+
+	uint16_t rest = checksum_fold(checksum_copy_partial(dst + i,
+				residue->buf + residue->pos, len - i, 0));
 
+	residue->pos += len - i;
 
-  if (rule_row.MO == IGNORE) {
-    return 1;
-  }
- 
-  if (rule_row.MO == EQUALS) {
-    PRINTLN("check_matching entering");
-
-    PRINT("fieldid: ");
-    PRINTLN(rule_row.fieldid);
-
-	 uint8_t tv[8] = {0};
-    switch (rule_row.fieldid) {
-
-      case IPV6_VERSION:
-        return (atoi(rule_row.tv) == ipv6_packet.ipv6_version);
-      case IPV6_TRAFFIC_CLASS:
-        return (atoi(rule_row.tv) == ipv6_packet.ipv6_traffic_class);
-      case IPV6_FLOW_LABEL:
-        return (atoi(rule_row.tv) == ipv6_packet.ipv6_flow_label);
-      case IPV6_PAYLOAD_LENGTH:
-        return (atoi(rule_row.tv) == ipv6_packet.ipv6_payload_length);
-      case IPV6_NEXT_HEADER:
-        return (atoi(rule_row.tv) == ipv6_packet.ipv6_next_header);
-      case IPV6_HOP_LIMIT:
-        return (atoi(rule_row.tv) == ipv6_packet.ipv6_hop_limit);
-      case IPV6_DEV_PREFIX:
-        string_to_bin(tv, rule_row.tv);
-        // If the field is not equal, we must return error.
-        if (memcmp((void*)&ipv6_packet.ipv6_dev_prefix, (void*)tv, 8) != 0) {
-          return 0;
-        }
-        return 1;
-      case IPV6_DEVIID:
-        string_to_bin(tv, rule_row.tv);
-        // If the field is not equal, we must return error.
-        if (memcmp(ipv6_packet.ipv6_dev_iid, tv, 8) != 0) {
-          return 0;
-        }
-        return 1;
-      case IPV6_APP_PREFIX:
-        string_to_bin(tv, rule_row.tv);
-        // If the field is not equal, we must return error.
-         
-        if (memcmp(ipv6_packet.ipv6_app_prefix, tv, 8) != 0) {
-          return 0;
-        }
-        return 1;
-      case IPV6_APPIID:
-        string_to_bin(tv, rule_row.tv);
-        // If the field is not equal, we must return error.
-        if (memcmp(ipv6_packet.ipv6_app_iid, tv, 8) != 0) {
-          return 0;
-        }
-        return 1;
-      case UDP_DEVPORT:
-        return (atoi(rule_row.tv) == ipv6_packet.udp_dev_port);
-      case UDP_APPPORT:
-        return (atoi(rule_row.tv) == ipv6_packet.udp_app_port);
-      case UDP_LENGTH:
-        return (atoi(rule_row.tv) == ipv6_packet.udp_length);
-      case UDP_CHECKSUM:
-        return (atoi(rule_row.tv) == ipv6_packet.udp_checksum);
-        string_to_bin(tv, rule_row.tv);
-        
-         // If the field is not equal, we must return error.
-         
-          return 0;
-        }
-        return 1;
-				{
-        string_to_bin(tv, rule_row.tv);
-
-        uint8_t tkl = tkl;
-
-        
-         // If the field is not equal, we must return error.
-         
-          return 0;
-        }
-        return 1;
-				}
-				{
-        string_to_bin(tv, rule_row.tv);
-
-        
-        // If the field is not equal, we must return error.
-         
-          return 0;
-        }
-        return 1;
-				}
-      default:
-        break;
-    }
-  }
-
-  PRINTLN("check_matching exit");
-
-  return 0;
+	/*
+	 * If the rest starts at an odd offset, its bytes were paired the
+	 * other way around, so its sum is byte-swapped (RFC 1071).
+	 */
+	rest = ~rest;
+	if (i & 1)
+		rest = (rest << 8) | (rest >> 8);
+
+	return sum + rest;
 }
 
 /**********************************************************************/
@@ -457,99 +720,241 @@ static int check_matching(struct field_description rule_row, struct field_values
 /**********************************************************************/
 
 
-int schc_compress(struct field_values ipv6_packet)
+void schc_ctx_init(struct schc_ctx *ctx, const struct schc_ruleset *ruleset)
+{
+	ctx->ruleset = ruleset;
+	ctx->flows_ruleset = ruleset;
+	ctx->generation = ruleset->generation;
+
+	for (int i = 0 ; i < SCHC_FLOW_CACHE_SIZE ; i++)
+		ctx->flows[i].valid = 0;
+}
+
+int schc_compress(struct schc_ctx *ctx, const uint8_t *ipv6_packet,
+		size_t ipv6_packet_len, enum direction direction,
+		uint8_t *schc_packet, size_t schc_packet_cap,
+		size_t *schc_packet_len)
+{
+	struct header_fields hdr;
+	const struct schc_flow *flow;
+	const struct schc_flow *filled;
+	const struct compiled_rule *rule;
+	struct schc_metrics *m = schc_metrics_get();
+	schc_tick_t start = schc_metrics_start(m);
+
+	SCHC_TRACE2(COMPRESS, ipv6_packet_len, direction);
+
+	if (extract_header_fields(ipv6_packet, ipv6_packet_len, direction, &hdr) != 0) {
+		SCHC_METRIC_ADD(m, compress_errors, 1);
+		return -1;
+	}
+
+	flow_cache_sync(ctx);
+
+	if (compress_lookup(ctx, &hdr, &flow, &rule, &filled) < 0) {
+		/*
+		 * No Rule in the context matched the ipv6_packet.
+		 */
+		SCHC_TRACE1(COMPRESS_NO_RULE, ipv6_packet_len);
+		SCHC_METRIC_ADD(m, compress_errors, 1);
+		return -1;
+	}
+
+	int len = compress_emit(ctx->ruleset, &hdr, flow, rule, schc_packet,
+			schc_packet_cap);
+
+	if (len < 0) {
+		SCHC_METRIC_ADD(m, compress_errors, 1);
+		return -1;
+	}
+
+	*schc_packet_len = len;
+
+	schc_metrics_compressed(m, rule->rule_id, ipv6_packet_len, len);
+	schc_metrics_latency(m, SCHC_LAT_COMPRESS, start, 1);
+
+	SCHC_TRACE_DATA(schc_packet, len);
+
+	return 0;
+}
+
+size_t schc_compress_batch(struct schc_ctx *ctx, const struct schc_buf *ipv6_packets,
+		size_t n, enum direction direction, uint8_t *arena, size_t arena_cap,
+		struct schc_buf *schc_packets)
 {
+	struct header_fields hdr[SCHC_BATCH_LEN];
+	const struct schc_flow *flow[SCHC_BATCH_LEN];
+	const struct compiled_rule *rule[SCHC_BATCH_LEN];
+	int8_t ok[SCHC_BATCH_LEN];
 
-	PRINTLN("schc_compress entering");
+	/*
+	 * A cache entry can be filled again by a later packet of the same
+	 * pass. A packet only copies the header of its entry if the last
+	 * packet that filled it (or tried to) is still the one it saw.
+	 */
+	int8_t filled_by[SCHC_FLOW_CACHE_SIZE];
+	int8_t seen[SCHC_BATCH_LEN];
 
-  //uint8_t schc_packet[SIZE_MTU_IPV6] = {0};
-  uint8_t schc_packet[1280] = {0};
-  size_t  schc_packet_len = 0;
+	size_t used = 0;
+	size_t done = 0;
+	struct schc_metrics *m = schc_metrics_get();
+	schc_tick_t start = schc_metrics_start(m);
 
-  /*
-   * Pointer to the current location of the schc_packet.
-   */
+	flow_cache_sync(ctx);
 
-  /*
-   * We go through all the rules.
-   */
+	for (size_t first = 0 ; first < n ; first += SCHC_BATCH_LEN) {
 
-  int nrules = sizeof(rules) / sizeof(rules[0]);
-  int field_description_size = sizeof(rules[0])/sizeof(struct field_description); 
+		const struct schc_buf *in = ipv6_packets + first;
+		struct schc_buf *out = schc_packets + first;
+		int count = MIN(n - first, (size_t) SCHC_BATCH_LEN);
 
-  for (int i = 0 ; i < nrules ; i++ ) {
+		for (int i = 0 ; i < count ; i++)
+			ok[i] = extract_header_fields(in[i].data, in[i].len, direction,
+						      &hdr[i]) == 0;
 
-    //struct field_description current_rule[22] = {0};
-    struct field_description current_rule[field_description_size];
-    memset(current_rule, 0, field_description_size * sizeof(struct field_description));
-    memcpy(&current_rule, rules[i], sizeof(current_rule));
+		memset(filled_by, -1, sizeof(filled_by));
 
-    /*
-     * number of field_descriptors in the rule.
-     */
-    int rule_rows = sizeof(current_rule) / sizeof(current_rule[0]);
+		for (int i = 0 ; i < count ; i++) {
+			if (!ok[i])
+				continue;
 
-    int rule_matches = 1; /* Guard Condition for the next loop */
+			const struct schc_flow *filled;
 
+			ok[i] = compress_lookup(ctx, &hdr[i], &flow[i], &rule[i], &filled) == 0;
 
-    if (rule_matches == 0) {
-			PRINTLN("schc_compress - rule don't matched :(");
-			schc_packet_len = 0;
-			continue;
+			if (filled != NULL)
+				filled_by[filled - ctx->flows] = i;
+			if (flow[i] != NULL)
+				seen[i] = filled_by[flow[i] - ctx->flows];
 		}
 
-    PRINTLN("schc_compress - rule matched!\n");
-		/*
-		 * At this point, all the MO of the rule returned success, we can
-		 * start writing the schc_packet.
-		 *
-		 * First, we append the Rule ID to the schc_packet
-		 */
-		schc_packet[schc_packet_len] = i;
-		schc_packet_l
-    PRINT("schc_packet_len: ");
-    PRINTLN(schc_packet_len);
-
-	PRINT("schc_packet: ");
-	for (size_t i = 0; i < schc_packet_len; i++){
-		PRINT(schc_packet[i], HEX);
-		PRINT(" ");
+		for (int i = 0 ; i < count ; i++) {
+			int len = -1;
+
+			if (ok[i]) {
+				if (flow[i] != NULL && filled_by[flow[i] - ctx->flows] != seen[i])
+					flow[i] = NULL;
+
+				len = compress_emit(ctx->ruleset, &hdr[i], flow[i], rule[i],
+						arena + used, arena_cap - used);
+			}
+
+			if (len < 0) {
+				out[i].data = NULL;
+				out[i].len = 0;
+				continue;
+			}
+
+			out[i].data = arena + used;
+			out[i].len = len;
+			used += len;
+			done++;
+
+			schc_metrics_compressed(m, rule[i]->rule_id, in[i].len, len);
+		}
 	}
-	PRINTLN("");
 
+	SCHC_METRIC_ADD(m, compress_errors, n - done);
+	schc_metrics_latency(m, SCHC_LAT_COMPRESS, start, done);
 
-  /*
-    * At this point, Compression Ressidue is already in the packet.
-    * We concatenate the app_payload to the packet.
-    */
+	return done;
+}
+
+int schc_decompress(struct schc_ctx *ctx, const uint8_t *schc_packet,
+		size_t schc_packet_len, enum direction direction,
+		uint8_t *ipv6_packet, size_t ipv6_packet_cap,
+		size_t *ipv6_packet_len)
+{
+	struct bit_reader r;
+	struct header_fields hdr;
+	struct compiled_field tmp;
+	struct schc_metrics *m = schc_metrics_get();
+
+	bit_reader_init(&r, schc_packet, schc_packet_len);
+
+	const struct compiled_rule *rule = rule_find(ctx->ruleset, bit_reader_get(&r, 8));
+
+	if (r.underflow || rule == NULL) {
+		SCHC_TRACE1(DECOMPRESS_ERROR, schc_packet_len);
+		SCHC_METRIC_ADD(m, decompress_errors, 1);
+		return -1;
+	}
+
+	SCHC_TRACE2(DECOMPRESS, rule->rule_id, schc_packet_len);
+
+	/*
+	 * The fields not described by the rule get their default value.
+	 */
+	memset(&hdr, 0, sizeof(hdr));
+	schc_slot_set(hdr.field[IPV6_VERSION], 6);
+	schc_slot_set(hdr.field[IPV6_NEXT_HEADER], 17);
+
+	for (int i = 0 ; i < rule->nfields ; i++) {
+		if (do_decompression_action(ctx->ruleset,
+					    rule_field(ctx->ruleset, rule, i, &tmp),
+					    &r, &hdr) != 0) {
+			SCHC_TRACE1(DECOMPRESS_ERROR, schc_packet_len);
+			SCHC_METRIC_ADD(m, decompress_errors, 1);
+			return -1;
+		}
+	}
+
+	/*
+	 * What is left after the residue is the payload. Only the last byte
+	 * of the SCHC packet may be padding, so any incomplete byte is
+	 * discarded.
+	 */
+	size_t payload_len = bit_reader_left(&r) / 8;
+	size_t udp_length = SIZE_UDP + payload_len;
+
+	if (SIZE_IPV6 + udp_length > ipv6_packet_cap) {
+		SCHC_TRACE1(DECOMPRESS_ERROR, schc_packet_len);
+		SCHC_METRIC_ADD(m, decompress_errors, 1);
+		return -1;
+	}
 
+	uint8_t *udp = ipv6_packet + SIZE_IPV6;
+	uint32_t sum = copy_payload_sum(&r, udp + SIZE_UDP, payload_len);
 
-  uint8_t *p = schc_packet + schc_packet_len;
+	for (int i = 0 ; i < rule->nfields ; i++) {
+		const struct compiled_field *row = rule_field(ctx->ruleset, rule, i, &tmp);
 
+		if (row->CDA == COMPUTE_LENGTH)
+			schc_slot_set(hdr.field[row->fieldid], udp_length);
+	}
 
-  schc_packet_len += app_payload_len;
+	write_header_fields(&hdr, direction, ipv6_packet);
 
-	PRINTLN("schc_compression() result: ");
-	PRINT_ARRAY(schc_packet, schc_packet_len);
+	for (int i = 0 ; i < rule->nfields ; i++) {
+		const struct compiled_field *row = rule_field(ctx->ruleset, rule, i, &tmp);
 
+		if (row->CDA != COMPUTE_CHECKSUM || row->fieldid != UDP_CHECKSUM)
+			continue;
 
 		/*
-		 * We have created the SCHC packet, we now go to the Fragmentation
-		 * layer and the packet will be sent to the downlink LPWAN tech by
-		 * the schc_fragmentate() function as a whole SCHC packet, or as a 
-		 * series of fragments.
-		 *
-		 * If schc_fragmentate succeeds, we return succeed. If it fails,
-		 * we return fail.
+		 * The payload is already summed up, we add the IPv6
+		 * pseudo-header and the UDP header (with a zero checksum).
 		 */
-	return schc_fragmentate(schc_packet, schc_packet_len);
+		udp[6] = udp[7] = 0;
 
-  }
+		sum += udp_length + 17;
+		sum = checksum_partial(ipv6_packet + 8, SIZE_IPV6 + SIZE_UDP - 8, sum);
 
-	/*
-	 * No Rule in the context matched the ipv6_packet.
-	 */
-	return -1;
+		uint16_t csum = checksum_fold(sum);
+
+		if (csum == 0)
+			csum = 0xFFFF;
+
+		udp[6] = csum >> 8;
+		udp[7] = csum & 0xFF;
+	}
+
+	*ipv6_packet_len = SIZE_IPV6 + udp_length;
+
+	SCHC_TRACE2(DECOMPRESS_DONE, rule->rule_id, *ipv6_packet_len);
+	SCHC_METRIC_ADD(m, decompressed, 1);
+
+	return 0;
 }
 
 /**********************************************************************/
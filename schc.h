@@ -66,6 +66,7 @@ using namespace std;
 #define SIZE_ETHERNET 14
 #define SIZE_IPV6 40
 #define SIZE_UDP 8
+#define SIZE_MTU_IPV6 1280
 /**
  * This is taken from the LoRaWAN Specification v1.0 Table 17.
  *
@@ -96,6 +97,64 @@ using namespace std;
 #define SCHC_FRG_PAY_LEN 20 /* TODO this value is set for testing, change to something else */
 
 // } Fragmentation/Reassembly
+
+/**
+ * Size in bytes of the binary slot used to store a field value. All the
+ * fields handled by the SCHC C/D fit in 64 bits (the biggest ones are
+ * the IPv6 prefixes and IIDs).
+ */
+#define SCHC_FIELD_LEN 8
+
+/**
+ * Maximum number of rows (field descriptions) of a single rule.
+ */
+#define SCHC_MAX_RULE_FIELDS 23
+
+/**
+ * Entries of the flow cache of every SCHC C/D instance (see struct
+ * schc_flow). Must be a power of two.
+ */
+#ifndef SCHC_FLOW_CACHE_SIZE
+#ifdef __AVR__
+#define SCHC_FLOW_CACHE_SIZE 1
+#else
+#define SCHC_FLOW_CACHE_SIZE 16
+#endif
+#endif
+
+/**
+ * Maximum length of a flow key, in bytes: SCHC_FIELD_LEN per field
+ * that decides the compression. The flows of a rule set with longer
+ * keys are not cached.
+ */
+#ifndef SCHC_FLOW_KEY_LEN
+#ifdef __AVR__
+#define SCHC_FLOW_KEY_LEN (8 * SCHC_FIELD_LEN)
+#else
+#define SCHC_FLOW_KEY_LEN (SCHC_FIELDS_COUNT * SCHC_FIELD_LEN)
+#endif
+#endif
+
+/**
+ * Maximum length of the cached Rule ID and Compression Residue, in
+ * bytes. Longer ones are not cached.
+ */
+#ifndef SCHC_FLOW_HDR_LEN
+#define SCHC_FLOW_HDR_LEN 16
+#endif
+
+/**
+ * Packets taken together by every pass of schc_compress_batch(). Must
+ * be below 128.
+ */
+#ifndef SCHC_BATCH_LEN
+#ifdef __AVR__
+#define SCHC_BATCH_LEN 2
+#else
+#define SCHC_BATCH_LEN 32
+#endif
+#endif
+
 //
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
@@ -109,6 +168,7 @@ extern char *__brkval;
 #endif  // __arm__
 
 #define SCHC_FRG_RULEID 0x80
+#define SCHC_FRG_ACK_RULEID 0x81 /* ACK-on-Error fragments and ACKs */
 
 #ifndef UTIL_H
 #define UTIL_H
@@ -150,6 +210,9 @@ enum MO {
 
 // SCHC draft 10, section 9
 enum fieldid {
+	IPV6_VERSION,
+	IPV6_TRAFFIC_CLASS,
+	IPV6_FLOW_LABEL,
 	IPV6_PAYLOAD_LENGTH,
 	IPV6_NEXT_HEADER,
 	IPV6_HOP_LIMIT,
@@ -165,6 +228,11 @@ enum fieldid {
 
 };
 
+/**
+ * Number of different header fields known by the SCHC C/D.
+ */
+#define SCHC_FIELDS_COUNT (UDP_CHECKSUM + 1)
+
 // SCHC draft 10, section 6.1
 enum direction {
 	UPLINK,
@@ -193,36 +261,98 @@ struct field_description {
 	char *tv;
 	enum MO MO;
 	enum CDA CDA;
+	int msb_length; /** x of MSB(x), in bits, only for MSB */
+};
+
+/**
+ * \brief A rule row once compiled by schc_compile_rules().
+ *
+ * The Target Value is parsed only once and stored as binary, in network
+ * byte order, right-aligned in a slot of SCHC_FIELD_LEN bytes. This way
+ * the matching operators are a plain memcmp() against the same field of
+ * the struct header_fields, no matter the type of the field.
+ *
+ * For MSB the TV keeps only its most significant bits, the rest are
+ * zero. For MATCH_MAPPING the TV is not used, the list of values is
+ * compiled into a mapping of the rule set (see context.h).
+ */
+struct compiled_field {
+	uint8_t fieldid;
+	uint8_t field_length; /** Length in bits */
+	uint8_t direction;
+	uint8_t MO;
+	uint8_t CDA;
+	uint8_t lsb_bits; /** MSB: bits not matched, the ones sent by LSB */
+	uint8_t mapping;  /** MATCH_MAPPING: mapping of the rule set */
+	uint8_t tv[SCHC_FIELD_LEN];
+};
+
+/**
+ * \brief A compiled rule. Its rows are not in the struct, they are read
+ * with rule_field() (see context.h), from RAM or from flash.
+ */
+struct compiled_rule {
+	uint8_t rule_id;
+	uint8_t nfields; /** Number of rows */
+	uint16_t residue_bits; /** Compression Residue length, in bits */
+	uint16_t first; /** Position of the first row in the rule set */
 };
 
-struct field_values {
-	uint8_t ipv6_version;
-	uint8_t ipv6_traffic_class;
-	uint32_t ipv6_flow_label;
-	size_t ipv6_payload_length;
-	uint8_t ipv6_next_header;
-	uint8_t ipv6_hop_limit;
-	uint8_t ipv6_dev_prefix[8];
-	uint8_t ipv6_dev_iid[8];
-	uint8_t ipv6_app_prefix[8];
-	uint8_t ipv6_app_iid[8];
-
-	uint16_t udp_dev_port;
-	uint16_t udp_app_port;
-	size_t udp_length;
-	uint16_t udp_checksum;
-	
-	// TODO: consider what to do with this field
-	//uint8_t payload[SIZE_MTU_IPV6]; 
+/**
+ * \brief The header fields of a packet, extracted once per packet in the
+ * same binary layout as compiled_field.tv.
+ *
+ * field[] is indexed by enum fieldid.
+ */
+struct header_fields {
+	uint8_t field[SCHC_FIELDS_COUNT][SCHC_FIELD_LEN];
 
+	const uint8_t *payload;
+	size_t payload_len;
 };
 
+struct schc_ruleset;
 
-typedef struct schc_fragment_s {
+/**
+ * \brief A flow already compressed by an instance.
+ *
+ * The key holds the values of every field that some rule matches or
+ * sends (see schc_ruleset.flow_fields). Two packets with the same key
+ * select the same rule and get the same Compression Residue, so a
+ * packet of a known flow is compressed by copying hdr and its payload.
+ */
+struct schc_flow {
+	uint8_t valid;
 	uint8_t rule_id;
-	uint8_t fcn;
-	uint8_t payload[SCHC_FRG_PAY_LEN];
-} schc_fragment;
+	uint16_t hdr_bits;              /** Rule ID and Compression Residue */
+	uint8_t hdr[SCHC_FLOW_HDR_LEN];
+	uint8_t key[SCHC_FLOW_KEY_LEN];
+};
+
+/**
+ * \brief A packet given to or returned by schc_compress_batch().
+ */
+struct schc_buf {
+	const uint8_t *data;
+	size_t len;
+};
+
+/**
+ * \brief A SCHC C/D instance.
+ *
+ * The compiled rules are shared, read-only, by all the instances using
+ * them (see context.h). Everything an instance writes is in its own
+ * struct, so each thread can run its own instance without locking. An
+ * instance must not be used by two threads at the same time.
+ */
+struct schc_ctx {
+	const struct schc_ruleset *ruleset;        /** May be changed at any time */
+	const struct schc_ruleset *flows_ruleset;  /** The one the flows were cached with */
+	uint32_t generation; /** Of flows_ruleset when the flows were cached */
+	struct schc_flow flows[SCHC_FLOW_CACHE_SIZE];
+};
+
+
 
 
 /**********************************************************************/
@@ -231,24 +361,148 @@ typedef struct schc_fragment_s {
 
 int string_to_bin(uint8_t dst[8], const char *src);
 
+/**
+ * \brief Stores the lowest SCHC_FIELD_LEN bytes of value into slot, in
+ * network byte order.
+ */
+static inline void schc_slot_set(uint8_t slot[SCHC_FIELD_LEN], uint64_t value)
+{
+	for (int i = SCHC_FIELD_LEN - 1 ; i >= 0 ; i--) {
+		slot[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+/**
+ * \brief Reads back a value stored with schc_slot_set().
+ */
+static inline uint64_t schc_slot_get(const uint8_t slot[SCHC_FIELD_LEN])
+{
+	uint64_t value = 0;
+
+	for (int i = 0 ; i < SCHC_FIELD_LEN ; i++)
+		value = (value << 8) | slot[i];
+
+	return value;
+}
+
+/**
+ * \brief Initializes a SCHC C/D instance using the given rule set.
+ *
+ * The instance caches the flows it compresses. The cache is flushed
+ * whenever the rule set is compiled again, or ctx->ruleset is set to
+ * another rule set.
+ */
+void schc_ctx_init(struct schc_ctx *ctx, const struct schc_ruleset *ruleset);
+
 /**
  * \brief Applies the SCHC compression procedure as detailed in
- * draft-ietf-lpwan-ipv6-static-context-hc-10 and, in case of success,
- * sends the SCHC Packet or derived SCHC Fragments though the downlink.
+ * draft-ietf-lpwan-ipv6-static-context-hc-10 to an IPv6/UDP packet.
+ *
+ * The header fields are read straight from the wire bytes of
+ * ipv6_packet, and the SCHC Packet (Rule ID, Compression Residue and
+ * payload) is written straight to schc_packet. Nothing else is copied.
+ *
+ * \note In case of failure or not matching any SCHC Rule, nothing is
+ * written to schc_packet_len and the packet should be discarded.
+ *
+ * @param [in] ctx The instance, with the rules to use.
  *
- * \note In case of failure or not matching any SCHC Rule, the packet is
- * silently discarded and is not sent through the downlink.
+ * @param [in] ipv6_packet The original IPv6 packet received from the
+ * ipv6 interface, starting at the IPv6 header. Only UDP is supported.
  *
- * @param [in] ipv6_pcaket The original IPv6 packet received from
- * the ipv6 interface. It will be used to apply a SCHC rule and generate
- * a compressed IPv6 Packet.
+ * @param [in] ipv6_packet_len Length of ipv6_packet, in bytes.
+ *
+ * @param [in] direction UPLINK if the packet goes from the device to the
+ * application (the device is the source of the packet), DOWNLINK
+ * otherwise.
+ *
+ * @param [out] schc_packet Caller-owned buffer where the SCHC Packet is
+ * written.
+ *
+ * @param [in] schc_packet_cap Size of schc_packet, in bytes.
+ *
+ * @param [out] schc_packet_len Length of the SCHC Packet written.
  *
  * @return 0 if successfull, non-zero if there was an error.
  */
-int schc_compress(struct field_values ipv6_packet);
+int schc_compress(struct schc_ctx *ctx, const uint8_t *ipv6_packet,
+		size_t ipv6_packet_len, enum direction direction,
+		uint8_t *schc_packet, size_t schc_packet_cap,
+		size_t *schc_packet_len);
 
-/*
- * TODO comment
+/**
+ * \brief Same as schc_compress(), for n packets at once.
+ *
+ * The packets are taken SCHC_BATCH_LEN at a time, and every step is
+ * done for all of them before the next one: the header fields are
+ * extracted, then the rules are looked for, then the SCHC Packets are
+ * written. Each loop runs the same code over and over, which keeps it
+ * and its data in the caches and its branches predicted.
+ *
+ * The SCHC Packets are written one after the other in arena, and
+ * schc_packets[i] points to the one of ipv6_packets[i]. If a packet
+ * could not be compressed, schc_packets[i] is NULL with length 0, and
+ * the rest are still compressed.
+ *
+ * @param [in] ctx The instance, with the rules to use.
+ *
+ * @param [in] ipv6_packets The n IPv6 packets, as in schc_compress().
+ *
+ * @param [in] n Number of packets.
+ *
+ * @param [in] direction The direction of all the packets.
+ *
+ * @param [out] arena Caller-owned buffer where the SCHC Packets are
+ * written.
+ *
+ * @param [in] arena_cap Size of arena, in bytes.
+ *
+ * @param [out] schc_packets The n SCHC Packets, inside arena.
+ *
+ * @return The number of packets compressed.
+ */
+size_t schc_compress_batch(struct schc_ctx *ctx, const struct schc_buf *ipv6_packets,
+		size_t n, enum direction direction, uint8_t *arena, size_t arena_cap,
+		struct schc_buf *schc_packets);
+
+/**
+ * \brief Rebuilds the original IPv6/UDP packet from a SCHC Packet, as
+ * detailed in draft-ietf-lpwan-ipv6-static-context-hc-10.
+ *
+ * The same compiled rules used by schc_compress() are used. The fields
+ * with COMPUTE_LENGTH and COMPUTE_CHECKSUM are computed while the
+ * payload is copied, in a single pass.
+ *
+ * @param [in] ctx The instance, with the rules to use.
+ *
+ * @param [in] schc_packet The SCHC Packet, starting with the Rule ID.
+ *
+ * @param [in] schc_packet_len Length of schc_packet, in bytes.
+ *
+ * @param [in] direction UPLINK if the packet was sent by the device,
+ * DOWNLINK otherwise.
+ *
+ * @param [out] ipv6_packet Caller-owned buffer where the IPv6 packet is
+ * written.
+ *
+ * @param [in] ipv6_packet_cap Size of ipv6_packet, in bytes.
+ *
+ * @param [out] ipv6_packet_len Length of the IPv6 packet written.
+ *
+ * @return 0 if successfull, non-zero if there was an error (unknown
+ * Rule ID, truncated residue, unsupported CDA or ipv6_packet too small).
+ */
+int schc_decompress(struct schc_ctx *ctx, const uint8_t *schc_packet,
+		size_t schc_packet_len, enum direction direction,
+		uint8_t *ipv6_packet, size_t ipv6_packet_cap,
+		size_t *ipv6_packet_len);
+
+/**
+ * \brief Handles a downlink LoRaWAN payload: a SCHC packet, or a SCHC
+ * Fragment, which is reassembled (see reassembly.h).
+ *
+ * @return 0 if successfull, non-zero if the payload was dropped.
  */
 int schc_reassemble(uint8_t *lorawan_payload, uint8_t lorawan_payload_len);
 
@@ -12,48 +12,17 @@
 
 #include "context.h"
 #include "schc.h" 
+#include "fragment.h"
+#include "reassembly.h"
+#include "timer.h"
+#include "metrics.h"
+#include "trace.h"
 #include "lorawan.h" 
 
 /**********************************************************************/
 /***        Macro Definitions                                       ***/
 /**********************************************************************/
 
-
-
-// #define DEBUG
-
-#ifdef DEBUG
-
-	#warning "DEBUG MODE ACTIVATED!"
-
-	#define PRINT(...) Serial.print(__VA_ARGS__)
-	#define PRINTLN(...) Serial.println(__VA_ARGS__)
-	#define PRINT_ARRAY(add, len) \
-	do { \
-		int i; \
-		for (i = 0 ; i < (len) ; i++) { \
-			if (i % 10 == 0) \
-				Serial.println(); \
-			if (i % 50 == 0) \
-				Serial.println(); \
-			Serial.print((((uint8_t*)(add))[i]), HEX); \
-			Serial.print(" "); \
-		} \
-		Serial.println(); \
-	} while(0)
-
-#else /* DEBUG */
-
-	#define PRINT(...)
-	#define PRINTLN(...)
-	#define PRINT_ARRAY(add, len)
-
-#endif /* DEBUG */
-
-
-
-
-
 /*
  * Arduino loop() state machine
  */
@@ -82,17 +51,60 @@
 // 1098 Bytes == SCHC RuleID + 1097 Bytes of payload.
 char lorem[] = /* UDP payload */ "hola mundo";
 
+/*
+ * IPv6/UDP header of the uplink packets. The lengths are filled in
+ * before compressing, the payload is lorem[].
+ */
+const uint8_t ipv6_udp_header[SIZE_IPV6 + SIZE_UDP] = {
+	0x60, 0x00, 0x00, 0x00,                         // Version, Traffic Class, Flow Label
+	0x00, 0x00, 0x11, 0x40,                         // Payload Length, Next Header, Hop Limit
+	0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // Source (device) prefix
+	0x08, 0x00, 0x27, 0xff, 0xfe, 0x00, 0x00, 0x00, // Source (device) IID
+	0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // Destination (application) prefix
+	0x0a, 0x00, 0x27, 0xff, 0xfe, 0x65, 0x65, 0x50, // Destination (application) IID
+	0xe7, 0xdb, 0x16, 0x33,                         // UDP ports: 59355 -> 5683
+	0x00, 0x00, 0x00, 0x00,                         // UDP Length, Checksum
+};
+
 
 /**********************************************************************/
 /***        Static Variables                                        ***/
 /**********************************************************************/
 
 
+// SCHC Compression {
+
+static struct schc_ruleset ruleset;
+static struct schc_ctx schc;
+
+/*
+ * The uplink packet is built in ipv6_packet and compressed in
+ * schc_packet, both sized for lorem[] (its NUL makes room for the Rule
+ * ID). schc_packet is kept until it is sent, but ipv6_packet is only
+ * used by schc_compress(), so the downlink packets are decompressed in
+ * it too: it also holds DOWNLINK_IPV6_LEN bytes, the longest IPv6
+ * packet a single LoRaWAN frame can bring. A longer one, reassembled
+ * from fragments, is dropped.
+ */
+#define UPLINK_IPV6_LEN   (sizeof(ipv6_udp_header) + sizeof(lorem))
+#define DOWNLINK_IPV6_LEN (SIZE_IPV6 + SIZE_UDP + MAX_LORAWAN_PKT_LEN)
+
+static uint8_t ipv6_packet[MAX(UPLINK_IPV6_LEN, DOWNLINK_IPV6_LEN)];
+static uint8_t schc_packet[UPLINK_IPV6_LEN];
+static size_t schc_packet_len = 0;
+
+// }
+
 // SCHC Fragmentation/Reassembly {
 
-static uint8_t fcn_current = 0;
-static uint8_t schc_reassemble_buf[SIZE_MTU_IPV6] = {0};
-static uint8_t schc_reassemble_offset = {0};
+static struct schc_reass reass;
+
+/*
+ * The uplink packets longer than a LoRaWAN frame are sent with
+ * ACK-on-Error, one at a time, with a new DTag each.
+ */
+static struct schc_aoe_session uplink;
+static uint8_t uplink_dtag = 0;
 
 // }
 
@@ -105,27 +117,35 @@ static uint8_t schc_reassemble_offset = {0};
  */
 static int ask_next_fragment = 0;
 
-// Research tests counters, only useful when running tests applications.
-// Not needed for the operation of the SCHC logic.
-// {
-static int long_packet_tx_counter          = 0;
-static int short_packet_tx_counter         = 0;
-static int rx_packet_counter               = 0;
-static int mac_tx_error_counter            = 0; // If mac tx returns something different from mac_tx_ok.
-static int duplicated_packet_counter       = 0;
-static int schc_reassemble_success_counter = 0;
-static int schc_reassemble_fail_counter    = 0;
-static int rx_len_was_zero_counter         = 0;
-static int ipv6_packet_sent_counter        = 0; // Increased Everytime we send the whole "lorem[]" payload.
-// }
+/*
+ * Counters of the SCHC operations, printed to the Serial port every
+ * print_metrics_interval millis.
+ */
+static struct schc_metrics metrics;
+static uint32_t print_metrics_interval = 60000;
+
+#ifdef SCHC_TRACE
+/*
+ * Trace of the last SCHC operations, sent in binary to the Serial port
+ * when a 't' is received. extras/trace/schc_trace decodes it.
+ */
+static struct schc_trace trace;
+#endif
 
 /*
  * Arduino loop() state machine
  */
 
-static uint32_t generate_uplink_schc_packet = 0; // Last time an uplink packet was generated
 static uint32_t generate_uplink_schc_packet_interval = 15000; // Send a packet each n millis.
 
+/*
+ * Timers, in millis(): the reassembly inactivity timers, the uplink
+ * retransmission timer and the uplink packet generation.
+ */
+static struct schc_wheel timers;
+static struct schc_timer generate_uplink_schc_packet;
+static struct schc_timer print_metrics;
+
 
 static int arduino_loop_state = LOOP_SEND_PACKET;
 
@@ -133,6 +153,68 @@ static int arduino_loop_state = LOOP_SEND_PACKET;
 /***        Static Functions                                        ***/
 /**********************************************************************/
 
+/*
+ * schc_fragmentate() sink: sends every SCHC Fragment (or the whole SCHC
+ * packet) in its own LoRaWAN frame.
+ */
+static int lorawan_sink(const uint8_t *frag, size_t frag_len, void *arg)
+{
+	(void) arg;
+
+	if (frag_len > sizeof(tx_buff)) {
+		return -1;
+	}
+
+	memcpy(tx_buff, frag, frag_len);
+	tx_buff_len = frag_len;
+	lorawan_send();
+
+	return 0;
+}
+
+/*
+ * schc_reass_input() sinks: the SCHC ACKs go back to the gateway like
+ * any other uplink frame, and the SCHC packets are decompressed.
+ */
+static int lorawan_ack_sink(uint64_t device, const uint8_t *ack, size_t ack_len,
+		void *arg)
+{
+	(void) device;
+
+	return lorawan_sink(ack, ack_len, arg);
+}
+
+/*
+ * struct schc_aoe_session callback, once the gateway has the uplink
+ * packet or the session gave up.
+ */
+static void uplink_done(struct schc_aoe_session *session, int status, void *arg)
+{
+	(void) session;
+	(void) arg;
+
+	if (status != SCHC_AOE_DONE)
+		Serial.println("Error sending the SCHC packet");
+}
+
+static int downlink_sink(uint64_t device, const uint8_t *schc_packet,
+		size_t len, void *arg)
+{
+	size_t ipv6_packet_len;
+
+	(void) device;
+	(void) arg;
+
+	if (schc_decompress(&schc, schc_packet, len, DOWNLINK, ipv6_packet,
+			    sizeof(ipv6_packet), &ipv6_packet_len) != 0) {
+		Serial.println("Error decompressing the SCHC packet");
+		return -1;
+	}
+
+	SCHC_TRACE_DATA(ipv6_packet, ipv6_packet_len);
+
+	return 0;
+}
 
 
 
@@ -142,6 +224,65 @@ static int arduino_loop_state = LOOP_SEND_PACKET;
 /**********************************************************************/
 
 
+static void generate_uplink_schc_packet_cb(struct schc_timer *timer, void *arg)
+{
+	(void) arg;
+
+	arduino_loop_state = LOOP_SEND_PACKET;
+	schc_timer_add(&timers, timer, generate_uplink_schc_packet_interval);
+}
+
+static int serial_sink(const char *line, void *arg)
+{
+	(void) arg;
+
+	Serial.println(line);
+
+	return 0;
+}
+
+static void print_metrics_cb(struct schc_timer *timer, void *arg)
+{
+	(void) arg;
+
+	schc_metrics_export(&metrics, serial_sink, NULL);
+	schc_timer_add(&timers, timer, print_metrics_interval);
+}
+
+#ifdef SCHC_TRACE
+static int serial_write_sink(const uint8_t *data, size_t len, void *arg)
+{
+	(void) arg;
+
+	Serial.write(data, len);
+
+	return 0;
+}
+#endif
+
+int schc_reassemble(uint8_t *lorawan_payload, uint8_t lorawan_payload_len)
+{
+	/*
+	 * While the uplink packet waits for its SCHC ACK, the short
+	 * ACK-on-Error frames with its DTag are that SCHC ACK.
+	 */
+	if (schc_aoe_session_busy(&uplink) && lorawan_payload_len <= SCHC_ACK_MAX_LEN &&
+	    lorawan_payload_len >= SCHC_AOE_HDR_LEN &&
+	    lorawan_payload[0] == SCHC_FRG_ACK_RULEID &&
+	    lorawan_payload[1] == uplink.sender.dtag) {
+		schc_aoe_session_ack(&uplink, lorawan_payload, lorawan_payload_len);
+		return 0;
+	}
+
+	/* The only sender of the downlink packets is the gateway */
+	int ret = schc_reass_input(&reass, 0, lorawan_payload, lorawan_payload_len,
+			downlink_sink, lorawan_ack_sink, NULL);
+
+	ask_next_fragment = (ret == SCHC_REASS_PENDING);
+
+	return ret == SCHC_REASS_ERROR;
+}
+
 int freeRam () {
   extern int __heap_start, *__brkval; 
   int v; 
@@ -160,17 +301,30 @@ void setup() {
 	while(!Serial)
 		 ;
 
-  
-uint8_t payload[] = {0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46, 0x11, 0xff, 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, // IPv6 header
-                        0x27, 0xff, 0xfe, 0x00, 0x00, 0x00, 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0xf0,
-                        0x08, 0xda, 0x05, 0xcb, 0xe1, 0x9a,
-                        0xe7, 0xdb, 0x16, 0x33, 0x00, 0x46, 0xb2, 0x98, // UDP Header
-                        0x42, 0x02, 0x19, 0xeb, 0x4d, 0x6a, 0xb7, 0x73, 0x74, 0x6f, 0x72, 0x61, 0x67, 0x65, 0xff, // CoAP header
-                        0x31, 0x30, 0x30, // Payload
-                        0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
-                        0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
-                        0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
-                        0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31}; // 111 B 
+
+	/*
+	 * The rules are parsed only once, schc_compress() uses the
+	 * compiled ones.
+	 */
+	if (schc_compile_rules(&ruleset) != 0)
+		Serial.println("Error compiling the SCHC rules");
+	schc_ctx_init(&schc, &ruleset);
+
+	schc_metrics_init(&metrics);
+	schc_metrics_attach(&metrics);
+#ifdef SCHC_TRACE
+	schc_trace_attach(&trace);
+#endif
+
+	schc_wheel_init(&timers, millis());
+	schc_reass_init(&reass, &timers);
+	schc_aoe_session_init(&uplink, &timers, lorawan_sink, uplink_done, NULL);
+	schc_timer_init(&generate_uplink_schc_packet,
+			generate_uplink_schc_packet_cb, NULL);
+	schc_timer_add(&timers, &generate_uplink_schc_packet,
+		       generate_uplink_schc_packet_interval);
+	schc_timer_init(&print_metrics, print_metrics_cb, NULL);
+	schc_timer_add(&timers, &print_metrics, print_metrics_interval);
 
 	lorawan_setup();
 }
@@ -178,7 +332,12 @@ uint8_t payload[] = {0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46, 0x11, 0xff, 0xfe,
 
 void loop() {
 
-	uint32_t current_millis = millis(); // Current timestamp
+	schc_wheel_advance(&timers, millis());
+
+#ifdef SCHC_TRACE
+	if (Serial.available() > 0 && Serial.read() == 't')
+		schc_trace_dump(&trace, serial_write_sink, NULL);
+#endif
 
 	/*
 	 * Arduino Specific Code
@@ -193,72 +352,30 @@ void loop() {
 			//Init pana state machine
 			Serial.println("Generating SCHC packet");
 
-		  struct field_values udpIp6_packet;
-
-		  // Ipv6 header fields 
-		  udpIp6_packet.ipv6_version = 6;
-		  udpIp6_packet.ipv6_traffic_class = 0;
-		  udpIp6_packet.ipv6_flow_label = 0;
-		  udpIp6_packet.ipv6_payload_length = 0; // Nwk to host
-		  udpIp6_packet.ipv6_next_header = 17;
-		  udpIp6_packet.ipv6_hop_limit = 64;
-		  // Udp header fields
-		  //udpIp6_packet.udp_dev_port = 59355; // Nwk to host
-		  udpIp6_packet.udp_dev_port = 0xE7DB;
-		  //udpIp6_packet.udp_app_port = 5683; // Nwk to host
-		  udpIp6_packet.udp_app_port = 0x1633;
-		  udpIp6_packet.udp_length = 0; // Nwk to host, length includes header
-		  udpIp6_packet.udp_checksum = 0;
-		  // Coap header fields
-		  udpIp6_packet.coap_version = 1;
-			udpIp6_packet.coap_type = 0;
-			udpIp6_packet.coap_tkl = 2;
-			udpIp6_packet.coap_code = 2;
-			udpIp6_packet.coap_message_id[0] = 0;
-			udpIp6_packet.coap_message_id[1] = 0;
-		  //udpIp6_packet.coap_token = token;
-		  uint8_t token[16] = "ab3456789123456";
-		  for (size_t i = 0; i < 16; i++)
-			 udpIp6_packet.coap_token[i] = token[i];
-		  udpIp6_packet.coap_option_delta = 11;
-		  udpIp6_packet.coap_option_length = 7;
-		  //udpIp6_packet.coap_option_value = value;
-		  uint8_t value[16] = "storage";
-		  for (size_t i = 0; i < 16; i++)
-			 udpIp6_packet.coap_option_value[i] = value[i];
-			udpIp6_packet.coap_payload_length = strlen(lorem);
-			PRINTLN(udpIp6_packet.coap_payload_length);
-			PRINTLN(lorem);
-			memcpy(udpIp6_packet.coap_payload, lorem, strlen(lorem));
-
-
-			/* -----*/
-			string_to_bin(udpIp6_packet.ipv6_dev_prefix, "fe80000000000000");
-			string_to_bin(udpIp6_packet.ipv6_dev_iid,    "080027fffe000000");
-			string_to_bin(udpIp6_packet.ipv6_app_prefix, "fe80000000000000");
-			string_to_bin(udpIp6_packet.ipv6_app_iid,    "0a0027fffe656550");
-
-
-
-		//  IP addresses
-		//  for (int i = 0; i < 8; i++){
-		//    udpIp6_packet.ipv6_dev_prefix[i] = 1;
-		//  }
-		//  for (int i = 8; i < 16; i++){
-		//    udpIp6_packet.ipv6_dev_iid[i-8] = 1;
-		//  }
-		//  for (int i = 0; i < 8; i++){
-		//    udpIp6_packet.ipv6_app_prefix[i] = 1;
-		//  }
-		//  for (int i = 8; i < 16; i++){
-		//    udpIp6_packet.ipv6_app_iid[i-8] = 1;
-		//  }
-
-
-
-
-
-		  schc_compress(udpIp6_packet);
+			size_t lorem_len = strlen(lorem);
+			size_t ipv6_packet_len = sizeof(ipv6_udp_header) + lorem_len;
+			size_t length = SIZE_UDP + lorem_len;
+
+			/* schc_packet is still being sent */
+			if (schc_aoe_session_busy(&uplink) ||
+			    ipv6_packet_len > sizeof(ipv6_packet)) {
+				arduino_loop_state = LOOP_IDLE;
+				break;
+			}
+
+			memcpy(ipv6_packet, ipv6_udp_header, sizeof(ipv6_udp_header));
+			ipv6_packet[4] = ipv6_packet[SIZE_IPV6 + 4] = length >> 8;   // IPv6 payload length
+			ipv6_packet[5] = ipv6_packet[SIZE_IPV6 + 5] = length & 0xFF; // and UDP length
+			memcpy(&ipv6_packet[sizeof(ipv6_udp_header)], lorem, lorem_len);
+
+			if (schc_compress(&schc, ipv6_packet, ipv6_packet_len, UPLINK,
+					  schc_packet, sizeof(schc_packet), &schc_packet_len) == 0) {
+				if (schc_packet_len <= MAX_SCHC_PKT_LEN)
+					schc_fragmentate(schc_packet, schc_packet_len, lorawan_sink, NULL);
+				else
+					schc_aoe_session_send(&uplink, schc_packet,
+							      schc_packet_len, uplink_dtag++);
+			}
 
 			//generar y enviar el paquete
 
@@ -268,12 +385,7 @@ void loop() {
 			}
 
 		case LOOP_IDLE:
-
-			if (current_millis - generate_uplink_schc_packet >= generate_uplink_schc_packet_interval) {
-				arduino_loop_state = LOOP_SEND_PACKET;
-				generate_uplink_schc_packet = current_millis;
-			}
-
+			// generate_uplink_schc_packet_cb() leaves this state
 			break;
 	}
                         
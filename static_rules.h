@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef STATIC_RULES_H
+#define STATIC_RULES_H
+
+/**
+ * \file
+ *
+ * \brief Rules known at build time, compiled into straight-line code.
+ *
+ * schc_compress() interprets the compiled rules: for every row it looks
+ * at the Matching Operator and at the CDA. When the rules are fixed in
+ * the firmware they can instead be given as template parameters, and
+ * the compiler generates for every rule its own matcher and residue
+ * writer, with the fields read at fixed offsets of the wire bytes and
+ * no branch on the field type, the MO or the CDA. The CDAs not used by
+ * any rule are not compiled at all.
+ *
+ * For instance:
+ *
+ * \verbatim
+ * typedef schc_static_rule<
+ *         SCHC_STATIC_ROW(IPV6_VERSION,         4, BI, 6,      EQUALS, NOT_SENT,       0),
+ *         ...
+ *         SCHC_STATIC_ROW(UDP_DEVPORT,         16, BI, 0xE700, MSB,    LSB,            8),
+ *         SCHC_STATIC_ROW(UDP_LENGTH,          16, BI, 0,      IGNORE, COMPUTE_LENGTH, 0)
+ * > rule1;
+ *
+ * typedef schc_static_ruleset<rule0, rule1> my_rules;
+ *
+ * my_rules::compress(ipv6_packet, len, UPLINK, schc_packet, cap, &schc_packet_len);
+ * \endverbatim
+ *
+ * The Rule ID of a rule is its position in the rule set, and the rule
+ * selected is the same schc_compress() would select with the same rules
+ * (see schc_static_ruleset::compile()), so the other end decompresses
+ * with schc_decompress() as usual.
+ *
+ * \note MATCH_MAPPING and MAPPING_SENT need the mapping lists of a
+ * struct schc_ruleset, they are not supported here. The flow cache is
+ * not used either: a static rule is already cheaper than a lookup.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "schc.h"
+#include "context.h"
+#include "bitbuf.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * \brief A static row, with the same columns as SCHC_ROW().
+ */
+#define SCHC_STATIC_ROW(fieldid, field_length, direction, tv, MO, CDA, arg) \
+	schc_static_row<fieldid, field_length, direction, (uint64_t) (tv), MO, CDA, arg>
+
+/**********************************************************************/
+/***        Inline Functions                                        ***/
+/**********************************************************************/
+
+/**
+ * \brief Reads a big-endian value of n bytes from the wire.
+ */
+static inline uint64_t static_wire_get(const uint8_t *p, int n)
+{
+	uint64_t value = 0;
+
+	for (int i = 0 ; i < n ; i++)
+		value = (value << 8) | p[i];
+
+	return value;
+}
+
+/**
+ * \brief Reads field FIELDID of an IPv6/UDP packet going in DIRECTION,
+ * the same value extract_header_fields() stores in its slot.
+ *
+ * Both are constants, so only the code of one case is left.
+ */
+template <int DIRECTION, int FIELDID>
+static inline uint64_t static_field_get(const uint8_t *ip)
+{
+	const uint8_t *udp = ip + SIZE_IPV6;
+	const int dev_addr = (DIRECTION == DOWNLINK) ? 24 : 8;
+	const int app_addr = (DIRECTION == DOWNLINK) ? 8 : 24;
+	const int dev_port = (DIRECTION == DOWNLINK) ? 2 : 0;
+	const int app_port = (DIRECTION == DOWNLINK) ? 0 : 2;
+
+	switch (FIELDID) {
+		case IPV6_VERSION:        return ip[0] >> 4;
+		case IPV6_TRAFFIC_CLASS:  return static_wire_get(ip, 2) >> 4 & 0xFF;
+		case IPV6_FLOW_LABEL:     return static_wire_get(ip + 1, 3) & 0xFFFFF;
+		case IPV6_PAYLOAD_LENGTH: return static_wire_get(ip + 4, 2);
+		case IPV6_NEXT_HEADER:    return ip[6];
+		case IPV6_HOP_LIMIT:      return ip[7];
+		case IPV6_DEV_PREFIX:     return static_wire_get(ip + dev_addr, 8);
+		case IPV6_DEVIID:         return static_wire_get(ip + dev_addr + 8, 8);
+		case IPV6_APP_PREFIX:     return static_wire_get(ip + app_addr, 8);
+		case IPV6_APPIID:         return static_wire_get(ip + app_addr + 8, 8);
+		case UDP_DEVPORT:         return static_wire_get(udp + dev_port, 2);
+		case UDP_APPPORT:         return static_wire_get(udp + app_port, 2);
+		case UDP_LENGTH:          return static_wire_get(udp + 4, 2);
+		default:                  return static_wire_get(udp + 6, 2);
+	}
+}
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * \brief A rule row known at build time, see SCHC_STATIC_ROW().
+ */
+template <int FIELDID, int FIELD_LENGTH, int DIRECTION, uint64_t TV,
+	  int MO, int CDA, int ARG>
+struct schc_static_row {
+	static_assert(FIELDID >= 0 && FIELDID < SCHC_FIELDS_COUNT, "unknown field");
+	static_assert(FIELD_LENGTH > 0 && FIELD_LENGTH <= 64, "bad Field Length");
+	static_assert(FIELD_LENGTH == 64 || (TV >> (FIELD_LENGTH % 64)) == 0,
+		      "the TV does not fit in the Field Length");
+	static_assert(MO == EQUALS || MO == IGNORE || MO == MSB,
+		      "MATCH_MAPPING is not supported by static rules");
+	static_assert(MO != MSB || ARG <= FIELD_LENGTH, "bad x of MSB(x)");
+	static_assert(CDA == NOT_SENT || CDA == VALUE_SENT ||
+		      CDA == COMPUTE_LENGTH || CDA == COMPUTE_CHECKSUM ||
+		      (CDA == LSB && MO == MSB), "CDA not supported by static rules");
+
+	/** Bits not matched by MSB, the ones sent by LSB */
+	static const int lsb_bits = (MO == MSB) ? FIELD_LENGTH - ARG : 0;
+
+	static const int residue_bits = (CDA == VALUE_SENT) ? FIELD_LENGTH :
+					(CDA == LSB) ? lsb_bits : 0;
+
+	template <int D>
+	static inline int match(const uint8_t *ip)
+	{
+		if (MO == IGNORE)
+			return 1;
+
+		uint64_t diff = static_field_get<D, FIELDID>(ip) ^ TV;
+
+		if (MO == MSB)
+			return lsb_bits == 64 || (diff >> (lsb_bits % 64)) == 0;
+
+		return diff == 0;
+	}
+
+	template <int D>
+	static inline void compress(const uint8_t *ip, struct bit_writer *w)
+	{
+		if (residue_bits != 0)
+			bit_writer_put(w, static_field_get<D, FIELDID>(ip), residue_bits);
+	}
+
+	static inline void pack(struct packed_field *row)
+	{
+		const struct packed_field packed = SCHC_ROW(FIELDID, FIELD_LENGTH,
+				DIRECTION, TV, MO, CDA, ARG);
+
+		*row = packed;
+	}
+};
+
+/**
+ * \brief The rows of a rule, checked and written one after the other.
+ */
+template <typename... Rows>
+struct schc_static_rows;
+
+template <>
+struct schc_static_rows<> {
+	static const int nfields = 0;
+	static const int residue_bits = 0;
+
+	template <int D>
+	static inline int match(const uint8_t *ip)
+	{
+		(void) ip;
+		return 1;
+	}
+
+	template <int D>
+	static inline void compress(const uint8_t *ip, struct bit_writer *w)
+	{
+		(void) ip;
+		(void) w;
+	}
+
+	static inline void pack(struct packed_field *rows)
+	{
+		(void) rows;
+	}
+};
+
+template <typename Row, typename... Rest>
+struct schc_static_rows<Row, Rest...> {
+	typedef schc_static_rows<Rest...> rest;
+
+	static const int nfields = 1 + rest::nfields;
+	static const int residue_bits = Row::residue_bits + rest::residue_bits;
+
+	template <int D>
+	static inline int match(const uint8_t *ip)
+	{
+		return Row::template match<D>(ip) && rest::template match<D>(ip);
+	}
+
+	template <int D>
+	static inline void compress(const uint8_t *ip, struct bit_writer *w)
+	{
+		Row::template compress<D>(ip, w);
+		rest::template compress<D>(ip, w);
+	}
+
+	static inline void pack(struct packed_field *rows)
+	{
+		Row::pack(rows);
+		rest::pack(rows + 1);
+	}
+};
+
+/**
+ * \brief A rule known at build time: its rows, in order.
+ */
+template <typename... Rows>
+struct schc_static_rule : schc_static_rows<Rows...> {
+	static_assert(sizeof...(Rows) <= SCHC_MAX_RULE_FIELDS, "too many rows");
+};
+
+/**
+ * \brief The rules of a rule set, looked at one after the other. ID is
+ * the Rule ID of the first one.
+ */
+template <int ID, typename... Rules>
+struct schc_static_rules;
+
+template <int ID>
+struct schc_static_rules<ID> {
+	static const int nrules = 0;
+	static const int nrows = 0;
+
+	template <int D>
+	static inline void select(const uint8_t *ip, int *rule_id, int *residue_bits)
+	{
+		(void) ip;
+		(void) rule_id;
+		(void) residue_bits;
+	}
+
+	template <int D>
+	static inline void compress(int rule_id, const uint8_t *ip, struct bit_writer *w)
+	{
+		(void) rule_id;
+		(void) ip;
+		(void) w;
+	}
+
+	static inline void pack(struct packed_field *rows)
+	{
+		(void) rows;
+	}
+};
+
+template <int ID, typename Rule, typename... Rest>
+struct schc_static_rules<ID, Rule, Rest...> {
+	typedef schc_static_rules<ID + 1, Rest...> rest;
+
+	static const int nrules = 1 + rest::nrules;
+	static const int nrows = Rule::nfields + 1 + rest::nrows;
+
+	/*
+	 * The rules are looked at in order of Rule ID, so a rule only
+	 * replaces the one found if its residue is strictly shorter, the
+	 * same as rule_is_better().
+	 */
+	template <int D>
+	static inline void select(const uint8_t *ip, int *rule_id, int *residue_bits)
+	{
+		if ((*rule_id < 0 || Rule::residue_bits < *residue_bits) &&
+		    Rule::template match<D>(ip)) {
+			*rule_id = ID;
+			*residue_bits = Rule::residue_bits;
+		}
+
+		rest::template select<D>(ip, rule_id, residue_bits);
+	}
+
+	template <int D>
+	static inline void compress(int rule_id, const uint8_t *ip, struct bit_writer *w)
+	{
+		if (rule_id == ID)
+			Rule::template compress<D>(ip, w);
+		else
+			rest::template compress<D>(rule_id, ip, w);
+	}
+
+	static inline void pack(struct packed_field *rows)
+	{
+		const struct packed_field end = SCHC_ROW_END;
+
+		Rule::pack(rows);
+		rows[Rule::nfields] = end;
+		rest::pack(rows + Rule::nfields + 1);
+	}
+};
+
+/**
+ * \brief A rule set known at build time: its rules, the first one has
+ * Rule ID 0.
+ */
+template <typename... Rules>
+struct schc_static_ruleset {
+	typedef schc_static_rules<0, Rules...> rules;
+
+	static_assert(sizeof...(Rules) <= SCHC_MAX_RULES, "too many rules");
+
+	/** Packed rows written by pack(), SCHC_ROW_END included */
+	static const int nrows = rules::nrows;
+
+	/**
+	 * \brief Same as schc_compress(), with these rules.
+	 */
+	static int compress(const uint8_t *ipv6_packet, size_t ipv6_packet_len,
+			enum direction direction, uint8_t *schc_packet,
+			size_t schc_packet_cap, size_t *schc_packet_len)
+	{
+		if (direction == DOWNLINK)
+			return compress_dir<DOWNLINK>(ipv6_packet, ipv6_packet_len,
+					schc_packet, schc_packet_cap, schc_packet_len);
+
+		return compress_dir<UPLINK>(ipv6_packet, ipv6_packet_len,
+				schc_packet, schc_packet_cap, schc_packet_len);
+	}
+
+	/**
+	 * \brief Writes the rules as packed rows (see struct packed_field),
+	 * nrows in all.
+	 */
+	static void pack(struct packed_field rows[nrows])
+	{
+		rules::pack(rows);
+	}
+
+#ifndef SCHC_FLASH_RULES
+	/**
+	 * \brief Compiles the same rules for schc_compress() and
+	 * schc_decompress().
+	 *
+	 * @return 0 if successfull, non-zero otherwise (see
+	 * schc_ruleset_compile_packed()).
+	 */
+	static int compile(struct schc_ruleset *ruleset)
+	{
+		struct packed_field rows[nrows];
+
+		pack(rows);
+
+		return schc_ruleset_compile_packed(ruleset, rows, nrows, NULL, 0);
+	}
+#endif
+
+private:
+	template <int D>
+	static int compress_dir(const uint8_t *ipv6_packet, size_t ipv6_packet_len,
+			uint8_t *schc_packet, size_t schc_packet_cap,
+			size_t *schc_packet_len)
+	{
+		if (ipv6_packet_len < SIZE_IPV6 + SIZE_UDP ||
+		    (ipv6_packet[0] >> 4) != 6 || ipv6_packet[6] != 17 /* UDP */) {
+			return -1;
+		}
+
+		int rule_id = -1;
+		int residue_bits = 0;
+
+		rules::template select<D>(ipv6_packet, &rule_id, &residue_bits);
+
+		if (rule_id < 0)
+			return -1;
+
+		struct bit_writer w;
+
+		bit_writer_init(&w, schc_packet, schc_packet_cap);
+		bit_writer_put(&w, rule_id, 8);
+		rules::template compress<D>(rule_id, ipv6_packet, &w);
+		bit_writer_put_bytes(&w, ipv6_packet + SIZE_IPV6 + SIZE_UDP,
+				ipv6_packet_len - SIZE_IPV6 - SIZE_UDP);
+
+		int len = bit_writer_finish(&w);
+
+		if (len < 0)
+			return -1;
+
+		*schc_packet_len = len;
+
+		return 0;
+	}
+};
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* STATIC_RULES_H */
+
+// vim:tw=72
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the timer.h functions.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "timer.h"
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+#define SLOT_MASK (SCHC_WHEEL_SLOTS - 1)
+
+/*
+ * A delay of zero would fall in the slot just processed, and one too
+ * long would wrap around the highest level.
+ */
+#define CLAMP_DELAY(d) ((d) == 0 ? 1 : (d) > SCHC_WHEEL_MAX_DELAY ? SCHC_WHEEL_MAX_DELAY : (d))
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+/*
+ * Links the timer in the slot of its expiration, on the level whose
+ * slots span the time left. The time left is at least one tick, so it
+ * never goes to the level 0 slot just processed.
+ */
+static void wheel_link(struct schc_wheel *wheel, struct schc_timer *timer)
+{
+	uint32_t delta = timer->expires - wheel->now;
+	int level = 0;
+
+	while (level < SCHC_WHEEL_LEVELS - 1 &&
+	       delta >= (1UL << (SCHC_WHEEL_BITS * (level + 1))))
+		level++;
+
+	struct schc_timer **head =
+		&wheel->slot[level][(timer->expires >> (SCHC_WHEEL_BITS * level)) & SLOT_MASK];
+
+	timer->next = *head;
+	if (*head != NULL)
+		(*head)->pprev = &timer->next;
+	timer->pprev = head;
+	*head = timer;
+}
+
+static void wheel_unlink(struct schc_timer *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next != NULL)
+		timer->next->pprev = timer->pprev;
+	timer->pprev = NULL;
+}
+
+/*
+ * Moves the timers of a slot of a higher level to the lower ones.
+ */
+static void wheel_cascade(struct schc_wheel *wheel, int level)
+{
+	struct schc_timer **head =
+		&wheel->slot[level][(wheel->now >> (SCHC_WHEEL_BITS * level)) & SLOT_MASK];
+	struct schc_timer *timer = *head;
+
+	*head = NULL;
+
+	while (timer != NULL) {
+		struct schc_timer *next = timer->next;
+
+		wheel_link(wheel, timer);
+		timer = next;
+	}
+}
+
+static void wheel_tick(struct schc_wheel *wheel)
+{
+	wheel->now++;
+
+	for (int level = 1 ; level < SCHC_WHEEL_LEVELS ; level++) {
+		if (wheel->now & ((1UL << (SCHC_WHEEL_BITS * level)) - 1))
+			break;
+		wheel_cascade(wheel, level);
+	}
+
+	struct schc_timer **head = &wheel->slot[0][wheel->now & SLOT_MASK];
+
+	/* The callbacks may add or cancel any timer, this one included */
+	while (*head != NULL) {
+		struct schc_timer *timer = *head;
+
+		wheel_unlink(timer);
+		wheel->pending--;
+		timer->cb(timer, timer->arg);
+	}
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+void schc_wheel_init(struct schc_wheel *wheel, uint32_t now)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now;
+}
+
+void schc_wheel_advance(struct schc_wheel *wheel, uint32_t now)
+{
+	while (wheel->now != now) {
+		/* Nothing can expire, jump */
+		if (wheel->pending == 0) {
+			wheel->now = now;
+			break;
+		}
+		wheel_tick(wheel);
+	}
+}
+
+void schc_timer_init(struct schc_timer *timer, schc_timer_cb cb, void *arg)
+{
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->expires = 0;
+	timer->cb = cb;
+	timer->arg = arg;
+}
+
+void schc_timer_add(struct schc_wheel *wheel, struct schc_timer *timer,
+		uint32_t delay)
+{
+	if (schc_timer_pending(timer))
+		wheel_unlink(timer);
+	else
+		wheel->pending++;
+
+	timer->expires = wheel->now + CLAMP_DELAY(delay);
+	wheel_link(wheel, timer);
+}
+
+void schc_timer_cancel(struct schc_wheel *wheel, struct schc_timer *timer)
+{
+	if (!schc_timer_pending(timer))
+		return;
+
+	wheel_unlink(timer);
+	wheel->pending--;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/**
+ * \file
+ *
+ * \brief Hierarchical timing wheel.
+ *
+ * The timers of the SCHC F/R sessions (reassembly inactivity, sender
+ * retransmission) are kept in a wheel of SCHC_WHEEL_LEVELS levels of
+ * SCHC_WHEEL_SLOTS slots each. A timer goes to the level whose slots
+ * are as wide as the time left, so adding and cancelling it is O(1),
+ * and every tick only looks at one slot: the timers of a higher level
+ * slot are moved down a level when the wheel reaches it.
+ *
+ * The wheel has no clock of its own, the caller makes it advance, for
+ * instance with millis() from loop(). The unit of the ticks is the one
+ * of that clock.
+ *
+ * The timers are embedded in the objects they belong to, the wheel
+ * never allocates memory.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * log2 of the number of slots per level, and number of levels. The
+ * longest delay is 2^(SCHC_WHEEL_BITS * SCHC_WHEEL_LEVELS) - 1 ticks,
+ * longer ones are cut to it. Both default to 2^24 ticks (4.6 hours of
+ * milliseconds), the AVR with fewer slots to save RAM.
+ */
+#ifndef SCHC_WHEEL_BITS
+#ifdef __AVR__
+#define SCHC_WHEEL_BITS 4
+#else
+#define SCHC_WHEEL_BITS 6
+#endif
+#endif
+
+#ifndef SCHC_WHEEL_LEVELS
+#define SCHC_WHEEL_LEVELS (24 / SCHC_WHEEL_BITS)
+#endif
+
+#define SCHC_WHEEL_SLOTS (1U << SCHC_WHEEL_BITS)
+#define SCHC_WHEEL_MAX_DELAY ((1UL << (SCHC_WHEEL_BITS * SCHC_WHEEL_LEVELS)) - 1)
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+struct schc_timer;
+
+/**
+ * \brief Called when a timer expires. The timer is not pending anymore,
+ * the callback can add it again.
+ */
+typedef void (*schc_timer_cb)(struct schc_timer *timer, void *arg);
+
+struct schc_timer {
+	struct schc_timer *next;
+	struct schc_timer **pprev; /** NULL if not pending */
+	uint32_t expires;
+	schc_timer_cb cb;
+	void *arg;
+};
+
+struct schc_wheel {
+	uint32_t now;
+	size_t pending;
+	struct schc_timer *slot[SCHC_WHEEL_LEVELS][SCHC_WHEEL_SLOTS];
+};
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Initializes an empty wheel whose clock reads now.
+ */
+void schc_wheel_init(struct schc_wheel *wheel, uint32_t now);
+
+/**
+ * \brief Advances the wheel to now, running the callbacks of the timers
+ * expired in between, in order of expiration.
+ */
+void schc_wheel_advance(struct schc_wheel *wheel, uint32_t now);
+
+/**
+ * \brief Initializes a timer, not pending.
+ */
+void schc_timer_init(struct schc_timer *timer, schc_timer_cb cb, void *arg);
+
+/**
+ * \brief Makes the timer expire delay ticks from now (at least one).
+ * If it was already pending, it is moved.
+ */
+void schc_timer_add(struct schc_wheel *wheel, struct schc_timer *timer,
+		uint32_t delay);
+
+/**
+ * \brief Cancels the timer, if it was pending.
+ */
+void schc_timer_cancel(struct schc_wheel *wheel, struct schc_timer *timer);
+
+static inline int schc_timer_pending(const struct schc_timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* TIMER_H */
+
+// vim:tw=72
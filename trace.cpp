@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+/**
+ * \file
+ * \brief Implementation of the trace.h functions.
+ *
+ * With the TSC, its frequency is measured when dumping, from the TSC
+ * and the steady clock read at schc_trace_attach() and read again.
+ */
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <cstring>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+#include "trace.h"
+
+/**********************************************************************/
+/***        Global Variables                                        ***/
+/**********************************************************************/
+
+SCHC_TRACE_THREAD_LOCAL struct schc_trace *schc_trace_current;
+
+/**********************************************************************/
+/***        Static Functions                                        ***/
+/**********************************************************************/
+
+static uint8_t *put_le(uint8_t *p, uint64_t v, int n)
+{
+	for (int i = 0 ; i < n ; i++)
+		*p++ = v >> (8 * i);
+
+	return p;
+}
+
+static uint32_t get_be32(const uint8_t *p, size_t len)
+{
+	uint32_t v = 0;
+
+	for (size_t i = 0 ; i < 4 ; i++)
+		v = (v << 8) | (i < len ? p[i] : 0);
+
+	return v;
+}
+
+#ifndef ARDUINO
+static uint64_t clock_ns(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static uint64_t ticks_per_second(const struct schc_trace *t)
+{
+#ifdef SCHC_TRACE_TSC
+	uint64_t ns = clock_ns() - t->attach_ns;
+	uint64_t tsc = __rdtsc() - t->attach_tsc;
+
+	if (ns == 0)
+		return 0;
+
+	/* ns is at most a few hours, no overflow */
+	return (uint64_t) ((double) tsc * 1e9 / ns);
+#elif defined(ARDUINO)
+	(void) t;
+	return 1000000;
+#else
+	(void) t;
+	return 1000000000;
+#endif
+}
+
+/**********************************************************************/
+/***        Public Functions                                        ***/
+/**********************************************************************/
+
+void schc_trace_attach(struct schc_trace *t)
+{
+	if (t != NULL) {
+		t->head = 0;
+#ifdef SCHC_TRACE_TSC
+		t->attach_ns = clock_ns();
+		t->attach_tsc = __rdtsc();
+#endif
+	}
+
+	schc_trace_current = t;
+}
+
+int schc_trace_dump(const struct schc_trace *t, schc_trace_sink sink, void *arg)
+{
+	uint8_t buf[SCHC_TRACE_HDR_LEN];
+	uint32_t n = t->head < SCHC_TRACE_LEN ? t->head : SCHC_TRACE_LEN;
+	uint8_t *p = buf;
+
+	memcpy(p, "SCTR", 4);
+	p = put_le(p + 4, SCHC_TRACE_VERSION, 4);
+	p = put_le(p, ticks_per_second(t), 8);
+	put_le(p, n, 4);
+
+	if (sink(buf, SCHC_TRACE_HDR_LEN, arg) != 0)
+		return -1;
+
+	for (uint32_t i = t->head - n ; i != t->head ; i++) {
+		const struct schc_trace_rec *r = &t->rec[i & (SCHC_TRACE_LEN - 1)];
+		uint8_t rec[SCHC_TRACE_REC_LEN];
+
+		p = put_le(rec, r->ticks, 8);
+		p = put_le(p, r->event, 4);
+		for (int a = 0 ; a < SCHC_TRACE_ARGS ; a++)
+			p = put_le(p, r->arg[a], 4);
+
+		if (sink(rec, SCHC_TRACE_REC_LEN, arg) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+void schc_trace_data(const uint8_t *data, size_t len)
+{
+	schc_trace_put(SCHC_EV_DATA, len, get_be32(data, len),
+		       len > 4 ? get_be32(data + 4, len - 4) : 0);
+}
+
+schc_trace_ticks_t schc_trace_clock(void)
+{
+#ifdef ARDUINO
+	return micros();
+#else
+	return clock_ns();
+#endif
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2018, Department of Information and Communication Engineering.
+ * University of Murcia. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author(s):
+ *            Jorge Gallego Madrid <jorge.gallego1@um.es>
+ *            Jesús Sánchez Gómez  <jesus.sanchez4@um.es>
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * \file
+ *
+ * \brief Binary trace log of the SCHC operations.
+ *
+ * A trace point writes a record (event, timestamp and up to three
+ * integers) into a ring of the calling thread, with no formatting and
+ * no lock: only the thread that owns a ring writes it, and the oldest
+ * records are overwritten. A trace point costs a few nanoseconds, so
+ * the timing of the code traced barely changes.
+ *
+ * The ring is written in binary with schc_trace_dump(), and the
+ * records are formatted offline by extras/trace/schc_trace:
+ *
+ * \verbatim
+ *      12.345678 compress          len 57 direction 0
+ *      12.345702 compressed        rule 5 residue bits 0 cached 1
+ * \endverbatim
+ *
+ * The trace points are compiled only with SCHC_TRACE defined (it can be
+ * uncommented below for the Arduino IDE), otherwise they are empty and
+ * their arguments are not evaluated.
+ */
+
+// #define SCHC_TRACE
+
+/**********************************************************************/
+/***        Include files                                           ***/
+/**********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if !defined(ARDUINO) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SCHC_TRACE_TSC
+#endif
+
+/**********************************************************************/
+/***        Local Include files                                     ***/
+/**********************************************************************/
+
+/**********************************************************************/
+/***        Macro Definitions                                       ***/
+/**********************************************************************/
+
+/**
+ * Records kept per ring, a power of two.
+ */
+#ifndef SCHC_TRACE_LEN
+#ifdef __AVR__
+#define SCHC_TRACE_LEN 16
+#else
+#define SCHC_TRACE_LEN 4096
+#endif
+#endif
+
+#define SCHC_TRACE_ARGS 3
+
+/**
+ * Layout of the dump: a header, then the records from the oldest one,
+ * all the integers in little endian.
+ *
+ * \verbatim
+ * header: "SCTR" | version (1) | 3 bytes 0 | ticks per second (8) | records (4)
+ * record: ticks (8) | event (2) | 2 bytes 0 | arg[0] (4) | arg[1] (4) | arg[2] (4)
+ * \endverbatim
+ */
+#define SCHC_TRACE_VERSION 1
+#define SCHC_TRACE_HDR_LEN 20
+#define SCHC_TRACE_REC_LEN 24
+
+/**
+ * The events, with the name and the printf() format of their arguments
+ * used by the decoder. New events go at the end, the decoder of older
+ * dumps relies on the numbers.
+ */
+#define SCHC_TRACE_EVENTS(X) \
+	X(COMPRESS,         "compress",         "len %u direction %u") \
+	X(COMPRESS_NO_RULE, "compress no rule", "len %u") \
+	X(COMPRESS_DONE,    "compressed",       "rule %u residue bits %u cached %u") \
+	X(RULE_MISS,        "rule miss",        "rule %u") \
+	X(DECOMPRESS,       "decompress",       "rule %u len %u") \
+	X(DECOMPRESS_ERROR, "decompress error", "len %u") \
+	X(DECOMPRESS_DONE,  "decompressed",     "rule %u len %u") \
+	X(FRAGMENT,         "fragment",         "len %u") \
+	X(FRAG_SEND,        "fragment sent",    "fcn %u len %u") \
+	X(REASS_INPUT,      "reass input",      "device %08x rule %u len %u") \
+	X(REASS_DONE,       "reassembled",      "device %08x") \
+	X(REASS_ERROR,      "reass error",      "device %08x") \
+	X(REASS_TIMEOUT,    "reass timeout",    "device %08x rule %u dtag %u") \
+	X(DATA,             "data",             "len %u: %08x %08x")
+
+#define SCHC_TRACE_ENUM(id, name, format) SCHC_EV_##id,
+
+#ifdef SCHC_TRACE
+
+#define SCHC_TRACE1(ev, a) \
+	schc_trace_put(SCHC_EV_##ev, (a), 0, 0)
+#define SCHC_TRACE2(ev, a, b) \
+	schc_trace_put(SCHC_EV_##ev, (a), (b), 0)
+#define SCHC_TRACE3(ev, a, b, c) \
+	schc_trace_put(SCHC_EV_##ev, (a), (b), (c))
+
+/**
+ * Records len and the first 8 bytes of data, as a DATA event.
+ */
+#define SCHC_TRACE_DATA(data, len) \
+	schc_trace_data((data), (len))
+
+#else /* SCHC_TRACE */
+
+#define SCHC_TRACE1(ev, a) do { } while (0)
+#define SCHC_TRACE2(ev, a, b) do { } while (0)
+#define SCHC_TRACE3(ev, a, b, c) do { } while (0)
+#define SCHC_TRACE_DATA(data, len) do { } while (0)
+
+#endif /* SCHC_TRACE */
+
+#ifdef ARDUINO
+#define SCHC_TRACE_THREAD_LOCAL
+#else
+#define SCHC_TRACE_THREAD_LOCAL thread_local
+#endif
+
+/**********************************************************************/
+/***        Types Definitions                                       ***/
+/**********************************************************************/
+
+enum schc_trace_event {
+	SCHC_TRACE_EVENTS(SCHC_TRACE_ENUM)
+	SCHC_EV_COUNT
+};
+
+#ifdef ARDUINO
+typedef uint32_t schc_trace_ticks_t;
+#else
+typedef uint64_t schc_trace_ticks_t;
+#endif
+
+struct schc_trace_rec {
+	schc_trace_ticks_t ticks;
+	uint16_t event;
+	uint32_t arg[SCHC_TRACE_ARGS];
+};
+
+struct schc_trace {
+	uint32_t head; /** Records written, the last SCHC_TRACE_LEN are kept */
+#ifdef SCHC_TRACE_TSC
+	/* To find the TSC frequency when dumping */
+	uint64_t attach_tsc;
+	uint64_t attach_ns;
+#endif
+	struct schc_trace_rec rec[SCHC_TRACE_LEN];
+};
+
+/**
+ * \brief Receives the dump, a piece at a time. Returns non-zero to stop
+ * the dump.
+ */
+typedef int (*schc_trace_sink)(const uint8_t *data, size_t len, void *arg);
+
+/**********************************************************************/
+/***        Global Variables                                        ***/
+/**********************************************************************/
+
+/**
+ * The ring of the calling thread, set by schc_trace_attach().
+ */
+extern SCHC_TRACE_THREAD_LOCAL struct schc_trace *schc_trace_current;
+
+/**********************************************************************/
+/***        Forward Declarations                                    ***/
+/**********************************************************************/
+
+/**
+ * \brief Empties t and makes it the ring of the calling thread. With
+ * NULL, the thread does not trace anymore.
+ */
+void schc_trace_attach(struct schc_trace *t);
+
+/**
+ * \brief Writes the records of t to sink, from the oldest one. It must
+ * not run while the owner of t writes it: call it from the owner
+ * thread, or once that thread is done.
+ *
+ * @return 0 if successfull, non-zero if the sink stopped the dump.
+ */
+int schc_trace_dump(const struct schc_trace *t, schc_trace_sink sink, void *arg);
+
+/**
+ * \brief The clock of the records where there is no TSC: nanoseconds on
+ * the host, microseconds on Arduino.
+ */
+schc_trace_ticks_t schc_trace_clock(void);
+
+/**
+ * \brief Used by SCHC_TRACE_DATA().
+ */
+void schc_trace_data(const uint8_t *data, size_t len);
+
+/**********************************************************************/
+/***        Inline Functions                                        ***/
+/**********************************************************************/
+
+/*
+ * The TSC on x86 hosts, as reading it is much faster than any clock.
+ * The dump tells its frequency.
+ */
+static inline schc_trace_ticks_t schc_trace_ticks(void)
+{
+#ifdef SCHC_TRACE_TSC
+	return __rdtsc();
+#else
+	return schc_trace_clock();
+#endif
+}
+
+/**
+ * \brief Used by the SCHC_TRACE macros.
+ */
+static inline void schc_trace_put(uint16_t event, uint32_t a, uint32_t b,
+		uint32_t c)
+{
+	struct schc_trace *t = schc_trace_current;
+
+	if (t == NULL)
+		return;
+
+	struct schc_trace_rec *r = &t->rec[t->head++ & (SCHC_TRACE_LEN - 1)];
+
+	r->ticks = schc_trace_ticks();
+	r->event = event;
+	r->arg[0] = a;
+	r->arg[1] = b;
+	r->arg[2] = c;
+}
+
+/**********************************************************************/
+/***        END OF FILE                                             ***/
+/**********************************************************************/
+
+#endif /* TRACE_H */
+
+// vim:tw=72